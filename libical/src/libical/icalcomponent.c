@@ -62,8 +62,20 @@ struct icalcomponent_impl
 	char* x_name;
 	pvl_list properties;
 	pvl_elem property_iterator;
-	pvl_list components;
-	pvl_elem component_iterator;
+
+	/** Children are kept in an intrusive doubly linked list: each
+	   child has the links to its siblings, so adding, walking and
+	   removing a child need no list elements and removing is O(1).
+	   component_iterator is the internal iterator of
+	   icalcomponent_get_first/next_component; icalcompiter is the
+	   reentrant one. */
+	icalcomponent* first_child;
+	icalcomponent* last_child;
+	int child_count;
+	unsigned int children_changes;	/**< see icalcomponent_get_children_changes */
+	icalcomponent* component_iterator;
+	icalcomponent* next_sibling;	/**< in parent's list of children */
+	icalcomponent* prior_sibling;
 	icalcomponent* parent;
 
 	/** An array of icaltimezone structs. We use this so we can do fast
@@ -72,6 +84,27 @@ struct icalcomponent_impl
 	   array before doing a binary search. */
 	icalarray* timezones;
 	int timezones_sorted;
+
+	/** The EXDATE values converted to UTC and sorted, so that
+	   icalproperty_recurrence_is_excluded() can do a binary search
+	   instead of walking all properties for every occurrence. Built
+	   on first use and dropped whenever an EXDATE is added or removed
+	   (changing the value of an EXDATE in place is not noticed). */
+	icalarray* exdates;
+
+	/** The first property of each kind present, as
+	   icalcomponent_property_slot structs sorted by kind, so that
+	   icalcomponent_get_first_property() finds a kind with a binary
+	   search over the few kinds a component has instead of walking
+	   all properties. Built on first use, kept up to date by
+	   icalcomponent_add/remove_property(). */
+	icalarray* property_index;
+};
+
+struct icalcomponent_property_slot
+{
+	icalproperty_kind kind;
+	pvl_elem first;
 };
 
 /* icalproperty functions that only components get to use */
@@ -80,6 +113,12 @@ void icalproperty_set_parent(icalproperty* property,
 icalcomponent* icalproperty_get_parent(icalproperty* property);
 void icalcomponent_add_children(icalcomponent *impl,va_list args);
 static icalcomponent* icalcomponent_new_impl (icalcomponent_kind kind);
+static void icalcomponent_drop_exdates (icalcomponent *comp);
+static struct icalcomponent_property_slot *icalcomponent_find_property_slot
+				(icalcomponent *comp, icalproperty_kind kind);
+static void icalcomponent_index_property (icalcomponent *comp, pvl_elem elem);
+static void icalcomponent_unindex_property (icalcomponent *comp,
+					    pvl_elem elem);
 
 static void icalcomponent_merge_vtimezone (icalcomponent *comp,
 					   icalcomponent *vtimezone,
@@ -136,12 +175,19 @@ icalcomponent_new_impl (icalcomponent_kind kind)
     comp->kind = kind;
     comp->properties = pvl_newlist();
     comp->property_iterator = 0;
-    comp->components = pvl_newlist();
+    comp->first_child = 0;
+    comp->last_child = 0;
+    comp->child_count = 0;
+    comp->children_changes = 0;
     comp->component_iterator = 0;
+    comp->next_sibling = 0;
+    comp->prior_sibling = 0;
     comp->x_name = 0;
     comp->parent = 0;
     comp->timezones = NULL;
     comp->timezones_sorted = 1;
+    comp->exdates = NULL;
+    comp->property_index = NULL;
 
     return comp;
 }
@@ -208,11 +254,8 @@ icalcomponent* icalcomponent_new_clone(icalcomponent* old)
     }
    
    
-    for( itr = pvl_head(old->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for( c = old->first_child; c != 0; c = c->next_sibling)
     {	
-	c = (icalcomponent*)pvl_data(itr);
 	icalcomponent_add_component(new,icalcomponent_new_clone(c));
     }
 
@@ -251,13 +294,10 @@ icalcomponent_free (icalcomponent* c)
 		}
       
 
-       while( (comp=pvl_data(pvl_head(c->components))) != 0){
-	   assert(comp!=0);
+       while( (comp=c->first_child) != 0){
 	   icalcomponent_remove_component(c,comp);
 	   icalcomponent_free(comp);
        }
-       
-       pvl_free(c->components);
 
 	if (c->x_name != 0) {
 	    free(c->x_name);
@@ -266,14 +306,23 @@ icalcomponent_free (icalcomponent* c)
 	if (c->timezones)
 	    icaltimezone_array_free (c->timezones);
 
+	if (c->exdates)
+	    icalarray_free (c->exdates);
+
+	if (c->property_index)
+	    icalarray_free (c->property_index);
+
 	c->kind = ICAL_NO_COMPONENT;
 	c->properties = 0;
 	c->property_iterator = 0;
-	c->components = 0;
+	c->first_child = 0;
+	c->last_child = 0;
 	c->component_iterator = 0;
 	c->x_name = 0;	
 	c->id[0] = 'X';
 	c->timezones = NULL;
+	c->exdates = NULL;
+	c->property_index = NULL;
 
 	free(c);
     }
@@ -333,12 +382,8 @@ icalcomponent_as_ical_string (icalcomponent* impl)
     }
    
    
-   for( itr = pvl_head(impl->components);
-	itr != 0;
-	itr = pvl_next(itr))
+   for( c = impl->first_child; c != 0; c = c->next_sibling)
    {	
-       c = (icalcomponent*)pvl_data(itr);
-       
        tmp_buf = icalcomponent_as_ical_string(c);
        
        icalmemory_append_string(&buf, &buf_ptr, &buf_size, tmp_buf);
@@ -410,6 +455,13 @@ icalcomponent_add_property (icalcomponent* component, icalproperty* property)
     icalproperty_set_parent(property,component);
 
     pvl_push(component->properties,property);
+
+    if (component->property_index)
+	icalcomponent_index_property(component,
+				     pvl_tail(component->properties));
+
+    if (icalproperty_isa(property) == ICAL_EXDATE_PROPERTY)
+	icalcomponent_drop_exdates(component);
 }
 
 
@@ -436,10 +488,16 @@ icalcomponent_remove_property (icalcomponent* component, icalproperty* property)
 	       component->property_iterator = pvl_next(itr);
 	   }
 
+	   if (component->property_index)
+	       icalcomponent_unindex_property(component, itr);
+
 	   pvl_remove( component->properties, itr); 
 	  icalproperty_set_parent(property,0);
 	}
     }	
+
+    if (icalproperty_isa(property) == ICAL_EXDATE_PROPERTY)
+	icalcomponent_drop_exdates(component);
 }
 
 int
@@ -481,6 +539,14 @@ icalproperty*
 icalcomponent_get_first_property (icalcomponent* c, icalproperty_kind kind)
 {
    icalerror_check_arg_rz( (c!=0),"component");
+
+   if (kind != ICAL_ANY_PROPERTY) {
+       struct icalcomponent_property_slot *slot;
+
+       slot = icalcomponent_find_property_slot(c, kind);
+       c->property_iterator = slot ? slot->first : 0;
+       return slot ? (icalproperty*) pvl_data(slot->first) : 0;
+   }
   
    for( c->property_iterator = pvl_head(c->properties);
 	c->property_iterator != 0;
@@ -533,11 +599,22 @@ icalcomponent_add_component (icalcomponent* parent, icalcomponent* child)
     
     if (child->parent !=0) {
         icalerror_set_errno(ICAL_USAGE_ERROR);
+	/* The sibling links can only be in one list, so take the child
+	   out of the old parent first to keep that list intact. */
+	icalcomponent_remove_component(child->parent, child);
     }
 
     child->parent = parent;
 
-    pvl_push(parent->components,child);
+    child->next_sibling = 0;
+    child->prior_sibling = parent->last_child;
+    if (parent->last_child != 0)
+	parent->last_child->next_sibling = child;
+    else
+	parent->first_child = child;
+    parent->last_child = child;
+    parent->child_count++;
+    parent->children_changes++;
 
     /* If the new component is a VTIMEZONE, add it to our array. */
     if (child->kind == ICAL_VTIMEZONE_COMPONENT) {
@@ -557,10 +634,14 @@ icalcomponent_add_component (icalcomponent* parent, icalcomponent* child)
 void
 icalcomponent_remove_component (icalcomponent* parent, icalcomponent* child)
 {
-   pvl_elem itr, next_itr;
-
    icalerror_check_arg_rv( (parent!=0), "parent");
    icalerror_check_arg_rv( (child!=0), "child");
+
+   if (child->parent != parent) {
+       /* not our child, nothing to remove */
+       icalerror_set_errno(ICAL_USAGE_ERROR);
+       return;
+   }
    
     /* If the component is a VTIMEZONE, remove it from our array as well. */
     if (child->kind == ICAL_VTIMEZONE_COMPONENT) {
@@ -578,27 +659,27 @@ icalcomponent_remove_component (icalcomponent* parent, icalcomponent* child)
 	}
     }
 
-   for( itr = pvl_head(parent->components);
-	itr != 0;
-	itr = next_itr)
-   {
-       next_itr = pvl_next(itr);
-       
-       if( pvl_data(itr) == (void*)child ){
+   if (parent->component_iterator == child){
+       /* Don't let the current iterator become invalid */
 
-	   if (parent->component_iterator == itr){
-	       /* Don't let the current iterator become invalid */
+       /* HACK. The semantics for this are troubling. */
+       parent->component_iterator = child->next_sibling;
+   }
 
-	       /* HACK. The semantics for this are troubling. */
-	       parent->component_iterator = 
-		   pvl_next(parent->component_iterator);
-	          
-	   }
-	   pvl_remove( parent->components, itr); 
-	   child->parent = 0;
-	   break;
-       }
-   }	
+   if (child->prior_sibling != 0)
+       child->prior_sibling->next_sibling = child->next_sibling;
+   else
+       parent->first_child = child->next_sibling;
+   if (child->next_sibling != 0)
+       child->next_sibling->prior_sibling = child->prior_sibling;
+   else
+       parent->last_child = child->prior_sibling;
+   parent->child_count--;
+   parent->children_changes++;
+
+   child->next_sibling = 0;
+   child->prior_sibling = 0;
+   child->parent = 0;
 }
 
 
@@ -607,16 +688,16 @@ icalcomponent_count_components (icalcomponent* component,
 				icalcomponent_kind kind)
 {
     int count=0;
-    pvl_elem itr;
+    icalcomponent *c;
 
     icalerror_check_arg_rz( (component!=0), "component");
 
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    if (kind == ICAL_ANY_COMPONENT)
+	return component->child_count;
+
+    for( c = component->first_child; c != 0; c = c->next_sibling)
     {
-	if(kind == icalcomponent_isa((icalcomponent*)pvl_data(itr)) ||
-	    kind == ICAL_ANY_COMPONENT){
+	if(kind == c->kind){
 	    count++;
 	}
     }
@@ -624,6 +705,14 @@ icalcomponent_count_components (icalcomponent* component,
     return count;
 }
 
+unsigned int
+icalcomponent_get_children_changes (icalcomponent* component)
+{
+    icalerror_check_arg_rz( (component!=0), "component");
+
+    return component->children_changes;
+}
+
 icalcomponent*
 icalcomponent_get_current_component(icalcomponent* component)
 {
@@ -633,7 +722,7 @@ icalcomponent_get_current_component(icalcomponent* component)
        return 0;
    }
 
-   return (icalcomponent*) pvl_data(component->component_iterator);
+   return component->component_iterator;
 }
 
 icalcomponent*
@@ -642,13 +731,13 @@ icalcomponent_get_first_component (icalcomponent* c,
 {
    icalerror_check_arg_rz( (c!=0),"component");
   
-   for( c->component_iterator = pvl_head(c->components);
+   for( c->component_iterator = c->first_child;
 	c->component_iterator != 0;
-	c->component_iterator = pvl_next(c->component_iterator)) {
+	c->component_iterator = c->component_iterator->next_sibling) {
 	    
-       icalcomponent *p =  (icalcomponent*) pvl_data(c->component_iterator);
+       icalcomponent *p =  c->component_iterator;
 	
-	   if (icalcomponent_isa(p) == kind || kind == ICAL_ANY_COMPONENT) {
+	   if (p->kind == kind || kind == ICAL_ANY_COMPONENT) {
 	       
 	       return p;
 	   }
@@ -667,13 +756,13 @@ icalcomponent_get_next_component (icalcomponent* c, icalcomponent_kind kind)
        return 0;
    }
 
-   for( c->component_iterator = pvl_next(c->component_iterator);
+   for( c->component_iterator = c->component_iterator->next_sibling;
 	c->component_iterator != 0;
-	c->component_iterator = pvl_next(c->component_iterator)) {
+	c->component_iterator = c->component_iterator->next_sibling) {
 	    
-       icalcomponent *p =  (icalcomponent*) pvl_data(c->component_iterator);
+       icalcomponent *p =  c->component_iterator;
 	
-	   if (icalcomponent_isa(p) == kind || kind == ICAL_ANY_COMPONENT) {
+	   if (p->kind == kind || kind == ICAL_ANY_COMPONENT) {
 	       
 	       return p;
 	   }
@@ -805,6 +894,158 @@ icaltime_span icalcomponent_get_span(icalcomponent* comp)
 
 }
 
+/**
+ * A function to compare 2 UTC times for qsort(). Dates sort before the
+ * date-times of the same day.
+ */
+static int icalcomponent_compare_exdate_fn (const void *elem1,
+					    const void *elem2)
+{
+    const struct icaltimetype *a = elem1, *b = elem2;
+
+    if (a->year != b->year)
+	return a->year - b->year;
+    if (a->month != b->month)
+	return a->month - b->month;
+    if (a->day != b->day)
+	return a->day - b->day;
+    if (a->is_date != b->is_date)
+	return b->is_date - a->is_date;
+    if (a->hour != b->hour)
+	return a->hour - b->hour;
+    if (a->minute != b->minute)
+	return a->minute - b->minute;
+    return a->second - b->second;
+}
+
+static void icalcomponent_drop_exdates (icalcomponent *comp)
+{
+    if (comp->exdates) {
+	icalarray_free (comp->exdates);
+	comp->exdates = NULL;
+    }
+}
+
+static int icalcomponent_compare_property_slot_fn (const void *elem1,
+						   const void *elem2)
+{
+    const struct icalcomponent_property_slot *a = elem1, *b = elem2;
+
+    return (int)a->kind - (int)b->kind;
+}
+
+/**
+ * Add the property in elem to the property index of comp if it is the
+ * first property of its kind.  Properties are only ever appended, so an
+ * existing slot never changes.
+ */
+static void icalcomponent_index_property (icalcomponent *comp, pvl_elem elem)
+{
+    struct icalcomponent_property_slot slot;
+    unsigned int i;
+
+    slot.kind = icalproperty_isa((icalproperty*)pvl_data(elem));
+    slot.first = elem;
+
+    for (i = 0; i < comp->property_index->num_elements; i++) {
+	struct icalcomponent_property_slot *s =
+	    icalarray_element_at (comp->property_index, i);
+	if (s->kind == slot.kind)
+	    return;
+    }
+
+    icalarray_append (comp->property_index, &slot);
+    icalarray_sort (comp->property_index,
+		    icalcomponent_compare_property_slot_fn);
+}
+
+/**
+ * Take the property in elem out of the property index of comp before it
+ * is removed from the property list, moving its slot to the next
+ * property of the same kind if there is one.
+ */
+static void icalcomponent_unindex_property (icalcomponent *comp,
+					    pvl_elem elem)
+{
+    struct icalcomponent_property_slot *slot;
+    icalproperty_kind kind = icalproperty_isa((icalproperty*)pvl_data(elem));
+    unsigned int i;
+
+    for (i = 0; i < comp->property_index->num_elements; i++) {
+	slot = icalarray_element_at (comp->property_index, i);
+	if (slot->kind != kind || slot->first != elem)
+	    continue;
+
+	for (slot->first = pvl_next(elem);
+	     slot->first != 0;
+	     slot->first = pvl_next(slot->first)) {
+	    if (icalproperty_isa((icalproperty*)pvl_data(slot->first)) == kind)
+		return;
+	}
+	icalarray_remove_element_at (comp->property_index, i);
+	return;
+    }
+}
+
+/**
+ * Find the slot of the first property of the given kind in comp, building
+ * the property index if it does not exist yet.  Returns NULL if comp has
+ * no property of that kind.
+ */
+static struct icalcomponent_property_slot *icalcomponent_find_property_slot
+				(icalcomponent *comp, icalproperty_kind kind)
+{
+    struct icalcomponent_property_slot *slot;
+    pvl_elem itr;
+    int low, high, mid;
+
+    if (!comp->property_index) {
+	comp->property_index =
+	    icalarray_new (sizeof (struct icalcomponent_property_slot), 8);
+	for (itr = pvl_head(comp->properties); itr != 0; itr = pvl_next(itr))
+	    icalcomponent_index_property (comp, itr);
+    }
+
+    low = 0;
+    high = comp->property_index->num_elements - 1;
+    while (low <= high) {
+	mid = (low + high) / 2;
+	slot = icalarray_element_at (comp->property_index, mid);
+	if (slot->kind == kind)
+	    return slot;
+	if (slot->kind < kind)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Build the sorted EXDATE array of comp if it does not exist yet.
+ */
+static icalarray *icalcomponent_get_exdates (icalcomponent *comp)
+{
+    icalproperty *exdate;
+    struct icaltimetype t;
+
+    if (comp->exdates)
+	return comp->exdates;
+
+    comp->exdates = icalarray_new (sizeof (struct icaltimetype), 8);
+    for (exdate = icalcomponent_get_first_property(comp,ICAL_EXDATE_PROPERTY);
+	 exdate != NULL;
+	 exdate = icalcomponent_get_next_property(comp,ICAL_EXDATE_PROPERTY)) {
+	t = icaltime_convert_to_zone (icalproperty_get_exdate(exdate),
+				      icaltimezone_get_utc_timezone());
+	icalarray_append (comp->exdates, &t);
+    }
+    icalarray_sort (comp->exdates, icalcomponent_compare_exdate_fn);
+
+    return comp->exdates;
+}
+
 /**
  * Decide if this recurrance is acceptable
  * 
@@ -817,21 +1058,19 @@ icaltime_span icalcomponent_get_span(icalcomponent* comp)
  * This function decides if a specific recurrence value is
  * excluded by EXRULE or EXDATE properties.
  *
- * It's not the most efficient code.  You might get better performance
- * if you assume that recurtime is always increasing for each
- * call. Then you could:
- *
- *   - sort the EXDATE values
- *   - save the state of each EXRULE iterator for the next call.
- * 
- * In this case though you don't need to worry how you call this
- * function.  It will always return the correct result.
+ * The EXDATE values are kept sorted in the component (see
+ * icalcomponent_get_exdates), so they are checked with a binary search.
+ * EXRULEs are positioned directly at recurtime with
+ * icalrecur_iterator_set_start() where the rule allows it.
  */
 
 int icalproperty_recurrence_is_excluded(icalcomponent *comp,
 				       struct icaltimetype *dtstart,
 				       struct icaltimetype *recurtime) {
-  icalproperty *exdate, *exrule;
+  icalproperty *exrule;
+  icalarray *exdates;
+  struct icaltimetype utc, *ex;
+  int lower, upper, middle, cmp;
 
   if (comp == NULL || 
       dtstart == NULL || 
@@ -841,24 +1080,40 @@ int icalproperty_recurrence_is_excluded(icalcomponent *comp,
     return 1;	
 
   /** first test against the exdate values **/
-  for (exdate = icalcomponent_get_first_property(comp,ICAL_EXDATE_PROPERTY);
-       exdate != NULL;
-       exdate = icalcomponent_get_next_property(comp,ICAL_EXDATE_PROPERTY)) {
-	 
-    struct icaltimetype exdatetime = icalproperty_get_exdate(exdate);
+  exdates = icalcomponent_get_exdates(comp);
+  if (exdates->num_elements) {
+    utc = icaltime_convert_to_zone(*recurtime,
+				   icaltimezone_get_utc_timezone());
+
+    /* find the first value on the same day as recurtime */
+    lower = 0;
+    upper = exdates->num_elements;
+    while (lower < upper) {
+      middle = (lower + upper) >> 1;
+      ex = icalarray_element_at(exdates, middle);
+      cmp = (ex->year - utc.year) * 512 + (ex->month - utc.month) * 32
+	+ (ex->day - utc.day);
+      if (cmp < 0)
+	lower = middle + 1;
+      else
+	upper = middle;
+    }
 
     /* JK 11-Feb-2009: Changed this to compare only dates. Like EXDATE
      * says, it really makes more sense to exclude full dates instead of
      * times. Standard seems to disagree to this and say that this can be
      * time also */
-    /*
-    if (icaltime_compare(*recurtime, exdatetime) == 0) {
-    */
-    if ((icaltime_is_date(exdatetime) 
-    &&   icaltime_compare_date_only(*recurtime, exdatetime) == 0)
-        || (icaltime_compare(*recurtime, exdatetime) == 0)) {
-      /** MATCHED **/
-      return 1;
+    for (; lower < (int)exdates->num_elements; lower++) {
+      ex = icalarray_element_at(exdates, lower);
+      if (ex->year != utc.year || ex->month != utc.month
+	  || ex->day != utc.day)
+	break;
+      if (ex->is_date
+	  || (!utc.is_date && ex->hour == utc.hour
+	      && ex->minute == utc.minute && ex->second == utc.second)) {
+	/** MATCHED **/
+	return 1;
+      }
     }
   }
 
@@ -871,6 +1126,10 @@ int icalproperty_recurrence_is_excluded(icalcomponent *comp,
     icalrecur_iterator *exrule_itr  = icalrecur_iterator_new(recur, *dtstart);
     struct icaltimetype exrule_time;
 
+    if (exrule_itr == NULL)
+      continue;
+    icalrecur_iterator_set_start(exrule_itr, *recurtime);
+
     while (1) {
       int result;
       exrule_time = icalrecur_iterator_next(exrule_itr);
@@ -883,7 +1142,7 @@ int icalproperty_recurrence_is_excluded(icalcomponent *comp,
 	icalrecur_iterator_free(exrule_itr);
 	return 1; /** MATCH **/
       }
-      if (result == 1)
+      if (result == -1)
 	break;    /** exrule_time > recurtime **/
     }
 
@@ -1031,9 +1290,13 @@ void icalcomponent_foreach_recurrence(icalcomponent* comp,
 
     struct icalrecurrencetype recur = icalproperty_get_rrule(rrule);
     icalrecur_iterator *rrule_itr  = icalrecur_iterator_new(recur, dtstart);
-    struct icaltimetype rrule_time = icalrecur_iterator_next(rrule_itr);
-    /** note that icalrecur_iterator_next always returns dtstart
-	the first time.. **/
+    struct icaltimetype rrule_time, first_start = start;
+
+    /** skip the occurrences which end before the range starts **/
+    if (!icaltime_is_null_time(start)) {
+      icaltime_adjust(&first_start, 0, 0, 0, -dtduration);
+      icalrecur_iterator_set_start(rrule_itr, first_start);
+    }
     
     while (1) {
       rrule_time = icalrecur_iterator_next(rrule_itr);
@@ -1041,11 +1304,21 @@ void icalcomponent_foreach_recurrence(icalcomponent* comp,
       if (icaltime_is_null_time(rrule_time)) 
 	break;
 
+      /** DTSTART was handled above **/
+      if (icaltime_compare(rrule_time, dtstart) == 0)
+	continue;
+
       dur = icaltime_subtract(rrule_time, dtstart);
 
       recurspan.start = basespan.start + icaldurationtype_as_int(dur);
       recurspan.end   = recurspan.start + dtduration;
 
+      /** occurrences come in order period by period, but not always
+	  within one; a period is at most a year long **/
+      if (!icaltime_is_null_time(end)
+	  && recurspan.start > limit_end + 366*24*60*60)
+	break;
+
       /** save the iterator ICK! **/
       property_iterator = comp->property_iterator;
 
@@ -1128,12 +1401,8 @@ int icalcomponent_count_errors(icalcomponent* component)
     }
 
 
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for( c = component->first_child; c != 0; c = c->next_sibling)
     {	
-	c = (icalcomponent*)pvl_data(itr);
-	
 	errors += icalcomponent_count_errors(c);
 	
     }
@@ -1161,11 +1430,8 @@ void icalcomponent_strip_errors(icalcomponent* component)
 	}
     }
     
-    for( itr = pvl_head(component->components);
-	 itr != 0;
-	 itr = pvl_next(itr))
+    for( c = component->first_child; c != 0; c = c->next_sibling)
     {	
-	c = (icalcomponent*)pvl_data(itr);
 	icalcomponent_strip_errors(c);
     }
 }
@@ -1337,20 +1603,18 @@ icalcompiter
 icalcomponent_begin_component(icalcomponent* component,icalcomponent_kind kind)
 {
     icalcompiter itr;
-    pvl_elem i;
+    icalcomponent *c;
 
     itr.kind = kind;
     itr.iter = NULL;
 
     icalerror_check_arg_re(component!=0,"component",icalcompiter_null);
 
-    for( i = pvl_head(component->components); i != 0; i = pvl_next(i)) {
+    for( c = component->first_child; c != 0; c = c->next_sibling) {
 	
-	icalcomponent *c =  (icalcomponent*) pvl_data(i);
-	
-	if (icalcomponent_isa(c) == kind || kind == ICAL_ANY_COMPONENT) {
+	if (c->kind == kind || kind == ICAL_ANY_COMPONENT) {
 	    
-	    itr.iter = i;
+	    itr.iter = c;
 
 	    return itr;
 	}
@@ -1363,19 +1627,17 @@ icalcompiter
 icalcomponent_end_component(icalcomponent* component,icalcomponent_kind kind)
 {
     icalcompiter itr; 
-    pvl_elem i;
+    icalcomponent *c;
 
     itr.kind = kind;
 
     icalerror_check_arg_re(component!=0,"component",icalcompiter_null);
 
-    for( i = pvl_tail(component->components); i != 0; i = pvl_prior(i)) {
-	
-	icalcomponent *c =  (icalcomponent*) pvl_data(i);
+    for( c = component->last_child; c != 0; c = c->prior_sibling) {
 	
-	if (icalcomponent_isa(c) == kind || kind == ICAL_ANY_COMPONENT) {
+	if (c->kind == kind || kind == ICAL_ANY_COMPONENT) {
 	    
-	    itr.iter = pvl_next(i);
+	    itr.iter = c->next_sibling;
 
 	    return itr;
 	}
@@ -1393,13 +1655,13 @@ icalcomponent* icalcompiter_next(icalcompiter* i)
 
    icalerror_check_arg_rz( (i!=0),"i");
 
-   for( i->iter = pvl_next(i->iter);
+   for( i->iter = i->iter->next_sibling;
 	i->iter != 0;
-	i->iter = pvl_next(i->iter)) {
+	i->iter = i->iter->next_sibling) {
 	    
-       icalcomponent *c =  (icalcomponent*) pvl_data(i->iter);
+       icalcomponent *c =  i->iter;
 	
-	   if (icalcomponent_isa(c) == i->kind 
+	   if (c->kind == i->kind 
 	       || i->kind == ICAL_ANY_COMPONENT) {
 	       
 	       return icalcompiter_deref(i);;
@@ -1416,13 +1678,13 @@ icalcomponent* icalcompiter_prior(icalcompiter* i)
        return 0;
    }
 
-   for( i->iter = pvl_prior(i->iter);
+   for( i->iter = i->iter->prior_sibling;
 	i->iter != 0;
-	i->iter = pvl_prior(i->iter)) {
+	i->iter = i->iter->prior_sibling) {
 	    
-       icalcomponent *c =  (icalcomponent*) pvl_data(i->iter);
+       icalcomponent *c =  i->iter;
 	
-	   if (icalcomponent_isa(c) == i->kind 
+	   if (c->kind == i->kind 
 	       || i->kind == ICAL_ANY_COMPONENT) {
 	       
 	       return icalcompiter_deref(i);;
@@ -1438,7 +1700,7 @@ icalcomponent* icalcompiter_deref(icalcompiter* i)
 	return 0;
     }
 
-    return pvl_data(i->iter);
+    return i->iter;
 }
 
 icalcomponent* icalcomponent_get_inner(icalcomponent* comp)
@@ -45,7 +45,7 @@ typedef struct _icaltimezone		icaltimezone;
 typedef struct icalcompiter
 {
 	icalcomponent_kind kind;
-	pvl_elem iter;
+	icalcomponent* iter;	/**< current child */
 
 } icalcompiter;
 
@@ -105,6 +105,12 @@ void icalcomponent_remove_component(icalcomponent* parent,
 int icalcomponent_count_components(icalcomponent* component,
 				   icalcomponent_kind kind);
 
+/**
+   Returns a number which grows every time a child component is added to
+   or removed from component. Comparing it with an earlier value tells if
+   pointers to the children that were cached then are still valid. */
+unsigned int icalcomponent_get_children_changes(icalcomponent* component);
+
 /**
    This takes 2 VCALENDAR components and merges the second one into the first,
    resolving any problems with conflicting TZIDs. comp_to_merge will no
@@ -546,6 +546,42 @@ static int line_is_blank(char* line){
     return 1;
 }
 
+/* Collect the top level components returned by icalparser_add_line.
+   Returns the new root. */
+static icalcomponent* icalparser_add_root(icalparser *parser,
+					  icalcomponent *root,
+					  icalcomponent *c)
+{
+    if(icalcomponent_get_parent(c) !=0){
+	/* This is bad news... assert? */
+    }	    
+	    
+    assert(parser->root_component == 0);
+    assert(pvl_count(parser->components) ==0);
+
+    if (root == 0){
+	/* Just one component */
+	root = c;
+    } else if(icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
+	/*Got a second component, so move the two components under
+	  an XROOT container */
+	icalcomponent *tempc = icalcomponent_new(ICAL_XROOT_COMPONENT);
+	icalcomponent_add_component(tempc, root);
+	icalcomponent_add_component(tempc, c);
+	root = tempc;
+    } else if(icalcomponent_isa(root) == ICAL_XROOT_COMPONENT) {
+	/* Already have an XROOT container, so add the component
+	   to it*/
+	icalcomponent_add_component(root, c);
+		
+    } else {
+	/* Badness */
+	assert(0);
+    }
+
+    return root;
+}
+
 icalcomponent* icalparser_parse(icalparser *parser,
 				char* (*line_gen_func)(char *s, size_t size, 
 						       void* d))
@@ -565,36 +601,8 @@ icalcomponent* icalparser_parse(icalparser *parser,
 	    line = icalparser_get_line(parser, line_gen_func);
 
 	if ((c = icalparser_add_line(parser,line)) != 0){
-
-	    if(icalcomponent_get_parent(c) !=0){
-		/* This is bad news... assert? */
-	    }	    
-	    
-	    assert(parser->root_component == 0);
-	    assert(pvl_count(parser->components) ==0);
-
-	    if (root == 0){
-		/* Just one component */
-		root = c;
-	    } else if(icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
-		/*Got a second component, so move the two components under
-		  an XROOT container */
-		icalcomponent *tempc = icalcomponent_new(ICAL_XROOT_COMPONENT);
-		icalcomponent_add_component(tempc, root);
-		icalcomponent_add_component(tempc, c);
-		root = tempc;
-	    } else if(icalcomponent_isa(root) == ICAL_XROOT_COMPONENT) {
-		/* Already have an XROOT container, so add the component
-		   to it*/
-		icalcomponent_add_component(root, c);
-		
-	    } else {
-		/* Badness */
-		assert(0);
-	    }
-
+	    root = icalparser_add_root(parser, root, c);
 	    c = 0;
-
         }
 	cont = 0;
 	if(line != 0){
@@ -609,6 +617,84 @@ icalcomponent* icalparser_parse(icalparser *parser,
 
 }
 
+/**
+ * Parse a whole ical stream held in a writable buffer, normally a
+ * private memory mapping of a calendar file. Content lines are handed to
+ * icalparser_add_line in place: the line end is overwritten with a NUL and
+ * folded lines are unfolded by moving the continuation data down, so
+ * every byte is copied at most once instead of going through the line
+ * generator and temp buffers of icalparser_parse. The buffer contents are
+ * destroyed.
+ */
+icalcomponent* icalparser_parse_buffer(icalparser *parser,
+				       char *buf, size_t size)
+{
+    char *p = buf;
+    char *end = buf + size;
+    char *line, *line_p, *nl, *seg_end, *last;
+    icalcomponent *c;
+    icalcomponent *root=0;
+    icalerrorstate es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+
+    icalerror_check_arg_rz((parser !=0),"parser");
+    icalerror_check_arg_rz((buf !=0 || size == 0),"buf");
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,ICAL_ERROR_NONFATAL);
+
+    while (p < end) {
+	line = line_p = p;
+
+	/* Copy the physical lines of one content line together. The
+	   continuation line is always behind the write position, so
+	   moving it down is safe */
+	while (1) {
+	    nl = memchr(p, '\n', end - p);
+	    seg_end = nl ? nl : end;
+	    if (line_p != p)
+		memmove(line_p, p, seg_end - p);
+	    line_p += seg_end - p;
+	    p = nl ? nl + 1 : end;
+
+	    if (nl && p < end && *p == ' ' && line_p > line) {
+		/* continuation line: drop the CRLF and the leading space */
+		if (*(line_p-1) == '\r')
+		    line_p--;
+		p++;
+	    } else {
+		break;
+	    }
+	}
+
+	/* Erase the final carriage return and trailing white space */
+	while (line_p > line && (*(line_p-1) == '\r' || iswspace((unsigned char)*(line_p-1))))
+	    line_p--;
+
+	last = 0;
+	if (line_p < end) {
+	    *line_p = '\0';
+	} else {
+	    /* last line without newline, no room for the NUL */
+	    if ((last = malloc(line_p - line + 1)) == 0) {
+		icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+		break;
+	    }
+	    memcpy(last, line, line_p - line);
+	    last[line_p - line] = '\0';
+	    line = last;
+	}
+
+	if ((c = icalparser_add_line(parser,line)) != 0)
+	    root = icalparser_add_root(parser, root, c);
+
+	if (last != 0)
+	    free(last);
+    }
+
+    icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR,es);
+
+    return root;
+}
+
 
 icalcomponent* icalparser_add_line(icalparser* parser,
                                        char* line)
@@ -76,6 +76,14 @@ icalcomponent* icalparser_parse(icalparser *parser,
  */
 void icalparser_set_gen_data(icalparser* parser, void* data);
 
+/**
+   Parse ical data held in a writable buffer of size bytes. Lines are
+   terminated and unfolded in place, so the buffer contents are destroyed.
+   The caller owns the returned component.
+ */
+icalcomponent* icalparser_parse_buffer(icalparser *parser,
+				       char *buf, size_t size);
+
 
 icalcomponent* icalparser_parse_string(const char* str);
 
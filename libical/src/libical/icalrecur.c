@@ -639,7 +639,8 @@ struct icalrecur_iterator_impl {
     
     
     short *by_ptrs[9]; /**< Pointers into the by_* array elements of the rule */
-    
+
+    struct icaltimetype istart; /**< set by icalrecur_iterator_set_start */
 };
 
 static void increment_year(icalrecur_iterator* impl, int inc);
@@ -2240,7 +2241,9 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
     }
 
     if(impl->occurrence_no == 0 
-       &&  icaltime_compare(impl->last,impl->dtstart) >= 0){
+       &&  icaltime_compare(impl->last,impl->dtstart) >= 0
+       && (icaltime_is_null_time(impl->istart)
+           || icaltime_compare(impl->last,impl->istart) >= 0)){
 
 	impl->occurrence_no++;
 	return impl->last;
@@ -2291,6 +2294,8 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
 	
     } while(!check_contracting_rules(impl) 
 	    || icaltime_compare(impl->last,impl->dtstart) < 0
+            || (!icaltime_is_null_time(impl->istart)
+                && icaltime_compare(impl->last,impl->istart) < 0)
             || valid == 0);
     
     
@@ -2306,6 +2311,262 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator *impl)
 }
 
 
+/* Days since 1970-01-01 of the date part of t. Used to step over whole
+   periods instead of walking through them one occurrence at a time. */
+static int recur_day_number(struct icaltimetype t)
+{
+    int y = t.year - (t.month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (t.month > 2 ? t.month - 3 : t.month + 9) + 2) / 5
+	+ t.day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static time_t recur_seconds(struct icaltimetype t)
+{
+    return (time_t)recur_day_number(t) * 86400
+	+ t.hour * 3600 + t.minute * 60 + t.second;
+}
+
+/* A rule is simple when every period holds exactly one occurrence at the
+   same offset from the period start as DTSTART. Those can be positioned
+   with plain arithmetic, also when COUNT is given. */
+static int recur_is_simple(icalrecur_iterator *impl)
+{
+    int i;
+
+    for (i = 0; i < 9; i++) {
+	if (impl->orig_data[i])
+	    return 0;
+    }
+
+    switch (impl->rule.freq) {
+	case ICAL_SECONDLY_RECURRENCE:
+	case ICAL_MINUTELY_RECURRENCE:
+	case ICAL_HOURLY_RECURRENCE:
+	case ICAL_DAILY_RECURRENCE:
+	case ICAL_WEEKLY_RECURRENCE:
+	    return 1;
+	case ICAL_MONTHLY_RECURRENCE:
+	    return (impl->dtstart.day <= 28);
+	case ICAL_YEARLY_RECURRENCE:
+	    return !(impl->dtstart.month == 2 && impl->dtstart.day == 29);
+	default:
+	    return 0;
+    }
+}
+
+/* Set the time of day to the last BYSECOND/BYMINUTE/BYHOUR combination,
+   which is where the iterator stands after the final occurrence of a
+   period. The next call then wraps them and steps to the next period. */
+static void recur_set_end_of_period(icalrecur_iterator *impl)
+{
+    int i;
+
+    i = icalrecur_iterator_sizeof_byarray(impl->by_ptrs[BY_SECOND]) - 1;
+    impl->by_indices[BY_SECOND] = (short)i;
+    impl->last.second = impl->by_ptrs[BY_SECOND][i];
+
+    i = icalrecur_iterator_sizeof_byarray(impl->by_ptrs[BY_MINUTE]) - 1;
+    impl->by_indices[BY_MINUTE] = (short)i;
+    impl->last.minute = impl->by_ptrs[BY_MINUTE][i];
+
+    i = icalrecur_iterator_sizeof_byarray(impl->by_ptrs[BY_HOUR]) - 1;
+    impl->by_indices[BY_HOUR] = (short)i;
+    impl->last.hour = impl->by_ptrs[BY_HOUR][i];
+}
+
+static struct icaltimetype recur_add_months(struct icaltimetype t, int months)
+{
+    int m = t.month - 1 + months;
+
+    t.year += m / 12;
+    t.month = m % 12 + 1;
+    return t;
+}
+
+/* Position a simple rule (see recur_is_simple) right after the last
+   occurrence before start. */
+static void recur_seek_simple(icalrecur_iterator *impl,
+			      struct icaltimetype start)
+{
+    struct icaltimetype occ = impl->dtstart;
+    int n;
+
+    if (impl->rule.freq == ICAL_MONTHLY_RECURRENCE
+	|| impl->rule.freq == ICAL_YEARLY_RECURRENCE) {
+	int step = impl->rule.interval;
+
+	if (impl->rule.freq == ICAL_YEARLY_RECURRENCE)
+	    step *= 12;
+	n = ((start.year * 12 + start.month)
+	     - (occ.year * 12 + occ.month)) / step;
+	/* occurrence n is the last one in or before the month of start */
+	if (recur_seconds(recur_add_months(occ, n * step))
+	    < recur_seconds(start))
+	    n++;
+	occ = recur_add_months(occ, (n - 1) * step);
+    } else {
+	time_t step = impl->rule.interval;
+	time_t skip;
+
+	switch (impl->rule.freq) {
+	    case ICAL_MINUTELY_RECURRENCE: step *= 60; break;
+	    case ICAL_HOURLY_RECURRENCE: step *= 3600; break;
+	    case ICAL_DAILY_RECURRENCE: step *= 86400; break;
+	    case ICAL_WEEKLY_RECURRENCE: step *= 7 * 86400; break;
+	    default: break;
+	}
+	n = (int)((recur_seconds(start) - recur_seconds(occ) + step - 1)
+		  / step);
+	skip = (n - 1) * step;
+	icaltime_adjust(&occ, (int)(skip / 86400), 0, 0, (int)(skip % 86400));
+    }
+
+    /* n occurrences lie before start and occ is the last of them */
+    impl->last = occ;
+    impl->occurrence_no = n;
+}
+
+/* Position a rule with BYxxx data at the end of the last whole period
+   (aligned to INTERVAL) that starts before start. Only valid for rules
+   without COUNT, as the occurrences skipped are not counted. */
+static int recur_seek_periods(icalrecur_iterator *impl,
+			      struct icaltimetype start)
+{
+    struct icaltimetype anchor = impl->last;
+    int interval = impl->rule.interval;
+    int k;
+
+    if (impl->rule.freq != ICAL_YEARLY_RECURRENCE
+	&& (has_by_data(impl, BY_MONTH) || has_by_data(impl, BY_WEEK_NO)
+	    || has_by_data(impl, BY_YEAR_DAY)
+	    || has_by_data(impl, BY_SET_POS))) {
+	/* increment_month() follows the BYMONTH list in these */
+	return 0;
+    }
+
+    switch (impl->rule.freq) {
+	case ICAL_DAILY_RECURRENCE: {
+	    k = (recur_day_number(start) - recur_day_number(anchor)) / interval;
+	    if (k < 1)
+		return 1;
+	    recur_set_end_of_period(impl);
+	    icaltime_adjust(&impl->last, (k - 1) * interval, 0, 0, 0);
+	    break;
+	}
+	case ICAL_WEEKLY_RECURRENCE: {
+	    int week_start, last_idx, dow;
+
+	    /* Weeks are counted from the week the iterator was set up in */
+	    dow = icaltime_day_of_week(anchor) - impl->rule.week_start;
+	    if (dow < 0)
+		dow += 7;
+	    anchor.is_date = 1;
+	    icaltime_adjust(&anchor, -dow, 0, 0, 0);
+	    week_start = recur_day_number(anchor);
+	    k = (recur_day_number(start) - week_start) / (7 * interval);
+	    if (k < 1)
+		return 1;
+
+	    last_idx = icalrecur_iterator_sizeof_byarray(impl->by_ptrs[BY_DAY])
+		- 1;
+	    dow = icalrecurrencetype_day_day_of_week(
+		impl->by_ptrs[BY_DAY][last_idx]) - impl->rule.week_start;
+	    if (dow < 0)
+		dow += 7;
+	    icaltime_adjust(&anchor, (k - 1) * 7 * interval + dow, 0, 0, 0);
+
+	    recur_set_end_of_period(impl);
+	    impl->by_indices[BY_DAY] = (short)last_idx;
+	    impl->last.year = anchor.year;
+	    impl->last.month = anchor.month;
+	    impl->last.day = anchor.day;
+	    break;
+	}
+	case ICAL_MONTHLY_RECURRENCE: {
+	    k = ((start.year * 12 + start.month)
+		 - (anchor.year * 12 + anchor.month)) / interval;
+	    if (k < 1)
+		return 1;
+	    recur_set_end_of_period(impl);
+	    anchor = recur_add_months(anchor, (k - 1) * interval);
+	    impl->last.year = anchor.year;
+	    impl->last.month = anchor.month;
+	    if (has_by_data(impl, BY_DAY)) {
+		/* next_month() scans forward from the day after last */
+		impl->last.day = icaltime_days_in_month(impl->last.month,
+							impl->last.year);
+	    } else if (has_by_data(impl, BY_MONTH_DAY)) {
+		impl->by_indices[BY_MONTH_DAY] = (short)
+		    (icalrecur_iterator_sizeof_byarray(
+			impl->by_ptrs[BY_MONTH_DAY]) - 1);
+		impl->last.day = 1;
+	    }
+	    break;
+	}
+	case ICAL_YEARLY_RECURRENCE: {
+	    k = (start.year - anchor.year) / interval;
+	    if (k < 1)
+		return 1;
+	    recur_set_end_of_period(impl);
+	    impl->last.year = anchor.year + (k - 1) * interval;
+	    impl->last.month = 1;
+	    impl->last.day = 1;
+	    /* An empty day list makes next_year() expand the next year */
+	    impl->days[0] = ICAL_RECURRENCE_ARRAY_MAX;
+	    impl->days_index = -1;
+	    break;
+	}
+	default:
+	    return 0;
+    }
+
+    impl->occurrence_no = 1;
+    return 1;
+}
+
+/** Position a new iterator so that icalrecur_iterator_next() returns the
+    first occurrence at or after start. Whole periods are skipped
+    arithmetically instead of being generated one by one. Returns 0 when
+    the rule can not be positioned this way (a COUNT with BYxxx data, or
+    the iterator has already been used); the caller then has to step
+    through the occurrences as before. */
+int icalrecur_iterator_set_start(icalrecur_iterator *impl,
+				 struct icaltimetype start)
+{
+    icalerror_check_arg_rz((impl!=0),"impl");
+
+    if (impl->occurrence_no != 0 || icaltime_is_null_time(start))
+	return 0;
+
+    if (impl->dtstart.zone != 0 && start.zone != 0
+	&& impl->dtstart.zone != start.zone) {
+	start = icaltime_convert_to_zone(start,
+					 (icaltimezone *)impl->dtstart.zone);
+    }
+    if (impl->dtstart.is_date) {
+	start.is_date = 1;
+	start.hour = start.minute = start.second = 0;
+    }
+
+    if (recur_seconds(start) <= recur_seconds(impl->dtstart))
+	return 1;
+
+    if (recur_is_simple(impl)) {
+	recur_seek_simple(impl, start);
+    } else {
+	if (impl->rule.count != 0 || !recur_seek_periods(impl, start))
+	    return 0;
+    }
+
+    impl->istart = start;
+    return 1;
+}
+
 /************************** Type Routines **********************/
 
 
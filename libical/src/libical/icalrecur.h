@@ -204,6 +204,11 @@ struct icaltimetype icalrecur_iterator_next(icalrecur_iterator*);
 
 void icalrecur_iterator_decrement_count(icalrecur_iterator*);
 
+/** Skip to the first occurrence at or after start without generating
+    the earlier ones. Returns 0 if the rule can not be positioned. */
+int icalrecur_iterator_set_start(icalrecur_iterator*,
+                                 struct icaltimetype start);
+
 /** Free the iterator */
 void icalrecur_iterator_free(icalrecur_iterator*);
 
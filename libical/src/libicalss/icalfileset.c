@@ -43,6 +43,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h> /* for fcntl */
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h> /* for mmap */
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include "icalfilesetimpl.h"
 #include "icalclusterimpl.h"
 
@@ -59,7 +65,9 @@
 extern int errno;
 
 /** Default options used when NULL is passed to icalset_new() **/
-icalfileset_options icalfileset_options_default = {O_RDWR|O_CREAT, 0644, 0, 0};
+icalfileset_options icalfileset_options_default = {O_RDWR|O_CREAT, 0644, 0, 0,
+						   ICALFILESET_SYNC_FILE, 0,
+						   ICALFILESET_COMPRESS_NONE};
 
 int icalfileset_lock(icalfileset *set);
 int icalfileset_unlock(icalfileset *set);
@@ -68,6 +76,9 @@ int icalfileset_filesize(icalfileset* set);
 
 icalerrorenum icalfileset_create_cluster(const char *path);
 
+static void icalfileset_uid_index_free(icalfileset *fset);
+
+
 icalset* icalfileset_new(const char* path)
 {
   return icalset_new(ICAL_FILE_SET, path, &icalfileset_options_default);
@@ -103,6 +114,11 @@ icalset* icalfileset_init(icalset *set, const char* path, void* options_in)
 
   fset->path = strdup(path);
   fset->options = *options;
+  fset->snapshot = options->snapshot ? strdup(options->snapshot) : 0;
+  fset->options.snapshot = fset->snapshot;
+  fset->snapshot_state = ICALFILESET_SNAPSHOT_NONE;
+  fset->uid_index = 0;
+  fset->uid_index_size = 0;
 
   flags = options->flags;
   mode  = options->mode;
@@ -203,15 +219,185 @@ char* icalfileset_read_from_file(char *s, size_t size, void *d)
 }
 
 
+/* Read the whole file into a malloced buffer. Used when the file can not
+   be mapped. */
+static char* icalfileset_read_buffer(int fd, size_t size)
+{
+    char *buf;
+    size_t pos = 0;
+    ssize_t n;
+
+    if ((buf = malloc(size)) == 0) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return 0;
+    }
+
+    while (pos < size) {
+	n = read(fd, buf + pos, size - pos);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	pos += n;
+    }
+
+    if (pos != size) {
+	free(buf);
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return 0;
+    }
+
+    return buf;
+}
+
+/* gzip files start with these two bytes */
+static int icalfileset_is_gzip(const char *buf, size_t size)
+{
+    return size >= 2 && (unsigned char)buf[0] == 0x1f
+	&& (unsigned char)buf[1] == 0x8b;
+}
+
+#ifdef HAVE_ZLIB
+/* Inflate gzip data, all members of it, into a malloced buffer */
+static char* icalfileset_gunzip(const char *data, size_t size,
+				size_t *text_size)
+{
+    z_stream zs;
+    char *buf = 0, *tmp;
+    size_t buf_size = 0;
+    int rtrn;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return 0;
+    }
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = (uInt)size;
+    *text_size = 0;
+    for (;;) {
+	if (*text_size == buf_size) {
+	    buf_size = buf_size ? 2 * buf_size : 4 * size + 4096;
+	    if ((tmp = realloc(buf, buf_size)) == 0) {
+		icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+		break;
+	    }
+	    buf = tmp;
+	}
+	zs.next_out = (Bytef *)buf + *text_size;
+	zs.avail_out = (uInt)(buf_size - *text_size);
+	rtrn = inflate(&zs, Z_NO_FLUSH);
+	*text_size = buf_size - zs.avail_out;
+	if (rtrn == Z_STREAM_END) {
+	    if (zs.avail_in == 0) {
+		inflateEnd(&zs);
+		return buf;
+	    }
+	    /* next member */
+	    if (inflateReset(&zs) != Z_OK)
+		rtrn = Z_DATA_ERROR;
+	}
+	if (rtrn != Z_OK && rtrn != Z_STREAM_END) {
+	    /* broken or truncated file */
+	    icalerror_set_errno(ICAL_FILE_ERROR);
+	    break;
+	}
+    }
+    inflateEnd(&zs);
+    free(buf);
+    return 0;
+}
+#endif
+
 icalerrorenum icalfileset_read_file(icalfileset* set,mode_t mode)
 {
     icalparser *parser;
-  
-    parser = icalparser_new();
+    struct stat sbuf;
+    size_t size;
+    char *buf = 0;
+    struct icalsnapshot_hash hs;
+#if defined(HAVE_MMAP) && !defined(WIN32)
+    int mapped = 0;
+#endif
+
+    if (fstat(set->fd, &sbuf) != 0) {
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+    size = (size_t)sbuf.st_size;
+
+    /* The parser terminates and unfolds the lines in place, so the
+       mapping is private and writable. Pages are copied only where the
+       parser writes, and the file itself is never changed. */
+#if defined(HAVE_MMAP) && !defined(WIN32)
+    if (size > 0) {
+	buf = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, set->fd, 0);
+	if (buf == MAP_FAILED) {
+	    buf = 0;
+	} else {
+	    mapped = 1;
+#ifdef MADV_SEQUENTIAL
+	    madvise(buf, size, MADV_SEQUENTIAL);
+#endif
+	}
+    }
+#endif
+
+    if (buf == 0 && size > 0 && (buf = icalfileset_read_buffer(set->fd, size)) == 0)
+	return icalerrno;
+
+    if (icalfileset_is_gzip(buf, size)) {
+	char *text = 0;
+	size_t text_size = 0;
+
+#ifdef HAVE_ZLIB
+	text = icalfileset_gunzip(buf, size, &text_size);
+#else
+	icalerror_set_errno(ICAL_UNIMPLEMENTED_ERROR);
+#endif
+#if defined(HAVE_MMAP) && !defined(WIN32)
+	if (mapped)
+	    munmap(buf, size);
+	else
+#endif
+	    free(buf);
+#if defined(HAVE_MMAP) && !defined(WIN32)
+	mapped = 0;
+#endif
+	if (text == 0)
+	    return icalerrno;
+	buf = text;
+	size = text_size;
+	/* write it back the same way */
+	set->options.compression = ICALFILESET_COMPRESS_GZIP;
+    }
 
-    icalparser_set_gen_data(parser,(void*)set->fd);
-    set->cluster = icalparser_parse(parser,icalfileset_read_from_file);
-    icalparser_free(parser);
+    if (set->snapshot != 0) {
+	/* the parser destroys the buffer, so hash it first. Hash is of
+	   the text, like in commit, but size is of the file. */
+	set->snapshot_key.size = sbuf.st_size;
+	set->snapshot_key.mtime = sbuf.st_mtime;
+	icalsnapshot_hash_init(&hs);
+	icalsnapshot_hash_add(&hs, buf, size);
+	set->snapshot_key.hash = icalsnapshot_hash_end(&hs);
+	set->cluster = icalsnapshot_read(set->snapshot, set->path,
+					 &set->snapshot_key);
+	set->snapshot_state = set->cluster ? ICALFILESET_SNAPSHOT_CURRENT
+	    : ICALFILESET_SNAPSHOT_STALE;
+    }
+
+    if (set->cluster == 0) {
+	parser = icalparser_new();
+	set->cluster = icalparser_parse_buffer(parser, buf, size);
+	icalparser_free(parser);
+    }
+
+#if defined(HAVE_MMAP) && !defined(WIN32)
+    if (mapped)
+	munmap(buf, size);
+    else
+#endif
+	free(buf);
 
     if (set->cluster == 0 || icalerrno != ICAL_NO_ERROR){
 	icalerror_set_errno(ICAL_PARSE_ERROR);
@@ -290,6 +476,13 @@ void icalfileset_free(icalset* set)
 	free(fset->path);
 	fset->path = 0;
     }
+
+    if(fset->snapshot != 0){
+	free(fset->snapshot);
+	fset->snapshot = 0;
+    }
+
+    icalfileset_uid_index_free(fset);
 }
 
 const char* icalfileset_path(icalset* set) {
@@ -337,13 +530,209 @@ int icalfileset_unlock(icalfileset *set)
 #endif
 }
 
+#ifndef WIN32
+#define ICALFILESET_WRITE_BUFSIZE 65536
+
+/* Buffered writer for icalfileset_commit(). Components are small compared
+   to the whole file, so one buffer and few write() calls do the job. */
+struct icalfileset_writer {
+    int fd;
+    size_t used;
+    struct icalsnapshot_hash hash; /**< of all data put, for snapshot key */
+#ifdef HAVE_ZLIB
+    int gzip;			/**< compress data put */
+    z_stream zs;
+#endif
+    char buf[ICALFILESET_WRITE_BUFSIZE];
+};
+
+static int icalfileset_write_all(int fd, const char *data, size_t len)
+{
+    ssize_t sz;
+
+    while (len > 0) {
+	sz = write(fd, data, len);
+	if (sz < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	data += sz;
+	len -= sz;
+    }
+    return 0;
+}
+
+static int icalfileset_writer_flush(struct icalfileset_writer *w)
+{
+    int rtrn = icalfileset_write_all(w->fd, w->buf, w->used);
+
+    w->used = 0;
+    return rtrn;
+}
+
+#ifdef HAVE_ZLIB
+/* Compress str into the buffer, writing the buffer out when it fills.
+   flush is Z_NO_FLUSH or Z_FINISH for the end of the file. */
+static int icalfileset_writer_deflate(struct icalfileset_writer *w,
+				      const char *str, size_t len, int flush)
+{
+    int rtrn;
+
+    w->zs.next_in = (Bytef *)str;
+    w->zs.avail_in = (uInt)len;
+    do {
+	if (w->used == sizeof(w->buf) && icalfileset_writer_flush(w) < 0)
+	    return -1;
+	w->zs.next_out = (Bytef *)w->buf + w->used;
+	w->zs.avail_out = (uInt)(sizeof(w->buf) - w->used);
+	rtrn = deflate(&w->zs, flush);
+	w->used = sizeof(w->buf) - w->zs.avail_out;
+	if (rtrn == Z_STREAM_ERROR)
+	    return -1;
+    } while (w->zs.avail_in > 0 || (flush == Z_FINISH && rtrn != Z_STREAM_END));
+    return 0;
+}
+#endif
+
+static int icalfileset_writer_start(struct icalfileset_writer *w, int fd,
+				    icalfileset_compression compression)
+{
+    w->fd = fd;
+    w->used = 0;
+    icalsnapshot_hash_init(&w->hash);
+#ifdef HAVE_ZLIB
+    w->gzip = (compression == ICALFILESET_COMPRESS_GZIP);
+    if (w->gzip) {
+	memset(&w->zs, 0, sizeof(w->zs));
+	if (deflateInit2(&w->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+			 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	    return -1;
+    }
+    return 0;
+#else
+    return compression == ICALFILESET_COMPRESS_NONE ? 0 : -1;
+#endif
+}
+
+/* Write out everything put so far. ok is 0 if writing has already failed
+   and we only need to clean up. */
+static int icalfileset_writer_end(struct icalfileset_writer *w, int ok)
+{
+    int rtrn = ok ? 0 : -1;
+
+#ifdef HAVE_ZLIB
+    if (w->gzip) {
+	if (rtrn == 0)
+	    rtrn = icalfileset_writer_deflate(w, "", 0, Z_FINISH);
+	deflateEnd(&w->zs);
+    }
+#endif
+    if (rtrn == 0)
+	rtrn = icalfileset_writer_flush(w);
+    return rtrn;
+}
+
+static int icalfileset_writer_put(struct icalfileset_writer *w,
+				  const char *str, size_t len)
+{
+    icalsnapshot_hash_add(&w->hash, str, len);
+#ifdef HAVE_ZLIB
+    if (w->gzip)
+	return icalfileset_writer_deflate(w, str, len, Z_NO_FLUSH);
+#endif
+    if (w->used + len > sizeof(w->buf)) {
+	if (icalfileset_writer_flush(w) < 0)
+	    return -1;
+	if (len > sizeof(w->buf)) /* does not fit, write it directly */
+	    return icalfileset_write_all(w->fd, str, len);
+    }
+    memcpy(w->buf + w->used, str, len);
+    w->used += len;
+    return 0;
+}
+
+/* Keep the current file as path.bak. The commit replaces path with a new
+   file, so a hard link is enough; copy only if links are not supported. */
+static int icalfileset_backup(const char *path, struct icalfileset_writer *w)
+{
+    char bak[ICAL_PATH_MAX];
+    ssize_t sz;
+    int fd, rtrn = 0;
+
+    if (snprintf(bak, ICAL_PATH_MAX, "%s.bak", path) >= ICAL_PATH_MAX)
+	return -1;
+    if (unlink(bak) < 0 && errno != ENOENT)
+	return -1;
+    if (link(path, bak) == 0)
+	return 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return -1;
+    if ((w->fd = open(bak, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+	close(fd);
+	return -1;
+    }
+    while ((sz = read(fd, w->buf, sizeof(w->buf))) != 0) {
+	if (sz < 0) {
+	    if (errno == EINTR)
+		continue;
+	    rtrn = -1;
+	    break;
+	}
+	if ((rtrn = icalfileset_write_all(w->fd, w->buf, sz)) < 0)
+	    break;
+    }
+    close(fd);
+    if (close(w->fd) < 0)
+	rtrn = -1;
+    return rtrn;
+}
+
+/* fsync the directory holding path so that the rename itself is durable */
+static int icalfileset_sync_dir(const char *path)
+{
+    char dir[ICAL_PATH_MAX];
+    char *slash;
+    int fd, rtrn;
+
+    strncpy(dir, path, ICAL_PATH_MAX-1);
+    dir[ICAL_PATH_MAX-1] = '\0';
+    if ((slash = strrchr(dir, '/')) == 0)
+	strcpy(dir, ".");
+    else if (slash == dir)
+	slash[1] = '\0'; /* file in root directory */
+    else
+	*slash = '\0';
+
+    if ((fd = open(dir, O_RDONLY)) < 0)
+	return -1;
+    rtrn = fsync(fd);
+    close(fd);
+    return rtrn;
+}
+#endif
+
+/** Write the set to disk.
+ *
+ * The data is written to a temporary file next to the real one, which is
+ * then renamed over it; a crash in the middle leaves the old file intact.
+ * options.durability selects the fsync calls done on the way.
+ */
 icalerrorenum icalfileset_commit(icalset* set)
 {
     char tmp[ICAL_PATH_MAX]; 
     char *str;
     icalcomponent *c;
-    off_t write_size=0;
     icalfileset *fset = (icalfileset*) set;
+#ifndef WIN32
+    struct icalfileset_writer *w;
+    struct stat sbuf;
+    char *path;
+    int fd;
+#else
+    off_t write_size=0;
+#endif
 
     icalerror_check_arg_re((fset!=0),"set",ICAL_BADARG_ERROR);  
     
@@ -354,12 +743,94 @@ icalerrorenum icalfileset_commit(icalset* set)
 	return ICAL_NO_ERROR;
     }
     
-    if (fset->options.safe_saves == 1) {
 #ifndef WIN32
-	snprintf(tmp,ICAL_PATH_MAX,"cp '%s' '%s.bak'",fset->path, fset->path);
+    if ((fset->options.flags & O_ACCMODE) == O_RDONLY) {
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+
+    /* replace the file a symbolic link points to, not the link */
+    if ((path = realpath(fset->path, NULL)) == 0)
+	path = strdup(fset->path);
+    if ((w = malloc(sizeof(struct icalfileset_writer))) == 0) {
+	free(path);
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return ICAL_NEWFAILED_ERROR;
+    }
+
+    if (fset->options.safe_saves == 1 && icalfileset_backup(path, w) < 0) {
+	free(w);
+	free(path);
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+
+    fd = -1;
+    if (snprintf(tmp, ICAL_PATH_MAX, "%s.XXXXXX", path) >= ICAL_PATH_MAX
+	|| (fd = mkstemp(tmp)) < 0) {
+	free(w);
+	free(path);
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+    /* mkstemp creates the file private, keep the old permissions */
+    if (fstat(fset->fd, &sbuf) == 0)
+	fchmod(fd, sbuf.st_mode & 07777);
+
+    if (icalfileset_writer_start(w, fd, fset->options.compression) < 0) {
+	close(fd);
+	unlink(tmp);
+	free(w);
+	free(path);
+	icalerror_set_errno(ICAL_UNIMPLEMENTED_ERROR);
+	return ICAL_UNIMPLEMENTED_ERROR;
+    }
+    for(c = icalcomponent_get_first_component(fset->cluster,ICAL_ANY_COMPONENT);
+	c != 0;
+	c = icalcomponent_get_next_component(fset->cluster,ICAL_ANY_COMPONENT)){
+	str = icalcomponent_as_ical_string(c);
+	if (icalfileset_writer_put(w, str, strlen(str)) < 0)
+	    break;
+    }
+    if (icalfileset_writer_end(w, c == 0) < 0
+	|| (fset->options.durability >= ICALFILESET_SYNC_FILE && fsync(fd) < 0)
+	|| rename(tmp, path) < 0) {
+	perror("icalfileset_commit");
+	close(fd);
+	unlink(tmp);
+	free(w);
+	free(path);
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+
+    /* the new file is now the set's file: move the lock over to it */
+    icalfileset_unlock(fset);
+    close(fset->fd);
+    fset->fd = fd;
+    icalfileset_lock(fset);
+    fset->changed = 0;
+
+    /* the file now has exactly what we wrote */
+    fset->snapshot_state = ICALFILESET_SNAPSHOT_NONE;
+    if (fset->snapshot != 0 && fstat(fd, &sbuf) == 0) {
+	fset->snapshot_key.size = sbuf.st_size;
+	fset->snapshot_key.mtime = sbuf.st_mtime;
+	fset->snapshot_key.hash = icalsnapshot_hash_end(&w->hash);
+	fset->snapshot_state = ICALFILESET_SNAPSHOT_STALE;
+    }
+    free(w);
+
+    if (fset->options.durability >= ICALFILESET_SYNC_DIR
+	&& icalfileset_sync_dir(path) < 0) {
+	free(path);
+	icalerror_set_errno(ICAL_FILE_ERROR);
+	return ICAL_FILE_ERROR;
+    }
+    free(path);
 #else
+    if (fset->options.safe_saves == 1) {
 	snprintf(tmp,ICAL_PATH_MAX,"copy %s %s.bak", fset->path, fset->path);
-#endif
 	
 	if(system(tmp) < 0){
 	    icalerror_set_errno(ICAL_FILE_ERROR);
@@ -391,13 +862,9 @@ icalerrorenum icalfileset_commit(icalset* set)
     }
     
     fset->changed = 0;    
+    fset->snapshot_state = ICALFILESET_SNAPSHOT_NONE;
 
-#ifndef WIN32
-    if(ftruncate(fset->fd,write_size) < 0){
-	return ICAL_FILE_ERROR;
-    }
-#else
-	chsize( fset->fd, tell( fset->fd ) );
+    chsize( fset->fd, tell( fset->fd ) );
 #endif
     
     return ICAL_NO_ERROR;
@@ -416,6 +883,45 @@ icalcomponent* icalfileset_get_component(icalset* set){
     return fset->cluster;
 }
 
+icalerrorenum icalfileset_set_compression(icalset* set,
+					  icalfileset_compression compression)
+{
+    icalfileset *fset = (icalfileset*) set;
+
+    icalerror_check_arg_re((set!=0),"set", ICAL_BADARG_ERROR);
+
+#if !defined(HAVE_ZLIB) || defined(WIN32)
+    if (compression != ICALFILESET_COMPRESS_NONE) {
+	icalerror_set_errno(ICAL_UNIMPLEMENTED_ERROR);
+	return ICAL_UNIMPLEMENTED_ERROR;
+    }
+#endif
+    if (fset->options.compression != compression) {
+	fset->options.compression = compression;
+	fset->changed = 1; /* the file needs to be written again */
+    }
+    return ICAL_NO_ERROR;
+}
+
+icalerrorenum icalfileset_write_snapshot(icalset* set)
+{
+    icalfileset *fset = (icalfileset*) set;
+
+    icalerror_check_arg_re((set!=0),"set", ICAL_BADARG_ERROR);
+
+    /* the snapshot must be exactly what is in the file */
+    if (fset->snapshot == 0 || fset->changed
+	|| fset->snapshot_state != ICALFILESET_SNAPSHOT_STALE)
+	return ICAL_NO_ERROR;
+
+    if (icalsnapshot_write(fset->snapshot, fset->path, &fset->snapshot_key,
+			   fset->cluster) < 0)
+	return icalerrno;
+
+    fset->snapshot_state = ICALFILESET_SNAPSHOT_CURRENT;
+    return ICAL_NO_ERROR;
+}
+
 
 /* manipulate the components in the set */
 
@@ -429,7 +935,7 @@ icalerrorenum icalfileset_add_component(icalset *set,
 
     icalcomponent_add_component(fset->cluster,child);
 
-    icalfileset_mark(set);
+    fset->changed = 1;
 
     return ICAL_NO_ERROR;
 }
@@ -444,7 +950,7 @@ icalerrorenum icalfileset_remove_component(icalset *set,
 
     icalcomponent_remove_component(fset->cluster,child);
 
-    icalfileset_mark(set);
+    fset->changed = 1;
 
     return ICAL_NO_ERROR;
 }
@@ -482,49 +988,221 @@ void icalfileset_clear(icalset* set)
     fset->gauge = 0;
 }
 
+/******* support routines for icalfileset_fetch *********/
+
+/* The UID index maps the UID of each inner component to the calendar
+   holding it. Components are often added to and removed from the
+   calendars directly with icalcomponent_add/remove_component, which the
+   set does not see, so the index remembers the children changes of the
+   cluster and of its calendars from when it was built and is built again
+   once they differ. While the cluster is unchanged its calendars are the
+   same and their counts only grow, so the sum of them is enough. A UID
+   changed in place is not counted; hits are checked for it and a miss
+   rebuilds the index once before giving up. */
+
+struct icalfileset_uid_entry {
+    char *uid;
+    icalcomponent *comp;	/* top level component containing uid */
+    icalcomponent *inner;	/* component with the uid */
+    struct icalfileset_uid_entry *next;
+};
+
+static unsigned int icalfileset_uid_hash(const char *uid)
+{
+    unsigned int h = 5381;
+
+    while (*uid != 0)
+	h = (h << 5) + h + (unsigned char)*uid++;
+
+    return h;
+}
+
+static const char *icalfileset_inner_uid(icalcomponent *inner)
+{
+    icalproperty *p;
+
+    if ((p = icalcomponent_get_first_property(inner,ICAL_UID_PROPERTY)) == 0)
+	return 0;
+
+    return icalproperty_get_uid(p);
+}
+
+static void icalfileset_uid_index_free(icalfileset *fset)
+{
+    struct icalfileset_uid_entry *e, *next;
+    size_t i;
+
+    if (fset->uid_index == 0)
+	return;
+
+    for (i = 0; i < fset->uid_index_size; i++){
+	for (e = fset->uid_index[i]; e != 0; e = next){
+	    next = e->next;
+	    free(e->uid);
+	    free(e);
+	}
+    }
+
+    free(fset->uid_index);
+    fset->uid_index = 0;
+    fset->uid_index_size = 0;
+}
+
+/* sum of the children changes of the calendars in the cluster */
+static unsigned int icalfileset_uid_index_inner(icalfileset *fset)
+{
+    icalcompiter i;
+    unsigned int sum = 0;
+
+    for(i = icalcomponent_begin_component(fset->cluster,ICAL_ANY_COMPONENT);
+	icalcompiter_deref(&i)!= 0; icalcompiter_next(&i)){
+	sum += icalcomponent_get_children_changes(icalcompiter_deref(&i));
+    }
+
+    return sum;
+}
+
+static int icalfileset_uid_index_valid(icalfileset *fset)
+{
+    return fset->uid_index != 0
+	&& fset->uid_index_cluster ==
+	   icalcomponent_get_children_changes(fset->cluster)
+	&& fset->uid_index_inner == icalfileset_uid_index_inner(fset);
+}
+
+static struct icalfileset_uid_entry *
+icalfileset_uid_index_find(icalfileset *fset, const char *uid)
+{
+    struct icalfileset_uid_entry *e;
+
+    e = fset->uid_index[icalfileset_uid_hash(uid) % fset->uid_index_size];
+    for (; e != 0; e = e->next){
+	if (strcmp(e->uid, uid) == 0)
+	    return e;
+    }
+
+    return 0;
+}
+
+/* Index the UIDs found in comp. Earlier entries win, which gives the
+   same result as a linear scan from the start of the cluster. */
+static int icalfileset_uid_index_add(icalfileset *fset, icalcomponent *comp)
+{
+    struct icalfileset_uid_entry *e;
+    icalcompiter i;
+    icalcomponent *inner;
+    const char *uid;
+    unsigned int h;
+
+    for(i = icalcomponent_begin_component(comp,ICAL_ANY_COMPONENT);
+	(inner = icalcompiter_deref(&i)) != 0; icalcompiter_next(&i)){
+
+	if (icalcomponent_get_first_property(inner,ICAL_UID_PROPERTY) == 0)
+	    continue;
+
+	if ((uid = icalfileset_inner_uid(inner)) == 0){
+	    icalerror_warn("icalfileset_fetch found a component with no UID");
+	    continue;
+	}
+
+	if (icalfileset_uid_index_find(fset, uid) != 0)
+	    continue;
+
+	if ((e = malloc(sizeof(struct icalfileset_uid_entry))) == 0)
+	    return 0;
+
+	if ((e->uid = strdup(uid)) == 0){
+	    free(e);
+	    return 0;
+	}
+	e->comp = comp;
+	e->inner = inner;
+	h = icalfileset_uid_hash(uid) % fset->uid_index_size;
+	e->next = fset->uid_index[h];
+	fset->uid_index[h] = e;
+    }
+
+    return 1;
+}
+
+static int icalfileset_uid_index_build(icalfileset *fset)
+{
+    icalcompiter i;
+    icalcomponent *this;
+    size_t count = 0;
+
+    icalfileset_uid_index_free(fset);
+
+    for(i = icalcomponent_begin_component(fset->cluster,ICAL_ANY_COMPONENT);
+	(this = icalcompiter_deref(&i)) != 0; icalcompiter_next(&i)){
+	count += icalcomponent_count_components(this, ICAL_ANY_COMPONENT);
+    }
+
+    fset->uid_index_size = 64;
+    while (fset->uid_index_size < 2*count)
+	fset->uid_index_size *= 2;
+
+    fset->uid_index = (struct icalfileset_uid_entry **)
+	calloc(fset->uid_index_size, sizeof(struct icalfileset_uid_entry *));
+    if (fset->uid_index == 0){
+	fset->uid_index_size = 0;
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return 0;
+    }
+
+    for(i = icalcomponent_begin_component(fset->cluster,ICAL_ANY_COMPONENT);
+	(this = icalcompiter_deref(&i)) != 0; icalcompiter_next(&i)){
+	if (!icalfileset_uid_index_add(fset, this)){
+	    icalfileset_uid_index_free(fset);
+	    icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	    return 0;
+	}
+    }
+
+    fset->uid_index_cluster = icalcomponent_get_children_changes(fset->cluster);
+    fset->uid_index_inner = icalfileset_uid_index_inner(fset);
+
+    return 1;
+}
+
 icalcomponent* icalfileset_fetch(icalset* set,const char* uid)
 {
     icalfileset *fset = (icalfileset*) set;
-    icalcompiter i;    
+    struct icalfileset_uid_entry *e;
+    const char *this_uid;
+    int built = 0;
 
     icalerror_check_arg_rz(set!=0,"set");
-    
-    for(i = icalcomponent_begin_component(fset->cluster,ICAL_ANY_COMPONENT);
-	icalcompiter_deref(&i)!= 0; icalcompiter_next(&i)){
-	
-		icalcomponent *this = icalcompiter_deref(&i);
-		icalcomponent *inner;
-		icalproperty *p;
-		const char *this_uid;
-
-		for(inner = icalcomponent_get_first_component(this,ICAL_ANY_COMPONENT);
-			inner != 0;
-			inner = icalcomponent_get_next_component(this,ICAL_ANY_COMPONENT)){
-
-			p = icalcomponent_get_first_property(inner,ICAL_UID_PROPERTY);
-			if ( p )
-			{
-				this_uid = icalproperty_get_uid(p);
-
-				if(this_uid==0){
-				icalerror_warn("icalfileset_fetch found a component with no UID");
-				continue;
-				}
-
-				if (strcmp(uid,this_uid)==0){
-					return this;
-				}
-			}
-		}
+    icalerror_check_arg_rz(uid!=0,"uid");
+
+    if (!icalfileset_uid_index_valid(fset)){
+	if (!icalfileset_uid_index_build(fset))
+	    return 0;
+	built = 1;
+    }
+
+    for (;;){
+	/* nothing was added or removed since the build, so e is alive */
+	if ((e = icalfileset_uid_index_find(fset, uid)) != 0){
+	    this_uid = icalfileset_inner_uid(e->inner);
+	    if (icalcomponent_get_parent(e->inner) == e->comp
+		&& this_uid != 0 && strcmp(uid, this_uid) == 0)
+		return e->comp;
 	}
 
-    return 0;
+	if (built)
+	    return 0;
+
+	/* a UID may have been changed in place */
+	if (!icalfileset_uid_index_build(fset))
+	    return 0;
+	built = 1;
+    }
 }
 
 int icalfileset_has_uid(icalset* set,const char* uid)
 {
-    assert(0); /* HACK, not implemented */
-    return 0;
+    return icalfileset_fetch(set, uid) != 0;
 }
 
 /******* support routines for icalfileset_fetch_match *********/
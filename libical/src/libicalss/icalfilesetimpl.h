@@ -33,6 +33,7 @@
 #endif
 
 #include "icalgauge.h"
+#include "icalsnapshot.h"
 
 /* This definition is in its own file so it can be kept out of the
    main header file, but used by "friend classes" like icaldirset*/
@@ -48,6 +49,17 @@ struct icalfileset_impl {
   icalgauge* gauge;		/**< gauge for filtering out data */
   int changed;			/**< boolean flag, 1 if data has changed */
   int fd;			/**< file descriptor */
+  struct icalfileset_uid_entry **uid_index; /**< UID hash, built on fetch */
+  size_t uid_index_size;	/**< number of buckets in uid_index */
+  unsigned int uid_index_cluster; /**< children changes of cluster */
+  unsigned int uid_index_inner;	/**< children changes of its calendars */
+  char *snapshot;		/**< copy of options.snapshot */
+  struct icalsnapshot_key snapshot_key; /**< file content on disk */
+  int snapshot_state;		/**< ICALFILESET_SNAPSHOT_* */
 };
 
+#define ICALFILESET_SNAPSHOT_NONE    0 /**< file content key not known */
+#define ICALFILESET_SNAPSHOT_STALE   1 /**< snapshot needs to be written */
+#define ICALFILESET_SNAPSHOT_CURRENT 2 /**< snapshot matches the file */
+
 #endif
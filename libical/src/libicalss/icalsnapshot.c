@@ -0,0 +1,721 @@
+/* -*- Mode: C -*-
+  ======================================================================
+  FILE: icalsnapshot.c
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+ ======================================================================*/
+
+/* Binary snapshot of a parsed calendar file.
+
+   The component tree is stored in pre-order as records:
+     'B' kind            begin component
+     'E'                 end component
+     'P' kind params value   property with typed value
+     'X' text            property in ical format, parsed on load
+     'R' text            component in ical format, parsed on load
+   Properties are stored with their parameters and typed value;
+   date-times, integers and durations are stored as numbers and text
+   without escaping, so loading most properties needs no parsing at all.
+   Other values are stored in ical format, and properties and components
+   libical can not take apart are stored as ical text.
+
+   The header holds the key (size, mtime and content hash) and the path
+   of the calendar file the snapshot was made from, and a hash of the
+   records; a snapshot is used only when all of them match. Numbers are
+   in native byte order. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "icalsnapshot.h"
+#include "icalset.h" /* for ICAL_PATH_MAX */
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#define ICALSNAPSHOT_MAGIC "ICALSNAP"
+#define ICALSNAPSHOT_VERSION 1
+#define ICALSNAPSHOT_BYTE_ORDER 0x01020304
+
+#define ICALSNAPSHOT_NO_STRING 0xffffffff
+
+/* FNV-1a over 64 bit words instead of bytes: the content is hashed on
+   every load, so speed matters more than quality here. Data may come in
+   pieces of any size, a partial word is kept until the next piece. */
+void icalsnapshot_hash_init(struct icalsnapshot_hash *hs)
+{
+    hs->h = 14695981039346656037ULL;
+    hs->word = 0;
+    hs->fill = 0;
+}
+
+void icalsnapshot_hash_add(struct icalsnapshot_hash *hs,
+			   const char *data, size_t len)
+{
+    const char *end = data + len;
+    size_t n;
+
+    if (hs->fill > 0) {
+	n = sizeof(hs->word) - hs->fill;
+	if (n > len)
+	    n = len;
+	memcpy((char *)&hs->word + hs->fill, data, n);
+	hs->fill += n;
+	data += n;
+	if (hs->fill < sizeof(hs->word))
+	    return;
+	hs->h = (hs->h ^ hs->word) * 1099511628211ULL;
+	hs->fill = 0;
+    }
+    while (end - data >= (ptrdiff_t)sizeof(hs->word)) {
+	memcpy(&hs->word, data, sizeof(hs->word));
+	hs->h = (hs->h ^ hs->word) * 1099511628211ULL;
+	data += sizeof(hs->word);
+    }
+    if (data < end) {
+	hs->word = 0;
+	hs->fill = end - data;
+	memcpy(&hs->word, data, hs->fill);
+    }
+}
+
+unsigned long long icalsnapshot_hash_end(struct icalsnapshot_hash *hs)
+{
+    if (hs->fill > 0)
+	hs->h = (hs->h ^ hs->word) * 1099511628211ULL;
+    hs->fill = 0;
+    return hs->h;
+}
+
+/* hash of one piece of data */
+static unsigned long long snap_hash(const char *data, size_t len)
+{
+    struct icalsnapshot_hash hs;
+
+    icalsnapshot_hash_init(&hs);
+    icalsnapshot_hash_add(&hs, data, len);
+    return icalsnapshot_hash_end(&hs);
+}
+
+/************************************************************************
+ * Writing
+ ************************************************************************/
+
+struct snap_out {
+    char *data;
+    size_t used;
+    size_t size;
+    int failed;
+};
+
+static void snap_put(struct snap_out *o, const void *data, size_t len)
+{
+    char *new_data;
+    size_t new_size;
+
+    if (o->failed)
+	return;
+    if (o->used + len > o->size) {
+	new_size = o->size ? o->size : 65536;
+	while (new_size < o->used + len)
+	    new_size *= 2;
+	if ((new_data = realloc(o->data, new_size)) == 0) {
+	    o->failed = 1;
+	    return;
+	}
+	o->data = new_data;
+	o->size = new_size;
+    }
+    memcpy(o->data + o->used, data, len);
+    o->used += len;
+}
+
+static void snap_put_u8(struct snap_out *o, char v)
+{
+    snap_put(o, &v, 1);
+}
+
+static void snap_put_u32(struct snap_out *o, unsigned int v)
+{
+    snap_put(o, &v, sizeof(v));
+}
+
+static void snap_put_u64(struct snap_out *o, unsigned long long v)
+{
+    snap_put(o, &v, sizeof(v));
+}
+
+/* strings are stored with their length and the terminating NUL, so that
+   the reader can use them directly from its buffer */
+static void snap_put_str(struct snap_out *o, const char *str)
+{
+    size_t len;
+
+    if (str == 0) {
+	snap_put_u32(o, ICALSNAPSHOT_NO_STRING);
+	return;
+    }
+    len = strlen(str);
+    snap_put_u32(o, (unsigned int)len);
+    snap_put(o, str, len + 1);
+}
+
+/* Value of a parameter as the parser got it: quotes removed */
+static const char *snap_parameter_value(icalparameter *param)
+{
+    const char *str;
+
+    if ((str = icalparameter_get_xvalue(param)) != 0)
+	return str;
+    /* enumerated value, never quoted */
+    if ((str = icalparameter_as_ical_string(param)) != 0
+	&& (str = strchr(str, '=')) != 0)
+	return str + 1;
+    return 0;
+}
+
+/* TRUE if the property can be stored typed */
+static int snap_typed_property(icalproperty *prop)
+{
+    icalparameter *param;
+    icalvalue *value;
+    icalparameter_kind kind;
+    struct icaltimetype tt;
+
+    if ((value = icalproperty_get_value(prop)) == 0
+	|| (icalproperty_isa(prop) == ICAL_X_PROPERTY
+	    && icalproperty_get_x_name(prop) == 0))
+	return 0;
+
+    for (param = icalproperty_get_first_parameter(prop, ICAL_ANY_PARAMETER);
+	 param != 0;
+	 param = icalproperty_get_next_parameter(prop, ICAL_ANY_PARAMETER)) {
+	kind = icalparameter_isa(param);
+	if (kind == ICAL_NO_PARAMETER || kind == ICAL_ANY_PARAMETER
+	    || (kind == ICAL_X_PARAMETER && icalparameter_get_xname(param) == 0)
+	    || snap_parameter_value(param) == 0)
+	    return 0;
+    }
+
+    switch (icalvalue_isa(value)) {
+    case ICAL_DATETIME_VALUE:
+    case ICAL_DATE_VALUE:
+	/* zone is only set for UTC after parsing */
+	tt = (icalvalue_isa(value) == ICAL_DATE_VALUE) ?
+	    icalvalue_get_date(value) : icalvalue_get_datetime(value);
+	return (tt.zone == 0 || tt.zone == icaltimezone_get_utc_timezone());
+    case ICAL_TEXT_VALUE:
+	return (icalvalue_get_text(value) != 0);
+    case ICAL_X_VALUE:
+	return (icalvalue_get_x(value) != 0);
+    default:
+	return (icalvalue_as_ical_string(value) != 0);
+    }
+}
+
+static void snap_put_property(struct snap_out *o, icalproperty *prop)
+{
+    icalparameter *param;
+    icalparameter_kind kind;
+    icalvalue *value;
+    struct icaltimetype tt;
+    struct icaldurationtype dur;
+    unsigned int cnt = 0;
+
+    if (!snap_typed_property(prop)) {
+	snap_put_u8(o, 'X');
+	snap_put_str(o, icalproperty_as_ical_string(prop));
+	return;
+    }
+
+    snap_put_u8(o, 'P');
+    snap_put_u32(o, (unsigned int)icalproperty_isa(prop));
+    snap_put_str(o, icalproperty_isa(prop) == ICAL_X_PROPERTY ?
+		 icalproperty_get_x_name(prop) : 0);
+
+    for (param = icalproperty_get_first_parameter(prop, ICAL_ANY_PARAMETER);
+	 param != 0;
+	 param = icalproperty_get_next_parameter(prop, ICAL_ANY_PARAMETER))
+	cnt++;
+    snap_put_u32(o, cnt);
+    for (param = icalproperty_get_first_parameter(prop, ICAL_ANY_PARAMETER);
+	 param != 0;
+	 param = icalproperty_get_next_parameter(prop, ICAL_ANY_PARAMETER)) {
+	kind = icalparameter_isa(param);
+	snap_put_u32(o, (unsigned int)kind);
+	snap_put_str(o, kind == ICAL_X_PARAMETER ?
+		     icalparameter_get_xname(param) : 0);
+	snap_put_str(o, snap_parameter_value(param));
+    }
+
+    value = icalproperty_get_value(prop);
+    snap_put_u32(o, (unsigned int)icalvalue_isa(value));
+    switch (icalvalue_isa(value)) {
+    case ICAL_DATETIME_VALUE:
+    case ICAL_DATE_VALUE:
+	tt = (icalvalue_isa(value) == ICAL_DATE_VALUE) ?
+	    icalvalue_get_date(value) : icalvalue_get_datetime(value);
+	snap_put_u32(o, tt.year);
+	snap_put_u32(o, tt.month);
+	snap_put_u32(o, tt.day);
+	snap_put_u32(o, tt.hour);
+	snap_put_u32(o, tt.minute);
+	snap_put_u32(o, tt.second);
+	snap_put_u32(o, (tt.is_utc ? 1 : 0) | (tt.is_date ? 2 : 0)
+		     | (tt.is_daylight ? 4 : 0) | (tt.zone ? 8 : 0));
+	break;
+    case ICAL_INTEGER_VALUE:
+	snap_put_u32(o, icalvalue_get_integer(value));
+	break;
+    case ICAL_DURATION_VALUE:
+	dur = icalvalue_get_duration(value);
+	snap_put_u32(o, dur.is_neg);
+	snap_put_u32(o, dur.days);
+	snap_put_u32(o, dur.weeks);
+	snap_put_u32(o, dur.hours);
+	snap_put_u32(o, dur.minutes);
+	snap_put_u32(o, dur.seconds);
+	break;
+    case ICAL_TEXT_VALUE:
+	snap_put_str(o, icalvalue_get_text(value));
+	break;
+    case ICAL_X_VALUE:
+	snap_put_str(o, icalvalue_get_x(value));
+	break;
+    default:
+	snap_put_str(o, icalvalue_as_ical_string(value));
+	break;
+    }
+}
+
+static void snap_put_component(struct snap_out *o, icalcomponent *comp)
+{
+    icalcomponent_kind kind = icalcomponent_isa(comp);
+    icalproperty *prop;
+    icalcompiter i;
+
+    if (kind == ICAL_X_COMPONENT || kind == ICAL_NO_COMPONENT
+	|| kind == ICAL_ANY_COMPONENT) {
+	snap_put_u8(o, 'R');
+	snap_put_str(o, icalcomponent_as_ical_string(comp));
+	return;
+    }
+
+    snap_put_u8(o, 'B');
+    snap_put_u32(o, (unsigned int)kind);
+    for (prop = icalcomponent_get_first_property(comp, ICAL_ANY_PROPERTY);
+	 prop != 0;
+	 prop = icalcomponent_get_next_property(comp, ICAL_ANY_PROPERTY))
+	snap_put_property(o, prop);
+    /* external iterator: the caller may be walking these components */
+    for (i = icalcomponent_begin_component(comp, ICAL_ANY_COMPONENT);
+	 icalcompiter_deref(&i) != 0;
+	 icalcompiter_next(&i))
+	snap_put_component(o, icalcompiter_deref(&i));
+    snap_put_u8(o, 'E');
+}
+
+static int snap_write_file(const char *snapshot, const char *data,
+			   size_t len)
+{
+#ifndef WIN32
+    char tmp[ICAL_PATH_MAX];
+    ssize_t sz;
+    int fd;
+
+    if (snprintf(tmp, ICAL_PATH_MAX, "%s.XXXXXX", snapshot) >= ICAL_PATH_MAX
+	|| (fd = mkstemp(tmp)) < 0)
+	return -1;
+
+    while (len > 0) {
+	sz = write(fd, data, len);
+	if (sz < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	data += sz;
+	len -= sz;
+    }
+    /* no fsync: a lost snapshot only means parsing the file once more */
+    if (close(fd) < 0 || len > 0 || rename(tmp, snapshot) < 0) {
+	unlink(tmp);
+	return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int icalsnapshot_write(const char *snapshot, const char *path,
+		       const struct icalsnapshot_key *key,
+		       icalcomponent *cluster)
+{
+    struct snap_out o;
+    unsigned long long body_len, body_hash;
+    size_t body_start, body_len_pos;
+    icalcompiter i;
+    int rtrn;
+
+    icalerror_check_arg_rx((snapshot!=0),"snapshot",-1);
+    icalerror_check_arg_rx((path!=0),"path",-1);
+    icalerror_check_arg_rx((key!=0),"key",-1);
+    icalerror_check_arg_rx((cluster!=0),"cluster",-1);
+
+    memset(&o, 0, sizeof(o));
+    snap_put(&o, ICALSNAPSHOT_MAGIC, 8);
+    snap_put_u32(&o, ICALSNAPSHOT_VERSION);
+    snap_put_u32(&o, ICALSNAPSHOT_BYTE_ORDER);
+    snap_put_u64(&o, key->size);
+    snap_put_u64(&o, (unsigned long long)key->mtime);
+    snap_put_u64(&o, key->hash);
+    snap_put_str(&o, path);
+    body_len_pos = o.used;
+    snap_put_u64(&o, 0); /* body length, filled in below */
+    snap_put_u64(&o, 0); /* body hash */
+    body_start = o.used;
+
+    /* the cluster is the XROOT made by icalfileset_read_file */
+    for (i = icalcomponent_begin_component(cluster, ICAL_ANY_COMPONENT);
+	 icalcompiter_deref(&i) != 0;
+	 icalcompiter_next(&i))
+	snap_put_component(&o, icalcompiter_deref(&i));
+
+    if (o.failed) {
+	free(o.data);
+	icalerror_set_errno(ICAL_NEWFAILED_ERROR);
+	return -1;
+    }
+    body_len = o.used - body_start;
+    body_hash = snap_hash(o.data + body_start, body_len);
+    memcpy(o.data + body_len_pos, &body_len, sizeof(body_len));
+    memcpy(o.data + body_len_pos + 8, &body_hash, sizeof(body_hash));
+
+    if ((rtrn = snap_write_file(snapshot, o.data, o.used)) < 0)
+	icalerror_set_errno(ICAL_FILE_ERROR);
+    free(o.data);
+    return rtrn;
+}
+
+/************************************************************************
+ * Reading
+ ************************************************************************/
+
+struct snap_in {
+    const char *p;
+    const char *end;
+    int bad;
+};
+
+static const void *snap_get(struct snap_in *in, size_t len)
+{
+    const char *p = in->p;
+
+    if (in->bad || (size_t)(in->end - p) < len) {
+	in->bad = 1;
+	return 0;
+    }
+    in->p += len;
+    return p;
+}
+
+static char snap_get_u8(struct snap_in *in)
+{
+    const char *p = snap_get(in, 1);
+
+    return p ? *p : 0;
+}
+
+static unsigned int snap_get_u32(struct snap_in *in)
+{
+    const void *p = snap_get(in, sizeof(unsigned int));
+    unsigned int v = 0;
+
+    if (p)
+	memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned long long snap_get_u64(struct snap_in *in)
+{
+    const void *p = snap_get(in, sizeof(unsigned long long));
+    unsigned long long v = 0;
+
+    if (p)
+	memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* returns a pointer into the snapshot buffer */
+static const char *snap_get_str(struct snap_in *in)
+{
+    unsigned int len = snap_get_u32(in);
+    const char *str;
+
+    if (in->bad || len == ICALSNAPSHOT_NO_STRING)
+	return 0;
+    if ((str = snap_get(in, (size_t)len + 1)) == 0 || str[len] != '\0') {
+	in->bad = 1;
+	return 0;
+    }
+    return str;
+}
+
+static icalvalue *snap_get_value(struct snap_in *in)
+{
+    icalvalue_kind kind = (icalvalue_kind)snap_get_u32(in);
+    struct icaltimetype tt;
+    struct icaldurationtype dur;
+    unsigned int flags;
+    const char *str;
+
+    switch (kind) {
+    case ICAL_DATETIME_VALUE:
+    case ICAL_DATE_VALUE:
+	tt = icaltime_null_time();
+	tt.year = snap_get_u32(in);
+	tt.month = snap_get_u32(in);
+	tt.day = snap_get_u32(in);
+	tt.hour = snap_get_u32(in);
+	tt.minute = snap_get_u32(in);
+	tt.second = snap_get_u32(in);
+	flags = snap_get_u32(in);
+	tt.is_utc = (flags & 1) ? 1 : 0;
+	tt.is_date = (flags & 2) ? 1 : 0;
+	tt.is_daylight = (flags & 4) ? 1 : 0;
+	tt.zone = (flags & 8) ? icaltimezone_get_utc_timezone() : 0;
+	if (in->bad)
+	    return 0;
+	return (kind == ICAL_DATE_VALUE ? icalvalue_new_date(tt)
+		: icalvalue_new_datetime(tt));
+    case ICAL_INTEGER_VALUE:
+	flags = snap_get_u32(in);
+	return (in->bad ? 0 : icalvalue_new_integer((int)flags));
+    case ICAL_DURATION_VALUE:
+	dur.is_neg = snap_get_u32(in);
+	dur.days = snap_get_u32(in);
+	dur.weeks = snap_get_u32(in);
+	dur.hours = snap_get_u32(in);
+	dur.minutes = snap_get_u32(in);
+	dur.seconds = snap_get_u32(in);
+	return (in->bad ? 0 : icalvalue_new_duration(dur));
+    case ICAL_TEXT_VALUE:
+	str = snap_get_str(in);
+	return (str ? icalvalue_new_text(str) : 0);
+    case ICAL_X_VALUE:
+	str = snap_get_str(in);
+	return (str ? icalvalue_new_x(str) : 0);
+    default:
+	str = snap_get_str(in);
+	return (str ? icalvalue_new_from_string(kind, str) : 0);
+    }
+}
+
+static icalproperty *snap_get_property(struct snap_in *in)
+{
+    icalproperty *prop;
+    icalparameter *param;
+    icalparameter_kind kind;
+    icalvalue *value;
+    unsigned int cnt;
+    const char *name, *str;
+
+    prop = icalproperty_new((icalproperty_kind)snap_get_u32(in));
+    name = snap_get_str(in);
+    if (prop == 0) {
+	in->bad = 1;
+	return 0;
+    }
+    if (name != 0)
+	icalproperty_set_x_name(prop, name);
+
+    /* parameters are made like icalparser does */
+    for (cnt = snap_get_u32(in); cnt > 0 && !in->bad; cnt--) {
+	kind = (icalparameter_kind)snap_get_u32(in);
+	name = snap_get_str(in);
+	if ((str = snap_get_str(in)) == 0) {
+	    in->bad = 1;
+	    break;
+	}
+	if (kind == ICAL_X_PARAMETER) {
+	    if (name == 0 || (param = icalparameter_new(kind)) == 0) {
+		in->bad = 1;
+		break;
+	    }
+	    icalparameter_set_xname(param, name);
+	    icalparameter_set_xvalue(param, str);
+	} else if ((param = icalparameter_new_from_value_string(kind, str))
+		   == 0) {
+	    in->bad = 1;
+	    break;
+	}
+	icalproperty_add_parameter(prop, param);
+    }
+    if (in->bad || (value = snap_get_value(in)) == 0) {
+	icalproperty_free(prop);
+	in->bad = 1;
+	return 0;
+    }
+    icalproperty_set_value(prop, value);
+    return prop;
+}
+
+/* Rebuild the components; returns the XROOT cluster */
+static icalcomponent *snap_get_cluster(struct snap_in *in)
+{
+    icalcomponent *root, *comp, *parent;
+    icalproperty *prop;
+    const char *str;
+    char type;
+
+    root = icalcomponent_new(ICAL_XROOT_COMPONENT);
+    parent = root;
+    while (in->p < in->end && !in->bad) {
+	switch (type = snap_get_u8(in)) {
+	case 'B':
+	    comp = icalcomponent_new(
+		    (icalcomponent_kind)snap_get_u32(in));
+	    if (comp == 0) {
+		in->bad = 1;
+		break;
+	    }
+	    icalcomponent_add_component(parent, comp);
+	    parent = comp;
+	    break;
+	case 'E':
+	    if (parent == root)
+		in->bad = 1;
+	    else
+		parent = icalcomponent_get_parent(parent);
+	    break;
+	case 'P':
+	case 'X':
+	    if (parent == root) {
+		in->bad = 1;
+		break;
+	    }
+	    if (type == 'P')
+		prop = snap_get_property(in);
+	    else
+		prop = (str = snap_get_str(in)) ?
+		    icalproperty_new_from_string(str) : 0;
+	    if (prop == 0)
+		in->bad = 1;
+	    else
+		icalcomponent_add_property(parent, prop);
+	    break;
+	case 'R':
+	    str = snap_get_str(in);
+	    comp = str ? icalcomponent_new_from_string((char *)str) : 0;
+	    if (comp == 0)
+		in->bad = 1;
+	    else
+		icalcomponent_add_component(parent, comp);
+	    break;
+	default:
+	    in->bad = 1;
+	    break;
+	}
+    }
+    if (in->bad || parent != root) {
+	icalcomponent_free(root);
+	return 0;
+    }
+    return root;
+}
+
+static char *snap_read_file(const char *snapshot, size_t *len)
+{
+    struct stat sbuf;
+    char *data;
+    size_t pos = 0;
+    ssize_t sz;
+    int fd;
+
+    if ((fd = open(snapshot, O_RDONLY)) < 0)
+	return 0;
+    if (fstat(fd, &sbuf) != 0 || sbuf.st_size <= 0
+	|| (data = malloc((size_t)sbuf.st_size)) == 0) {
+	close(fd);
+	return 0;
+    }
+    while (pos < (size_t)sbuf.st_size) {
+	sz = read(fd, data + pos, (size_t)sbuf.st_size - pos);
+	if (sz < 0 && errno == EINTR)
+	    continue;
+	if (sz <= 0)
+	    break;
+	pos += sz;
+    }
+    close(fd);
+    if (pos != (size_t)sbuf.st_size) {
+	free(data);
+	return 0;
+    }
+    *len = pos;
+    return data;
+}
+
+icalcomponent* icalsnapshot_read(const char *snapshot, const char *path,
+				 const struct icalsnapshot_key *key)
+{
+    struct snap_in in;
+    icalcomponent *cluster = 0;
+    const char *magic, *snap_path;
+    unsigned long long body_len, body_hash;
+    char *data;
+    size_t len;
+
+    icalerror_check_arg_rz((snapshot!=0),"snapshot");
+    icalerror_check_arg_rz((path!=0),"path");
+    icalerror_check_arg_rz((key!=0),"key");
+
+    if ((data = snap_read_file(snapshot, &len)) == 0)
+	return 0;
+
+    in.p = data;
+    in.end = data + len;
+    in.bad = 0;
+    magic = snap_get(&in, 8);
+    if (in.bad || memcmp(magic, ICALSNAPSHOT_MAGIC, 8) != 0
+	|| snap_get_u32(&in) != ICALSNAPSHOT_VERSION
+	|| snap_get_u32(&in) != ICALSNAPSHOT_BYTE_ORDER
+	|| snap_get_u64(&in) != key->size
+	|| snap_get_u64(&in) != (unsigned long long)key->mtime
+	|| snap_get_u64(&in) != key->hash
+	|| (snap_path = snap_get_str(&in)) == 0
+	|| strcmp(snap_path, path) != 0) {
+	free(data);
+	return 0;
+    }
+    body_len = snap_get_u64(&in);
+    body_hash = snap_get_u64(&in);
+    if (in.bad || body_len != (unsigned long long)(in.end - in.p)
+	|| body_hash != snap_hash(in.p, (size_t)body_len)) {
+	free(data);
+	return 0;
+    }
+
+    cluster = snap_get_cluster(&in);
+    free(data);
+    return cluster;
+}
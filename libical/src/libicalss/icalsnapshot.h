@@ -0,0 +1,58 @@
+/* -*- Mode: C -*-
+  ======================================================================
+  FILE: icalsnapshot.h
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of either:
+
+    The LGPL as published by the Free Software Foundation, version
+    2.1, available at: http://www.fsf.org/copyleft/lesser.html
+
+  Or:
+
+    The Mozilla Public License Version 1.0. You may obtain a copy of
+    the License at http://www.mozilla.org/MPL/
+
+ ======================================================================*/
+
+#ifndef ICALSNAPSHOT_H
+#define ICALSNAPSHOT_H
+
+#include "ical.h"
+#include <sys/types.h>
+
+/* Binary snapshot of a parsed icalfileset. This is a private cache
+   of icalfileset (see icalfileset_options.snapshot), not an exchange
+   format: it is only valid on the machine and build which wrote it. */
+
+/** Identifies the exact calendar file content a snapshot was made from */
+struct icalsnapshot_key {
+    unsigned long long size;	/**< file size in bytes */
+    long long mtime;		/**< file modification time */
+    unsigned long long hash;	/**< icalsnapshot_hash of the content */
+};
+
+/** Content hash, which can be computed piece by piece */
+struct icalsnapshot_hash {
+    unsigned long long h;
+    unsigned long long word;	/**< partial word from the previous piece */
+    size_t fill;		/**< bytes in word */
+};
+
+void icalsnapshot_hash_init(struct icalsnapshot_hash *hs);
+void icalsnapshot_hash_add(struct icalsnapshot_hash *hs,
+			   const char *data, size_t len);
+unsigned long long icalsnapshot_hash_end(struct icalsnapshot_hash *hs);
+
+/** Load the cluster stored in snapshot file, if it was made from path
+    with exactly this key. Returns 0 when there is no valid snapshot */
+icalcomponent* icalsnapshot_read(const char *snapshot, const char *path,
+				 const struct icalsnapshot_key *key);
+
+/** Store cluster, which is the parsed content of path with key, into
+    snapshot file. Returns 0 on success */
+int icalsnapshot_write(const char *snapshot, const char *path,
+		       const struct icalsnapshot_key *key,
+		       icalcomponent *cluster);
+
+#endif /* !ICALSNAPSHOT_H */
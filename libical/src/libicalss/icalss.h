@@ -123,7 +123,7 @@ typedef enum icalset_kind {
 
 typedef struct icalsetiter
 {
-	icalcompiter iter;    /* icalcomponent_kind, pvl_elem iter */
+	icalcompiter iter;    /* icalcomponent_kind, icalcomponent *iter */
 	icalgauge* gauge;
         icalrecur_iterator* ritr; /*the last iterator*/
         icalcomponent* last_component; /*the pending recurring component to be processed  */
@@ -413,6 +413,42 @@ icalcomponent* icalfileset_form_a_matched_recurrence_component(icalsetiter* itr)
 
 icalcomponent* icalfileset_get_component(icalset* cluster);
 
+/** Store the parsed set into options.snapshot, so that next time the
+    same file content is opened it need not be parsed. Does nothing if
+    the snapshot is up to date or the set has uncommitted changes. */
+icalerrorenum icalfileset_write_snapshot(icalset* set);
+
+/**
+ * @brief how hard icalfileset_commit() tries to get data on disk.
+ *
+ * The file is always written to a temporary file which then replaces
+ * the original with rename(), so a crash leaves either the old or the
+ * new file.  The levels only select which fsync() calls are done.
+ */
+
+typedef enum icalfileset_durability {
+  ICALFILESET_SYNC_NONE = 0,	/**< no fsync, leave it to the OS */
+  ICALFILESET_SYNC_FILE,	/**< fsync the new file before rename */
+  ICALFILESET_SYNC_DIR		/**< also fsync the directory after rename */
+} icalfileset_durability;
+
+/**
+ * @brief compression of the file on disk.
+ *
+ * Compressed files are recognized by their magic bytes when they are
+ * read, and a set keeps writing its file the way it was read. Needs zlib.
+ */
+
+typedef enum icalfileset_compression {
+  ICALFILESET_COMPRESS_NONE = 0,	/**< plain text */
+  ICALFILESET_COMPRESS_GZIP		/**< gzip */
+} icalfileset_compression;
+
+/** Select how the next commits write the file. The file is rewritten on
+    next commit if this changes it. */
+icalerrorenum icalfileset_set_compression(icalset* set,
+					  icalfileset_compression compression);
+
 /** 
  * @brief options for opening an icalfileset.
  *
@@ -422,8 +458,11 @@ icalcomponent* icalfileset_get_component(icalset* cluster);
 typedef struct icalfileset_options {
   int          flags;		/**< flags for open() O_RDONLY, etc  */
   mode_t       mode;		/**< file mode */
-  int          safe_saves;	/**< to lock or not */
+  int          safe_saves;	/**< keep previous version as path.bak */
   icalcluster  *cluster;	/**< use this cluster to initialize data */
+  icalfileset_durability durability; /**< fsync level for commits */
+  const char   *snapshot;	/**< binary snapshot cache file, or NULL */
+  icalfileset_compression compression; /**< how new files are written */
 } icalfileset_options;
 
 extern icalfileset_options icalfileset_options_default;
@@ -507,8 +507,9 @@ static void on_arrow_down_press_event_cb(GtkWidget *widget
     changeSelectedDate((day_win *)user_data, 7);
 }
 
-static void add_row(day_win *dw, xfical_appt *appt)
+static void add_row(day_win *dw, xfical_occurrence *occ)
 {
+    xfical_appt *appt = occ->appt;
     gint row, start_row, end_row, days;
     gint col, start_col, end_col, first_col, last_col;
     gint height, start_height, end_height;
@@ -520,8 +521,8 @@ static void add_row(day_win *dw, xfical_appt *appt)
     gchar *format_bold = "<b> %s </b>";
 
     /* First clarify timings */
-    tm_start = orage_icaltime_to_tm_time(appt->starttimecur, FALSE);
-    tm_end   = orage_icaltime_to_tm_time(appt->endtimecur, FALSE);
+    tm_start = orage_icaltime_to_tm_time(occ->starttimecur, FALSE);
+    tm_end   = orage_icaltime_to_tm_time(occ->endtimecur, FALSE);
     tm_first = orage_icaltime_to_tm_time(dw->a_day, FALSE);
     start_col = orage_days_between(&tm_first, &tm_start)+1;
     end_col   = orage_days_between(&tm_first, &tm_end)+1;
@@ -680,18 +681,18 @@ static void add_row(day_win *dw, xfical_appt *appt)
 static void app_rows(day_win *dw, xfical_type ical_type, gchar *file_type)
 {
     GList *appt_list=NULL, *tmp;
-    xfical_appt *appt;
+    xfical_occurrence *occ;
 
     xfical_get_each_app_within_time(dw->a_day, dw->days
             , ical_type, file_type, &appt_list);
     for (tmp = g_list_first(appt_list);
          tmp != NULL;
          tmp = g_list_next(tmp)) {
-        appt = (xfical_appt *)tmp->data;
-        if (appt->priority < g_par.priority_list_limit) { 
-            add_row(dw, appt);
+        occ = (xfical_occurrence *)tmp->data;
+        if (occ->appt->priority < g_par.priority_list_limit) { 
+            add_row(dw, occ);
         }
-        xfical_appt_free(appt);
+        xfical_occurrence_free(occ);
     }
     g_list_free(appt_list);
 }
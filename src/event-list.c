@@ -159,18 +159,15 @@ static int append_time(char *result, char *ical_time, int i)
     return(6);
 }
 
-static char *format_time(el_win *el, xfical_appt *appt, char *par)
+static char *format_time(el_win *el, xfical_appt *appt
+        , char *start_ical_time, char *end_ical_time, char *par)
 {
     char *result;
     char *tmp;
     int i = 0, j = 0;
-    char *start_ical_time;
-    char *end_ical_time;
     gboolean same_date;
     struct tm t = {0,0,0,0,0,0,0,0,0};
 
-    start_ical_time = appt->starttimecur;
-    end_ical_time = appt->endtimecur;
     same_date = !strncmp(start_ical_time, end_ical_time, 8);
     result = g_new0(char, 51);
 
@@ -192,7 +189,7 @@ static char *format_time(el_win *el, xfical_appt *appt, char *par)
         }
     }
     else { /* normally show date and time */
-        t = orage_icaltime_to_tm_time(appt->starttimecur, TRUE);
+        t = orage_icaltime_to_tm_time(start_ical_time, TRUE);
         tmp = orage_tm_date_to_i18_date(&t);
         i = g_strlcpy(result, tmp, 50);
         if (start_ical_time[8] == 'T') { /* time part available */
@@ -204,7 +201,7 @@ static char *format_time(el_win *el, xfical_appt *appt, char *par)
             }
             else {
                 if (!same_date) {
-                    t = orage_icaltime_to_tm_time(appt->endtimecur, TRUE);
+                    t = orage_icaltime_to_tm_time(end_ical_time, TRUE);
                     tmp = orage_tm_date_to_i18_date(&t);
                     i = g_strlcat(result, tmp, 50);
                     result[i++] = ' ';
@@ -218,7 +215,7 @@ static char *format_time(el_win *el, xfical_appt *appt, char *par)
                 g_strlcat(result, "...", 50);
             }
             else {
-                t = orage_icaltime_to_tm_time(appt->endtimecur, TRUE);
+                t = orage_icaltime_to_tm_time(end_ical_time, TRUE);
                 tmp = orage_tm_date_to_i18_date(&t);
                 g_strlcat(result, tmp, 50);
             }
@@ -362,7 +359,10 @@ static void start_time_data_func(GtkTreeViewColumn *col, GtkCellRenderer *rend
     }
 }
 
-static void add_el_row(el_win *el, xfical_appt *appt, char *par)
+/* starttimecur and endtimecur are given separately, since appointments
+ * from xfical_get_each_app_within_time keep them in the occurrence */
+static void add_el_row(el_win *el, xfical_appt *appt
+        , char *starttimecur, char *endtimecur, char *par)
 {
     GtkTreeIter     iter1;
     GtkListStore   *list1;
@@ -373,7 +373,7 @@ static void add_el_row(el_win *el, xfical_appt *appt, char *par)
     gchar          *tmp_note;
     guint           len = 50;
 
-    stime = format_time(el, appt, par);
+    stime = format_time(el, appt, starttimecur, endtimecur, par);
     if (appt->display_alarm_orage || appt->display_alarm_notify 
     ||  appt->sound_alarm || appt->procedure_alarm)
         if (appt->alarm_persistent)
@@ -428,7 +428,7 @@ static void add_el_row(el_win *el, xfical_appt *appt, char *par)
         g_free(tmp_note);
     }
 
-    s_sort1 = g_strconcat(appt->starttimecur, appt->endtimecur, NULL);
+    s_sort1 = g_strconcat(starttimecur, endtimecur, NULL);
     /*
     s_sort = g_utf8_collate_key(s_sort1, -1);
     */
@@ -451,48 +451,33 @@ static void add_el_row(el_win *el, xfical_appt *appt, char *par)
     */
 }
 
-static void searh_rows(el_win *el, gchar *search_string, gchar *file_type)
-{
-    xfical_appt *appt;
-
-    for (appt = xfical_appt_get_next_with_string(search_string, TRUE
-                , file_type);
-         appt;
-         appt = xfical_appt_get_next_with_string(search_string, FALSE
-                 , file_type)) {
-        add_el_row(el, appt, NULL);
-        xfical_appt_free(appt);
-    }
-}
-
 static void search_data(el_win *el)
 {
-    gchar *search_string = NULL, file_type[8];
-    gint i;
+    GList *appts, *l;
+    xfical_appt *appt;
+#ifdef HAVE_ARCHIVE
+    gboolean archive;
+#endif
 
-    search_string = g_utf8_strup(gtk_entry_get_text(
-                (GtkEntry *)el->search_entry), -1);
-    /* first search base orage file */
     if (!xfical_file_open(TRUE))
         return;
-    strcpy(file_type, "O00.");
-    searh_rows(el, search_string, file_type);
-    /* then process all foreign files */
-    for (i = 0; i < g_par.foreign_count; i++) {
-        g_sprintf(file_type, "F%02d.", i);
-        searh_rows(el, search_string, file_type);
+#ifdef HAVE_ARCHIVE
+    /* archive file is always searched also */
+    archive = xfical_archive_open();
+#endif
+    appts = xfical_appt_search((char *)gtk_entry_get_text(
+                (GtkEntry *)el->search_entry));
+    for (l = appts; l != NULL; l = g_list_next(l)) {
+        appt = (xfical_appt *)l->data;
+        add_el_row(el, appt, appt->starttimecur, appt->endtimecur, NULL);
+        xfical_appt_free(appt);
     }
-
+    g_list_free(appts);
 #ifdef HAVE_ARCHIVE
-    /* finally process always archive file also */
-    if (xfical_archive_open()) {
-        strcpy(file_type, "A00.");
-        searh_rows(el, search_string, file_type);
+    if (archive)
         xfical_archive_close();
-    }
 #endif
     xfical_file_close(TRUE);
-    g_free(search_string);
 }
 
 static void app_rows(el_win *el, char *a_day, char *par, xfical_type ical_type
@@ -500,6 +485,7 @@ static void app_rows(el_win *el, char *a_day, char *par, xfical_type ical_type
 {
     GList *appt_list=NULL, *tmp;
     xfical_appt *appt;
+    xfical_occurrence *occ;
 
     if (ical_type == XFICAL_TYPE_EVENT && !el->only_first) {
         xfical_get_each_app_within_time(a_day, el->days+1
@@ -507,11 +493,12 @@ static void app_rows(el_win *el, char *a_day, char *par, xfical_type ical_type
         for (tmp = g_list_first(appt_list);
              tmp != NULL;
              tmp = g_list_next(tmp)) {
-            appt = (xfical_appt *)tmp->data;
-            if (appt->priority < g_par.priority_list_limit) {
-                add_el_row(el, appt, par);
+            occ = (xfical_occurrence *)tmp->data;
+            if (occ->appt->priority < g_par.priority_list_limit) {
+                add_el_row(el, occ->appt, occ->starttimecur, occ->endtimecur
+                        , par);
             }
-            xfical_appt_free(appt);
+            xfical_occurrence_free(occ);
         }
         g_list_free(appt_list);
     }
@@ -533,7 +520,8 @@ static void app_rows(el_win *el, char *a_day, char *par, xfical_type ical_type
             if (!(appt->endtimecur[8] == 'T' 
                 && strncmp(appt->endtimecur+9, "000000", 6) == 0
                 && strncmp(appt->endtimecur, a_day, 8) == 0))
-                add_el_row(el, appt, par);
+                add_el_row(el, appt, appt->starttimecur, appt->endtimecur
+                        , par);
             xfical_appt_free(appt);
         }
     }
@@ -574,7 +562,7 @@ static void app_data(el_win *el, char *a_day, char *par)
 #ifdef HAVE_ARCHIVE
     /* finally process archive file for JOURNAL only */
     if (ical_type == XFICAL_TYPE_JOURNAL) {
-        if (xfical_archive_open()) {
+        if (xfical_archive_open_period(a_day, el->days, ical_type)) {
             strcpy(file_type, "A00.");
             app_rows(el, a_day, par, ical_type, file_type);
             xfical_archive_close();
@@ -681,6 +669,11 @@ void refresh_el_win(el_win *el)
     if (el->Window && el->ListStore && el->TreeView) {
         gtk_list_store_clear(el->ListStore);
         el->page = gtk_notebook_get_current_page(GTK_NOTEBOOK(el->Notebook));
+        /* search results are shown best match first */
+        gtk_tree_sortable_set_sort_column_id(el->TreeSortable
+                , el->page == SEARCH_PAGE
+                        ? GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID : COL_SORT
+                , GTK_SORT_ASCENDING);
         switch (el->page) {
             case EVENT_PAGE:
                 event_data(el);
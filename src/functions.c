@@ -882,7 +882,7 @@ gboolean orage_copy_file(gchar *source, gchar *target)
         ok = FALSE;
     }
     /* write file */
-    if (ok && !g_file_set_contents(target, text, -1, &error)) {
+    if (ok && !g_file_set_contents(target, text, text_len, &error)) {
         orage_message(150, "orage_copy_file: Could not write file (%s) error:%s"
                 , target, error->message);
         g_error_free(error);
@@ -987,6 +987,25 @@ gchar *orage_config_file_location(char *name)
     return(file_name);
 }
 
+/* Returns xdg cache file name and makes sure its directory exists.
+   Cache files can always be recreated, so there are no system defaults */
+gchar *orage_cache_file_location(char *name)
+{
+    char *file_name, *dir_name;
+    const char *base_dir;
+    int mode = 0700;
+
+    base_dir = g_get_user_cache_dir();
+    file_name = g_build_filename(base_dir, name, NULL);
+    dir_name = g_path_get_dirname((const gchar *)file_name);
+    if (g_mkdir_with_parents(dir_name, mode)) {
+        orage_message(150, "orage_cache_file_location: (%s) (%s) directory creation failed.\n", base_dir, file_name);
+    }
+    g_free(dir_name);
+
+    return(file_name);
+}
+
 /*******************************************************
  * rc file interface
  *******************************************************/
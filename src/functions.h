@@ -116,8 +116,10 @@ gint orage_days_between(struct tm *t1, struct tm *t2);
 void orage_select_date(GtkCalendar *cal, guint year, guint month, guint day);
 void orage_select_today(GtkCalendar *cal);
 
+gboolean orage_copy_file(gchar *source, gchar *target);
 gchar *orage_data_file_location(char *dir_name);
 gchar *orage_config_file_location(char *dir_name);
+gchar *orage_cache_file_location(char *dir_name);
 OrageRc *orage_rc_file_open(char *fpath, gboolean read_only);
 void orage_rc_file_close(OrageRc *orc);
 gchar **orage_rc_get_groups(OrageRc *orc);
@@ -77,38 +77,203 @@
 
 
 #ifdef HAVE_ARCHIVE
-gboolean xfical_archive_open(void)
+/* Archive is split by the start year of the appointments into partition
+ * files "<archive file>.<yyyy>", so that we only need to read the years we
+ * are interested in. "<archive file>.idx" has one line per archived
+ * appointment: "<yyyy> <yyyymmdd> <kind> <uid>\n" (partition year, start
+ * date, E/T/J for event/todo/journal, uid).
+ * Old archives were one file, "<archive file>" itself. Those are split
+ * into partitions when they are used the first time.
+ */
+
+static gchar *archive_partition_file(const gchar *archive, gint year)
+{
+    return(g_strdup_printf("%s.%04d", archive, year));
+}
+
+static gchar *archive_index_file(const gchar *archive)
+{
+    return(g_strconcat(archive, ".idx", NULL));
+}
+
+static gint archive_year_order(gconstpointer a, gconstpointer b)
+{
+    return(*(const gint *)a - *(const gint *)b);
+}
+
+static void archive_year_add(GArray *years, gint year)
+{
+    guint i;
+
+    for (i = 0; i < years->len; i++)
+        if (g_array_index(years, gint, i) == year)
+            return;
+    g_array_append_val(years, year);
+}
+
+/* years of all partition files found in the archive directory */
+static GArray *archive_partitions(const gchar *archive)
 {
 #undef P_N
-#define P_N "xfical_archive_open: "
+#define P_N "archive_partitions: "
+    GArray *years;
+    GDir *dir;
+    const gchar *name;
+    gchar *dir_name, *base;
+    gsize base_len;
+
 #ifdef ORAGE_DEBUG
-    orage_message(-100, P_N);
+    orage_message(-300, P_N);
 #endif
-    if (!g_par.archive_limit)
-        return(FALSE);
-    if (!ORAGE_STR_EXISTS(g_par.archive_file))
-        return(FALSE);
+    years = g_array_new(FALSE, FALSE, sizeof(gint));
+    dir_name = g_path_get_dirname(archive);
+    base = g_path_get_basename(archive);
+    base_len = strlen(base);
+    if ((dir = g_dir_open(dir_name, 0, NULL)) != NULL) {
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            if (strncmp(name, base, base_len) == 0 && name[base_len] == '.'
+            &&  strlen(name+base_len+1) == 4
+            &&  g_ascii_isdigit(name[base_len+1])
+            &&  g_ascii_isdigit(name[base_len+2])
+            &&  g_ascii_isdigit(name[base_len+3])
+            &&  g_ascii_isdigit(name[base_len+4]))
+                archive_year_add(years, atoi(name+base_len+1));
+        }
+        g_dir_close(dir);
+    }
+    g_array_sort(years, archive_year_order);
+    g_free(base);
+    g_free(dir_name);
+    return(years);
+}
+
+/* years of partitions, which have appointments of kind (0 = any) starting
+ * from...to (yyyymmdd, NULL = no limit) and with uid (NULL = any).
+ * returns NULL if there is no index. */
+static GArray *archive_index_years(gchar kind, const gchar *from
+        , const gchar *to, const gchar *uid)
+{
+#undef P_N
+#define P_N "archive_index_years: "
+    GArray *years;
+    gchar *file, *contents, *line, *nl;
 
-    return(ic_internal_file_open(&ic_aical, &ic_afical, g_par.archive_file
-            , FALSE, FALSE));
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    file = archive_index_file(g_par.archive_file);
+    if (!g_file_get_contents(file, &contents, NULL, NULL)) {
+        g_free(file);
+        return(NULL);
+    }
+    years = g_array_new(FALSE, FALSE, sizeof(gint));
+    for (line = contents; line != NULL; line = nl ? nl+1 : NULL) {
+        if ((nl = strchr(line, '\n')) != NULL)
+            *nl = '\0';
+        if (strlen(line) < 17 
+        ||  line[4] != ' ' || line[13] != ' ' || line[15] != ' ')
+            continue;
+        if ((kind && line[14] != kind)
+        ||  (from && strncmp(line+5, from, 8) < 0)
+        ||  (to && strncmp(line+5, to, 8) > 0)
+        ||  (uid && strcmp(line+16, uid) != 0))
+            continue;
+        archive_year_add(years, atoi(line));
+    }
+    g_array_sort(years, archive_year_order);
+    g_free(contents);
+    g_free(file);
+    return(years);
 }
+
+static void archive_index_append(const gchar *lines)
+{
+#undef P_N
+#define P_N "archive_index_append: "
+    gchar *file;
+    FILE *f;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
 #endif
+    if (!ORAGE_STR_EXISTS(lines))
+        return;
+    file = archive_index_file(g_par.archive_file);
+    if ((f = g_fopen(file, "a")) == NULL
+    ||  fputs(lines, f) < 0 || fclose(f) != 0)
+        orage_message(250, P_N "writing %s failed: %d (%s)"
+                , file, errno, strerror(errno));
+    g_free(file);
+}
 
-#ifdef HAVE_ARCHIVE
-void xfical_archive_close(void)
+static void archive_index_remove(const gchar *uid)
 {
-#undef  P_N 
-#define P_N "xfical_archive_close: "
+#undef P_N
+#define P_N "archive_index_remove: "
+    gchar *file, *contents, *line, *nl;
+    GString *lines;
+    GError *error = NULL;
+
 #ifdef ORAGE_DEBUG
-    orage_message(-100, P_N);
+    orage_message(-300, P_N);
 #endif
-    if (!ORAGE_STR_EXISTS(g_par.archive_file))
+    file = archive_index_file(g_par.archive_file);
+    if (!g_file_get_contents(file, &contents, NULL, NULL)) {
+        g_free(file);
         return;
+    }
+    lines = g_string_new(NULL);
+    for (line = contents; line != NULL && *line; line = nl ? nl+1 : NULL) {
+        if ((nl = strchr(line, '\n')) != NULL)
+            *nl = '\0';
+        if (strlen(line) < 17 || strcmp(line+16, uid) != 0)
+            g_string_append_printf(lines, "%s\n", line);
+    }
+    if (!g_file_set_contents(file, lines->str, lines->len, &error)) {
+        orage_message(250, P_N "writing %s failed: %s", file, error->message);
+        g_error_free(error);
+    }
+    g_string_free(lines, TRUE);
+    g_free(contents);
+    g_free(file);
+}
 
-    if (ic_afical == NULL)
-        orage_message(150, P_N "afical is NULL");
-    icalset_free(ic_afical);
-    ic_afical = NULL;
+/* partition year, where c belongs to */
+static gint archive_year(icalcomponent *c)
+{
+    xfical_period per;
+
+    per = ic_get_period(c, TRUE);
+    if (per.stime.year < 0 || per.stime.year > 9999)
+        return(0);
+    return(per.stime.year);
+}
+
+static void archive_index_line(GString *lines, icalcomponent *c, gint year)
+{
+    xfical_period per;
+    const char *uid;
+    gchar kind;
+
+    uid = icalcomponent_get_uid(c);
+    if (!ORAGE_STR_EXISTS(uid) || strchr(uid, '\n'))
+        return;
+    per = ic_get_period(c, TRUE);
+    switch (per.ikind) {
+        case ICAL_VEVENT_COMPONENT:
+            kind = 'E';
+            break;
+        case ICAL_VTODO_COMPONENT:
+            kind = 'T';
+            break;
+        case ICAL_VJOURNAL_COMPONENT:
+            kind = 'J';
+            break;
+        default:
+            kind = 'X';
+    }
+    g_string_append_printf(lines, "%04d %04d%02d%02d %c %s\n", year
+            , per.stime.year, per.stime.month, per.stime.day, kind, uid);
 }
 #endif
 
@@ -140,24 +305,8 @@ static icalproperty *replace_repeating(icalcomponent *c, icalproperty *p
 }
 
 #ifdef HAVE_ARCHIVE
-static void xfical_icalcomponent_archive_normal(icalcomponent *e) 
-{
-#undef P_N
-#define P_N "xfical_icalcomponent_archive_normal: "
-    icalcomponent *d;
-
-#ifdef ORAGE_DEBUG
-    orage_message(-200, P_N);
-#endif
-    /* Add to the archive file */
-    d = icalcomponent_new_clone(e);
-    icalcomponent_add_component(ic_aical, d);
-
-    /* Remove from the main file */
-    icalcomponent_remove_component(ic_ical, e);
-}
-
-static void xfical_icalcomponent_archive_recurrent(icalcomponent *e
+/* returns TRUE when the recurrence has ended and e can be archived */
+static gboolean xfical_icalcomponent_archive_recurrent(icalcomponent *e
         , struct tm *threshold, char *uid)
 {
 #undef P_N
@@ -263,13 +412,15 @@ static void xfical_icalcomponent_archive_recurrent(icalcomponent *e
     }
     icalrecur_iterator_free(ri);
 
+    /* times change, so indexes need to see it as a new appointment */
+    ic_uid_index_remove(ic_ical, e);
     if (icaltime_is_null_time(nsdate)) { /* remove since it has ended */
         orage_message(20, _("\tRecur ended, moving to archive file."));
         if (has_orig_dtstart) 
             replace_repeating(e, p_origdtstart, ICAL_DTSTART_PROPERTY);
         if (has_orig_dtend) 
             replace_repeating(e, p_origdtend, ICAL_DTEND_PROPERTY);
-        xfical_icalcomponent_archive_normal(e);
+        return(TRUE);
     }
     else { /* modify times*/
         if (!has_orig_dtstart) {
@@ -306,22 +457,591 @@ static void xfical_icalcomponent_archive_recurrent(icalcomponent *e
                                 , icalparameter_new_tzid(etz_loc)
                                 , 0));
         }
+        ic_uid_index_add(ic_ical, e);
     }
+    return(FALSE);
 }
 
-gboolean xfical_archive(void)
+/* returns TRUE if c should be moved to the archive file */
+static gboolean archive_needed(icalcomponent *c, struct tm *threshold)
 {
 #undef P_N
-#define P_N "xfical_archive: "
-    /*
-    struct icaltimetype sdate, edate;
-    */
+#define P_N "archive_needed: "
     xfical_period per;
-    icalcomponent *c, *c2;
     icalproperty *p;
+    char *uid;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    per =  ic_get_period(c, TRUE);
+    uid = (char *)icalcomponent_get_uid(c);
+    /* Items with endate before threshold => archived.
+     * Recurring events are marked in the main file by adding special
+     * X-ORAGE_ORIG-DTSTART/X-ORAGE_ORIG-DTEND to save the original
+     * start/end dates. Then start_date is changed. These are NOT
+     * written in archive file (unless of course they really have ended).
+     */
+    if ((per.etime.year*12 + per.etime.month) 
+        >= (threshold->tm_year*12 + threshold->tm_mon))
+        return(FALSE);
+    orage_message(20, _("Archiving uid: %s"), uid);
+    /* FIXME: check VTODO completed before archiving it */
+    if (per.ikind == ICAL_VTODO_COMPONENT 
+        && ((per.ctime.year*12 + per.ctime.month) 
+            < (per.stime.year*12 + per.stime.month))) {
+        /* VTODO not completed, do not archive */
+        orage_message(20, _("\tVTODO not complete; not archived"));
+        return(FALSE);
+    }
+    p = icalcomponent_get_first_property(c, ICAL_RRULE_PROPERTY);
+    if (p) {  /*  it is recurrent event */
+        orage_message(20, _("\tRecurring. End year: %04d, month: %02d, day: %02d")
+            , per.etime.year, per.etime.month, per.etime.day);
+        return(xfical_icalcomponent_archive_recurrent(c, threshold, uid));
+    }
+    return(TRUE);
+}
+
+#define ARCHIVE_TAIL_LEN 256
+
+/* Undo a failed archive_append: put the original end of the file back at
+ * pos and cut the file to its original size, or remove the file if it was
+ * new. The original bytes were already on the disk, so this does not need
+ * more space than the file had. */
+static void archive_append_undo(const gchar *file_name, long pos
+        , const gchar *orig)
+{
+#undef P_N
+#define P_N "archive_append_undo: "
+    FILE *file;
+    size_t len = strlen(orig);
+    gboolean ok;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (pos == 0 && len == 0) { /* new file */
+        if (g_remove(file_name) == 0)
+            return;
+        ok = FALSE;
+    }
+    else if ((file = g_fopen(file_name, "r+")) == NULL)
+        ok = FALSE;
+    else {
+        ok = fseek(file, pos, SEEK_SET) == 0
+                && fwrite(orig, 1, len, file) == len
+                && fflush(file) == 0
+                && ftruncate(fileno(file), pos + len) == 0
+                && fsync(fileno(file)) == 0;
+        if (fclose(file) != 0)
+            ok = FALSE;
+    }
+    if (!ok)
+        orage_message(250, P_N "could not restore %s: %d (%s)"
+                , file_name, errno, strerror(errno));
+}
+
+/* Append archived components to the end of the archive partition file
+ * without reading and parsing it: the final END:VCALENDAR is cut away and
+ * written again after the new components. New file is simply written.
+ * returns 1 when done, 0 when writing failed and -1 when the file does not
+ * end like we expect or is compressed. With -1 nothing has been written
+ * and the file needs to be written the slow way. With 0 the file has been
+ * restored to what it was. */
+static gint archive_append(const gchar *file_name, GList *archived)
+{
+#undef P_N
+#define P_N "archive_append: "
+    const gchar *end_cal = "END:VCALENDAR";
+    gchar tail[ARCHIVE_TAIL_LEN+1], *end, *orig = "";
+    FILE *file;
+    long size, pos;
+    size_t len;
+    GList *l;
+    gboolean ok;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+#ifndef HAVE_LIBICAL
+    if (g_par.archive_compress) /* libical writes it */
+        return(-1);
+#endif
+    if ((file = g_fopen(file_name, "r+")) == NULL) {
+        if (errno != ENOENT || (file = g_fopen(file_name, "w")) == NULL)
+            return(-1);
+        size = 0;
+    }
+    else if (fread(tail, 1, 2, file) == 2
+            && (guchar)tail[0] == 0x1f && (guchar)tail[1] == 0x8b) {
+        fclose(file); /* compressed, libical writes it */
+        return(-1);
+    }
+    else if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+        fclose(file);
+        return(-1);
+    }
+    if (size == 0) /* new file */
+        fputs("BEGIN:VCALENDAR\nVERSION:2.0\nPRODID:-//Xfce//Orage//EN\n"
+                , file);
+    else {
+        pos = size > ARCHIVE_TAIL_LEN ? size - ARCHIVE_TAIL_LEN : 0;
+        if (fseek(file, pos, SEEK_SET) != 0
+        ||  (len = fread(tail, 1, size - pos, file)) != (size_t)(size - pos)) {
+            fclose(file);
+            return(-1);
+        }
+        tail[len] = '\0';
+        if (strlen(tail) != len || (end = g_strrstr(tail, end_cal)) == NULL) {
+            fclose(file);
+            return(-1);
+        }
+        orig = end;
+        for (pos += end - tail, end += strlen(end_cal); *end; end++) {
+            if (!g_ascii_isspace(*end)) {
+                fclose(file);
+                return(-1);
+            }
+        }
+        if (fseek(file, pos, SEEK_SET) != 0) {
+            fclose(file);
+            return(-1);
+        }
+    }
+
+    /* checks done, let's start the real work */
+    for (l = g_list_first(archived); l != NULL; l = g_list_next(l))
+        ic_write_component(file, (icalcomponent *)l->data);
+    fprintf(file, "%s\n", end_cal);
+    ok = fflush(file) == 0 && !ferror(file)
+            && ftruncate(fileno(file), ftell(file)) == 0
+            && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+        ok = FALSE;
+    if (!ok) {
+        orage_message(250, P_N "writing %s failed: %d (%s)"
+                , file_name, errno, strerror(errno));
+        archive_append_undo(file_name, size ? pos : 0, orig);
+    }
+    return(ok ? 1 : 0);
+}
+
+/* Slow way: read the whole partition file, add archived components and
+ * write it back, compressed if so wanted. The components are freed with
+ * the file when this succeeds. */
+static gboolean archive_commit(gchar *file_name, GList *archived)
+{
+#undef P_N
+#define P_N "archive_commit: "
+    icalset *fical = NULL;
+    icalcomponent *ical = NULL;
+    GList *l;
+    gboolean ok;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    if (!ic_internal_file_open(&ical, &fical, file_name, FALSE, FALSE)) {
+        orage_message(250, P_N "archive file open error");
+        return(FALSE);
+    }
+    for (l = g_list_first(archived); l != NULL; l = g_list_next(l))
+        icalcomponent_add_component(ical, (icalcomponent *)l->data);
+    icalset_mark(fical);
+#ifndef HAVE_LIBICAL
+    icalfileset_set_compression(fical, g_par.archive_compress
+            ? ICALFILESET_COMPRESS_GZIP : ICALFILESET_COMPRESS_NONE);
+#endif
+    ok = (icalset_commit(fical) == ICAL_NO_ERROR);
+    if (!ok) {
+        orage_message(250, P_N "writing %s failed. %s"
+                , file_name, icalerror_strerror(icalerrno));
+        /* give them back to the caller */
+        for (l = g_list_first(archived); l != NULL; l = g_list_next(l))
+            icalcomponent_remove_component(ical, (icalcomponent *)l->data);
+    }
+    icalset_free(fical);
+    return(ok);
+}
+
+/* Group archived components by partition year. Takes the list. Returns
+ * hash table year -> list of components in their original order. */
+static GHashTable *archive_group(GList *archived)
+{
+    GHashTable *partitions;
+    GList *l, *years, *comps;
+    gint year;
+
+    partitions = g_hash_table_new(NULL, NULL);
+    for (l = g_list_first(archived); l != NULL; l = g_list_next(l)) {
+        year = archive_year((icalcomponent *)l->data);
+        comps = g_hash_table_lookup(partitions, GINT_TO_POINTER(year));
+        g_hash_table_insert(partitions, GINT_TO_POINTER(year)
+                , g_list_prepend(comps, l->data));
+    }
+    g_list_free(archived);
+    years = g_hash_table_get_keys(partitions);
+    for (l = g_list_first(years); l != NULL; l = g_list_next(l)) {
+        comps = g_hash_table_lookup(partitions, l->data);
+        g_hash_table_insert(partitions, l->data, g_list_reverse(comps));
+    }
+    g_list_free(years);
+    return(partitions);
+}
+
+/* Write components of one year into file and add their index lines to
+ * index. Takes the list and frees the components when done. Returns
+ * FALSE and leaves the components alone if writing failed. */
+static gboolean archive_store_year(const gchar *file, GList *comps, gint year
+        , GString *index)
+{
+    GString *lines;
+    GList *cl;
+    gint done;
+
+    lines = g_string_new(NULL);
+    for (cl = comps; cl != NULL; cl = g_list_next(cl))
+        archive_index_line(lines, (icalcomponent *)cl->data, year);
+    if ((done = archive_append(file, comps)) < 0)
+        done = archive_commit((gchar *)file, comps) ? 1 : 0;
+    else if (done) { /* written, not needed anymore */
+        for (cl = comps; cl != NULL; cl = g_list_next(cl))
+            icalcomponent_free((icalcomponent *)cl->data);
+    }
+    if (done) {
+        g_string_append_len(index, lines->str, lines->len);
+        g_list_free(comps);
+    }
+    g_string_free(lines, TRUE);
+    return(done != 0);
+}
+
+/* Write archived components into their year partitions and add them to
+ * the index. Takes the list. Written components are freed and the ones,
+ * which could not be written, are returned. */
+static GList *archive_store(GList *archived)
+{
+#undef P_N
+#define P_N "archive_store: "
+    GHashTable *partitions;
+    GList *l, *years, *comps, *failed = NULL;
+    GString *index;
+    gchar *file;
+    gint year;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    partitions = archive_group(archived);
+    index = g_string_new(NULL);
+    years = g_hash_table_get_keys(partitions);
+    for (l = g_list_first(years); l != NULL; l = g_list_next(l)) {
+        year = GPOINTER_TO_INT(l->data);
+        comps = g_hash_table_lookup(partitions, l->data);
+        file = archive_partition_file(g_par.archive_file, year);
+        if (!archive_store_year(file, comps, year, index))
+            failed = g_list_concat(failed, comps);
+        g_free(file);
+    }
+    archive_index_append(index->str);
+    g_string_free(index, TRUE);
+    g_list_free(years);
+    g_hash_table_destroy(partitions);
+    return(failed);
+}
+
+/* Put the new versions of files in place: each file.new replaces file.
+ * Old versions are first moved to file.old, so that if any rename fails,
+ * all files can be put back like they were. Removes the new versions
+ * which were not used. Returns FALSE if nothing was changed. */
+static gboolean archive_replace_files(GList *files)
+{
+#undef P_N
+#define P_N "archive_replace_files: "
+    GList *f, *done = NULL;
+    gchar *tmp, *old;
+    gboolean ok = TRUE;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    for (f = g_list_first(files); f != NULL && ok; f = g_list_next(f)) {
+        tmp = g_strconcat((gchar *)f->data, ".new", NULL);
+        old = g_strconcat((gchar *)f->data, ".old", NULL);
+        g_remove(old);
+        if ((g_file_test((gchar *)f->data, G_FILE_TEST_EXISTS)
+                && g_rename((gchar *)f->data, old) != 0)
+        ||  g_rename(tmp, (gchar *)f->data) != 0) {
+            orage_message(250, P_N "renaming %s failed: %d (%s)"
+                    , tmp, errno, strerror(errno));
+            ok = FALSE;
+            g_rename(old, (gchar *)f->data); /* if it was moved */
+        }
+        else
+            done = g_list_prepend(done, f->data);
+        g_free(tmp);
+        g_free(old);
+    }
+
+    for (f = g_list_first(done); f != NULL; f = g_list_next(f)) {
+        old = g_strconcat((gchar *)f->data, ".old", NULL);
+        if (ok)
+            g_remove(old);
+        else if (g_file_test(old, G_FILE_TEST_EXISTS)
+                ? g_rename(old, (gchar *)f->data) != 0
+                : g_remove((gchar *)f->data) != 0)
+            orage_message(350, P_N "could not restore %s: %d (%s)"
+                    , (gchar *)f->data, errno, strerror(errno));
+        g_free(old);
+    }
+    g_list_free(done);
+    for (f = g_list_first(files); f != NULL; f = g_list_next(f)) {
+        tmp = g_strconcat((gchar *)f->data, ".new", NULL);
+        g_remove(tmp); /* the ones not reached */
+        g_free(tmp);
+    }
+    return(ok);
+}
+
+/* Like archive_store, but all or nothing: every partition and the index
+ * are first written into temporary copies, which replace the real files
+ * only after all of them have been written. Takes the list and frees the
+ * components. Returns FALSE if nothing was stored. */
+static gboolean archive_store_all(GList *archived)
+{
+#undef P_N
+#define P_N "archive_store_all: "
+    GHashTable *partitions;
+    GList *l, *years, *comps, *cl, *files = NULL;
+    GString *index;
+    gchar *file, *tmp, *contents = NULL;
+    gint year;
+    gboolean ok = TRUE;
+    GError *error = NULL;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    partitions = archive_group(archived);
+    index = g_string_new(NULL);
+    years = g_hash_table_get_keys(partitions);
+    for (l = g_list_first(years); l != NULL; l = g_list_next(l)) {
+        year = GPOINTER_TO_INT(l->data);
+        comps = g_hash_table_lookup(partitions, l->data);
+        file = archive_partition_file(g_par.archive_file, year);
+        tmp = g_strconcat(file, ".new", NULL);
+        g_remove(tmp);
+        if (!ok
+        ||  (g_file_test(file, G_FILE_TEST_EXISTS)
+                && !orage_copy_file(file, tmp))
+        ||  !archive_store_year(tmp, comps, year, index)) {
+            ok = FALSE;
+            for (cl = comps; cl != NULL; cl = g_list_next(cl))
+                icalcomponent_free((icalcomponent *)cl->data);
+            g_list_free(comps);
+        }
+        files = g_list_append(files, file);
+        g_free(tmp);
+    }
+    g_list_free(years);
+    g_hash_table_destroy(partitions);
+
+    /* the index goes with the partitions */
+    file = archive_index_file(g_par.archive_file);
+    tmp = g_strconcat(file, ".new", NULL);
+    if (ok) {
+        if (g_file_get_contents(file, &contents, NULL, NULL))
+            g_string_prepend(index, contents);
+        if (!g_file_set_contents(tmp, index->str, index->len, &error)) {
+            orage_message(250, P_N "writing %s failed: %s"
+                    , tmp, error->message);
+            g_error_free(error);
+            ok = FALSE;
+        }
+        g_free(contents);
+    }
+    files = g_list_append(files, file);
+    g_free(tmp);
+    g_string_free(index, TRUE);
+
+    if (ok)
+        ok = archive_replace_files(files);
+    else { /* remove what was written */
+        for (l = g_list_first(files); l != NULL; l = g_list_next(l)) {
+            tmp = g_strconcat((gchar *)l->data, ".new", NULL);
+            g_remove(tmp);
+            g_free(tmp);
+        }
+    }
+    for (l = g_list_first(files); l != NULL; l = g_list_next(l))
+        g_free(l->data);
+    g_list_free(files);
+    return(ok);
+}
+
+/* Split old style archive, which is all in one file, into partitions */
+static void archive_split_old(void)
+{
+#undef P_N
+#define P_N "archive_split_old: "
+    icalset *fical = NULL;
+    icalcomponent *ical = NULL, *c;
+    GList *comps = NULL;
+    struct stat s;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    if (!ORAGE_STR_EXISTS(g_par.archive_file)
+    ||  g_stat(g_par.archive_file, &s) != 0)
+        return; /* nothing to split */
+    if (s.st_size > 0) {
+        orage_message(20, P_N "splitting %s into yearly files"
+                , g_par.archive_file);
+        if (!ic_internal_file_open(&ical, &fical, g_par.archive_file
+                , TRUE, FALSE)) {
+            orage_message(250, P_N "archive file open error");
+            return;
+        }
+        /* first component is found immediately, so removing is cheap */
+        while ((c = icalcomponent_get_first_component(ical
+                        , ICAL_ANY_COMPONENT)) != 0) {
+            icalcomponent_remove_component(ical, c);
+            comps = g_list_prepend(comps, c);
+        }
+        icalset_free(fical);
+        if (!archive_store_all(g_list_reverse(comps))) {
+            /* nothing was stored, keep the old file and try again next
+             * time */
+            orage_message(250, P_N "could not split %s", g_par.archive_file);
+            return;
+        }
+    }
+    if (g_remove(g_par.archive_file) == -1)
+        orage_message(190, P_N "Failed to remove old archive file %s"
+                , g_par.archive_file);
+}
+
+/* Read the partitions of years into ic_aical */
+static void archive_read(GArray *years)
+{
+#undef P_N
+#define P_N "archive_read: "
+    icalset *fical;
+    icalcomponent *ical, *c;
+    gchar *file;
+    guint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    ic_aical = icalcomponent_new(ICAL_VCALENDAR_COMPONENT);
+    for (i = 0; i < years->len; i++) {
+        file = archive_partition_file(g_par.archive_file
+                , g_array_index(years, gint, i));
+        fical = NULL;
+        ical = NULL;
+        if (g_file_test(file, G_FILE_TEST_EXISTS)
+        &&  ic_internal_file_open(&ical, &fical, file, TRUE, FALSE)) {
+            while ((c = icalcomponent_get_first_component(ical
+                            , ICAL_ANY_COMPONENT)) != 0) {
+                icalcomponent_remove_component(ical, c);
+                icalcomponent_add_component(ic_aical, c);
+            }
+            icalset_free(fical);
+        }
+        g_free(file);
+    }
+}
+
+/* Open all of the archive. Used when we need to see everything, like
+ * in search. */
+gboolean xfical_archive_open(void)
+{
+#undef P_N
+#define P_N "xfical_archive_open: "
+    GArray *years;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (!g_par.archive_limit)
+        return(FALSE);
+    if (!ORAGE_STR_EXISTS(g_par.archive_file))
+        return(FALSE);
+    if (ic_aical != NULL) /* already open */
+        return(TRUE);
+
+    archive_split_old();
+    years = archive_partitions(g_par.archive_file);
+    archive_read(years);
+    g_array_free(years, TRUE);
+    return(TRUE);
+}
+
+/* Open only the partitions, which have appointments of type starting
+ * within days from a_day (yyyymmdd) */
+gboolean xfical_archive_open_period(char *a_day, gint days, xfical_type type)
+{
+#undef P_N
+#define P_N "xfical_archive_open_period: "
+    GArray *years;
+    struct tm t;
+    gchar to[9];
+    gchar kind;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (!g_par.archive_limit)
+        return(FALSE);
+    if (!ORAGE_STR_EXISTS(g_par.archive_file))
+        return(FALSE);
+    if (ic_aical != NULL) /* already open */
+        return(TRUE);
+
+    archive_split_old();
+    t = orage_icaltime_to_tm_time(a_day, TRUE);
+    orage_move_day(&t, days);
+    g_strlcpy(to, orage_tm_time_to_icaltime(&t), sizeof(to));
+    if (type == XFICAL_TYPE_EVENT)
+        kind = 'E';
+    else if (type == XFICAL_TYPE_TODO)
+        kind = 'T';
+    else
+        kind = 'J';
+    if ((years = archive_index_years(kind, a_day, to, NULL)) == NULL)
+        years = archive_partitions(g_par.archive_file); /* no index */
+    archive_read(years);
+    g_array_free(years, TRUE);
+    return(TRUE);
+}
+
+void xfical_archive_close(void)
+{
+#undef  P_N 
+#define P_N "xfical_archive_close: "
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (ic_aical == NULL) {
+        orage_message(150, P_N "archive is not open");
+        return;
+    }
+    ic_uid_index_free(ic_aical);
+    icalcomponent_free(ic_aical);
+    ic_aical = NULL;
+}
+
+gboolean xfical_archive(void)
+{
+#undef P_N
+#define P_N "xfical_archive: "
+    icalcomponent *c, *first_kept = NULL;
     struct tm tm_threshold;
     struct tm *threshold;
-    char *uid;
+    GList *archived = NULL, *l;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
@@ -330,10 +1050,11 @@ gboolean xfical_archive(void)
         orage_message(20, _("Archiving not enabled. Exiting"));
         return(TRUE);
     }
-    if (!xfical_file_open(FALSE) || !xfical_archive_open()) {
+    if (!ORAGE_STR_EXISTS(g_par.archive_file) || !xfical_file_open(FALSE)) {
         orage_message(250, P_N "file open error");
         return(FALSE);
     }
+    archive_split_old();
     memcpy(&tm_threshold, orage_localtime(), sizeof(tm_threshold));
     threshold=&tm_threshold;
     threshold->tm_mday = 1;
@@ -352,57 +1073,39 @@ gboolean xfical_archive(void)
     orage_message(20, _("\tArchiving events, which are older than: %04d-%02d-%02d")
             , threshold->tm_year, threshold->tm_mon, threshold->tm_mday);
 
-    /* Check appointment file for items older than the threshold */
-    /* Note: remove moves the "c" pointer to next item, so we need to store it
-     *       first to process all of them or we end up skipping entries */
+    /* Check appointment file for items older than the threshold in one
+     * pass. We always take the first component, so that no iterator is
+     * left on a removed one: archived ones are collected and the others
+     * are moved to the end. We have seen all when the first kept
+     * component comes around again. */
     for (c = icalcomponent_get_first_component(ic_ical, ICAL_ANY_COMPONENT);
-         c != 0;
-         c = c2) {
-        c2 = icalcomponent_get_next_component(ic_ical, ICAL_ANY_COMPONENT);
-        /*
-        sdate = icalcomponent_get_dtstart(c);
-        edate = icalcomponent_get_dtend(c);
-        if (icaltime_is_null_time(edate)) {
-            edate = sdate;
+         c != 0 && c != first_kept;
+         c = icalcomponent_get_first_component(ic_ical, ICAL_ANY_COMPONENT)) {
+        if (archive_needed(c, threshold)) {
+            ic_uid_index_remove(ic_ical, c);
+            icalcomponent_remove_component(ic_ical, c);
+            archived = g_list_prepend(archived, c);
         }
-        */
-        per =  ic_get_period(c, TRUE);
-        uid = (char *)icalcomponent_get_uid(c);
-        /* Items with endate before threshold => archived.
-         * Recurring events are marked in the main file by adding special
-         * X-ORAGE_ORIG-DTSTART/X-ORAGE_ORIG-DTEND to save the original
-         * start/end dates. Then start_date is changed. These are NOT
-         * written in archive file (unless of course they really have ended).
-         */
-        if ((per.etime.year*12 + per.etime.month) 
-            < (threshold->tm_year*12 + threshold->tm_mon)) {
-            orage_message(20, _("Archiving uid: %s"), uid);
-            /* FIXME: check VTODO completed before archiving it */
-            if (per.ikind == ICAL_VTODO_COMPONENT 
-                && ((per.ctime.year*12 + per.ctime.month) 
-                    < (per.stime.year*12 + per.stime.month))) {
-                /* VTODO not completed, do not archive */
-                orage_message(20, _("\tVTODO not complete; not archived"));
-            }
-            else {
-                p = icalcomponent_get_first_property(c, ICAL_RRULE_PROPERTY);
-                if (p) {  /*  it is recurrent event */
-                    orage_message(20, _("\tRecurring. End year: %04d, month: %02d, day: %02d")
-                        , per.etime.year, per.etime.month, per.etime.day);
-                    xfical_icalcomponent_archive_recurrent(c, threshold, uid);
-                }
-                else 
-                    xfical_icalcomponent_archive_normal(c);
-            }
+        else {
+            icalcomponent_remove_component(ic_ical, c);
+            icalcomponent_add_component(ic_ical, c);
+            if (first_kept == NULL)
+                first_kept = c;
+        }
+    }
+
+    if ((archived = archive_store(g_list_reverse(archived))) != NULL) {
+        /* keep them in the main file, so nothing gets lost */
+        orage_message(250, P_N "archive write failed, keeping appointments");
+        for (l = g_list_first(archived); l != NULL; l = g_list_next(l)) {
+            icalcomponent_add_component(ic_ical, (icalcomponent *)l->data);
+            ic_uid_index_add(ic_ical, (icalcomponent *)l->data);
         }
+        g_list_free(archived);
     }
 
     ic_file_modified = TRUE;
-    icalset_mark(ic_afical);
-    icalset_commit(ic_afical);
-    xfical_archive_close();
-    icalset_mark(ic_fical);
-    icalset_commit(ic_fical);
+    ic_change_log_commit();
     xfical_file_close(FALSE);
     orage_message(25, _("Archiving done\n"));
     return(TRUE);
@@ -412,9 +1115,15 @@ gboolean xfical_unarchive(void)
 {
 #undef P_N
 #define P_N "xfical_unarchive: "
-    icalcomponent *c, *d;
+    icalset *fical;
+    icalcomponent *ical, *c;
     icalproperty *p;
     const char *text;
+    GArray *years;
+    GList *files = NULL, *l;
+    gchar *file;
+    gboolean ok = TRUE, replaced;
+    guint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
@@ -430,45 +1139,75 @@ gboolean xfical_unarchive(void)
     for (c = icalcomponent_get_first_component(ic_ical, ICAL_VEVENT_COMPONENT);
          c != 0;
          c = icalcomponent_get_next_component(ic_ical, ICAL_VEVENT_COMPONENT)) {
+         replaced = FALSE;
          p = icalcomponent_get_first_property(c, ICAL_X_PROPERTY);
          while (p) {
             text = icalproperty_get_x_name(p);
-            if (g_str_has_prefix(text, "X-ORAGE-ORIG-DTSTART"))
-                p = replace_repeating(c, p, ICAL_DTSTART_PROPERTY);
-            else if (g_str_has_prefix(text, "X-ORAGE-ORIG-DTEND"))
-                p = replace_repeating(c, p, ICAL_DTEND_PROPERTY);
+            if (g_str_has_prefix(text, "X-ORAGE-ORIG-DTSTART")
+            ||  g_str_has_prefix(text, "X-ORAGE-ORIG-DTEND")) {
+                if (!replaced) /* times change, index it again */
+                    ic_uid_index_remove(ic_ical, c);
+                replaced = TRUE;
+                p = replace_repeating(c, p
+                        , g_str_has_prefix(text, "X-ORAGE-ORIG-DTSTART")
+                                ? ICAL_DTSTART_PROPERTY : ICAL_DTEND_PROPERTY);
+            }
             else /* it was not our X-PROPERTY */
                 p = icalcomponent_get_next_property(c, ICAL_X_PROPERTY);
         }
+        if (replaced)
+            ic_uid_index_add(ic_ical, c);
     }
-    /* PHASE 2: go through archive file and add everything back to base orage.
-     * After that delete the whole arch file */
+    /* PHASE 2: go through archive files and add everything back to base
+     * orage. After that delete the archive files */
     orage_message(20, _("\tPHASE 2: return archived appointments"));
-    if (!xfical_archive_open()) {
+    archive_split_old();
+    if (g_file_test(g_par.archive_file, G_FILE_TEST_EXISTS)) {
         /* we have risk to delete the data permanently, let's stop here */
         orage_message(350, P_N "archive file open error");
-        /*
-        icalset_mark(ic_fical);
-        icalset_commit(ic_fical);
-        */
         xfical_file_close(FALSE);
         return(FALSE);
     }
-    for (c = icalcomponent_get_first_component(ic_aical, ICAL_ANY_COMPONENT);
-         c != 0;
-         c = icalcomponent_get_next_component(ic_aical, ICAL_ANY_COMPONENT)) {
-    /* Add to the base file */
-        d = icalcomponent_new_clone(c);
-        icalcomponent_add_component(ic_ical, d);
-    }
-    xfical_archive_close();
-    if (g_remove(g_par.archive_file) == -1) {
-        orage_message(190, P_N "Failed to remove archive file %s", g_par.archive_file);
+    years = archive_partitions(g_par.archive_file);
+    for (i = 0; i < years->len; i++) {
+        file = archive_partition_file(g_par.archive_file
+                , g_array_index(years, gint, i));
+        fical = NULL;
+        ical = NULL;
+        if (!ic_internal_file_open(&ical, &fical, file, TRUE, FALSE)) {
+            /* keep it, so that nothing gets lost */
+            orage_message(350, P_N "archive file open error %s", file);
+            g_free(file);
+            ok = FALSE;
+            continue;
+        }
+        while ((c = icalcomponent_get_first_component(ical
+                        , ICAL_ANY_COMPONENT)) != 0) {
+            icalcomponent_remove_component(ical, c);
+            icalcomponent_add_component(ic_ical, c);
+            ic_uid_index_add(ic_ical, c);
+        }
+        icalset_free(fical);
+        files = g_list_prepend(files, file);
     }
+    g_array_free(years, TRUE);
     ic_file_modified = TRUE;
-    icalset_mark(ic_fical);
-    icalset_commit(ic_fical);
+    ic_change_log_commit();
     xfical_file_close(FALSE);
+
+    /* appointments are safe in the main file now */
+    for (l = g_list_first(files); l != NULL; l = g_list_next(l)) {
+        if (g_remove((gchar *)l->data) == -1)
+            orage_message(190, P_N "Failed to remove archive file %s"
+                    , (gchar *)l->data);
+        g_free(l->data);
+    }
+    g_list_free(files);
+    if (ok) {
+        file = archive_index_file(g_par.archive_file);
+        g_remove(file);
+        g_free(file);
+    }
     orage_message(25, _("Archive removal done\n"));
     return(TRUE);
 }
@@ -477,40 +1216,121 @@ gboolean xfical_unarchive_uid(char *uid)
 {
 #undef P_N
 #define P_N "xfical_unarchive_uid: "
-    icalcomponent *c, *d;
-    gboolean key_found = FALSE;
-    const char *text;
+    icalset *fical;
+    icalcomponent *ical, *c = NULL;
     char *ical_uid;
+    GArray *years;
+    gchar *file;
+    guint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
     ical_uid = uid+4; /* skip file id (which is A00. now)*/
-    if (!xfical_file_open(FALSE) || !xfical_archive_open()) {
+    if (!ORAGE_STR_EXISTS(g_par.archive_file) || !xfical_file_open(FALSE)) {
         orage_message(250, P_N "file open error");
         return(FALSE);
     } 
-    for (c = icalcomponent_get_first_component(ic_aical, ICAL_ANY_COMPONENT);
-         c != 0 && !key_found;
-         c = icalcomponent_get_next_component(ic_aical, ICAL_ANY_COMPONENT)) {
-        text = icalcomponent_get_uid(c);
-        if (strcmp(text, ical_uid) == 0) { /* we found our uid (=event) */
-            /* Add to the base file */
-            d = icalcomponent_new_clone(c);
-            icalcomponent_add_component(ic_ical, d);
-            /* Remove from the archive file */
-            icalcomponent_remove_component(ic_aical, c);
-            key_found = TRUE;
-            ic_file_modified = TRUE;
+    archive_split_old();
+    /* the index tells the partition. Without it we need to look
+     * everywhere */
+    years = archive_index_years(0, NULL, NULL, ical_uid);
+    if (years == NULL || years->len == 0) {
+        if (years)
+            g_array_free(years, TRUE);
+        years = archive_partitions(g_par.archive_file);
+    }
+    for (i = 0; i < years->len && c == NULL; i++) {
+        file = archive_partition_file(g_par.archive_file
+                , g_array_index(years, gint, i));
+        fical = NULL;
+        ical = NULL;
+        if (g_file_test(file, G_FILE_TEST_EXISTS)
+        &&  ic_internal_file_open(&ical, &fical, file, FALSE, FALSE)) {
+            if ((c = ic_uid_index_lookup(ical, ical_uid)) != NULL) {
+                /* Move from the archive file to the base file */
+                ic_uid_index_remove(ical, c);
+                icalcomponent_remove_component(ical, c);
+                icalcomponent_add_component(ic_ical, c);
+                ic_uid_index_add(ic_ical, c);
+                ic_file_modified = TRUE;
+                icalset_mark(fical);
+                icalset_commit(fical);
+            }
+            ic_uid_index_free(ical);
+            icalset_free(fical);
         }
+        g_free(file);
     }
-    icalset_mark(ic_afical);
-    icalset_commit(ic_afical);
-    xfical_archive_close();
-    icalset_mark(ic_fical);
-    icalset_commit(ic_fical);
+    g_array_free(years, TRUE);
+    if (c != NULL)
+        archive_index_remove(ical_uid);
+    ic_change_log_commit();
     xfical_file_close(FALSE);
 
     return(TRUE);
 }
+
+/* Copy or move the whole archive to use new_file name */
+gboolean xfical_archive_copy(gchar *new_file, gboolean move)
+{
+#undef P_N
+#define P_N "xfical_archive_copy: "
+    GArray *years;
+    GList *sources = NULL, *targets = NULL, *s, *t;
+    gboolean ok = TRUE;
+    guint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    archive_split_old();
+    years = archive_partitions(g_par.archive_file);
+    for (i = 0; i < years->len; i++) {
+        sources = g_list_prepend(sources, archive_partition_file(
+                g_par.archive_file, g_array_index(years, gint, i)));
+        targets = g_list_prepend(targets, archive_partition_file(
+                new_file, g_array_index(years, gint, i)));
+    }
+    g_array_free(years, TRUE);
+    sources = g_list_prepend(sources, archive_index_file(g_par.archive_file));
+    targets = g_list_prepend(targets, archive_index_file(new_file));
+
+    for (s = sources, t = targets; s != NULL && ok; s = s->next, t = t->next) {
+        if (!g_file_test((gchar *)s->data, G_FILE_TEST_EXISTS))
+            continue;
+        if (move && g_rename((gchar *)s->data, (gchar *)t->data) == 0)
+            continue;
+        ok = orage_copy_file((gchar *)s->data, (gchar *)t->data);
+        if (ok && move) { /* this is move. so let's remove the orig */
+            if (g_remove((gchar *)s->data))
+                g_warning("file remove failed %s", (gchar *)s->data);
+        }
+    }
+    g_list_foreach(sources, (GFunc)g_free, NULL);
+    g_list_free(sources);
+    g_list_foreach(targets, (GFunc)g_free, NULL);
+    g_list_free(targets);
+    return(ok);
+}
+
+/* TRUE if file is usable as archive: either split into partitions
+ * or old style archive file */
+gboolean xfical_archive_check(gchar *file)
+{
+#undef P_N
+#define P_N "xfical_archive_check: "
+    gchar *index;
+    gboolean ok;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    index = archive_index_file(file);
+    ok = g_file_test(index, G_FILE_TEST_EXISTS)
+            || (g_file_test(file, G_FILE_TEST_EXISTS) 
+                && xfical_file_check(file));
+    g_free(index);
+    return(ok);
+}
 #endif
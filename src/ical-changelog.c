@@ -0,0 +1,343 @@
+/*      Orage - Calendar and alarm handler
+ *
+ * Copyright (c) 2005-2011 Juha Kautto  (juha at xfce.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+       Free Software Foundation
+       51 Franklin Street, 5th Floor
+       Boston, MA 02110-1301 USA
+
+ */
+
+/* Change log of the main Orage file.
+ *
+ * Writing the whole calendar after each change takes time relative to the
+ * size of the calendar. When "Use change log" parameter is set, adding,
+ * modifying and deleting appointments in the Orage file only appends a
+ * small record to a log file next to it (Orage file name + ".log"). The
+ * Orage file itself is rewritten (= log compacted) when the log grows
+ * bigger than "Change log compact size" bytes or older than
+ * "Change log compact age" seconds, and always when the whole file is
+ * written anyway, like in archiving and import.
+ *
+ * The log is replayed every time the Orage file is read, also when the
+ * change log has been disabled meanwhile.
+ *
+ * Each record is a header line "<op> <length> <uid>\n" followed by
+ * <length> bytes of the component in ical format. op is A (add),
+ * R (replace) or D (delete, length 0). Replay replaces by UID, so applying
+ * a record twice does no harm. Partial record at the end of the file
+ * (crash while writing) is dropped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_LIBICAL
+#include <libical/ical.h>
+#include <libical/icalss.h>
+#else
+#include <ical.h>
+#include <icalss.h>
+#endif
+
+#include "orage-i18n.h"
+#include "functions.h"
+#include "ical-code.h"
+#include "ical-internal.h"
+#include "parameters.h"
+
+
+/*
+#define ORAGE_DEBUG 1
+*/
+
+static guint change_log_timer_id = 0; /* compact when log gets too old */
+static guint change_log_idle_id = 0;  /* compact when log gets too big */
+
+static gchar *change_log_file(void)
+{
+    return(g_strconcat(g_par.orage_file, ".log", NULL));
+}
+
+static gboolean change_log_compact(gpointer user_data)
+{
+#undef P_N
+#define P_N "change_log_compact: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    change_log_timer_id = 0;
+    change_log_idle_id = 0;
+    xfical_change_log_compact();
+    return(FALSE); /* once only */
+}
+
+static void change_log_schedule(off_t size)
+{
+    if (size >= g_par.change_log_compact_size) {
+        if (!change_log_idle_id)
+            change_log_idle_id = g_idle_add(change_log_compact, NULL);
+    }
+    else if (!change_log_timer_id)
+        change_log_timer_id = g_timeout_add_seconds(
+                g_par.change_log_compact_age, change_log_compact, NULL);
+}
+
+static void change_log_unschedule(void)
+{
+    if (change_log_timer_id) {
+        g_source_remove(change_log_timer_id);
+        change_log_timer_id = 0;
+    }
+    if (change_log_idle_id) {
+        g_source_remove(change_log_idle_id);
+        change_log_idle_id = 0;
+    }
+}
+
+static gboolean change_log_write(int fd, const gchar *data, gsize len)
+{
+    gssize sz;
+
+    while (len > 0) {
+        if ((sz = write(fd, data, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return(FALSE);
+        }
+        data += sz;
+        len -= sz;
+    }
+    return(TRUE);
+}
+
+ /* Append one change of the Orage file into the log.
+  * op: 'A' add, 'R' replace or 'D' delete
+  * uid: internal uid (without file id)
+  * c: new component, NULL with delete
+  * returns: TRUE if change is stored, FALSE if change log is not in use.
+  *          When writing to the log fails, the whole file is written.
+  */
+gboolean ic_change_log_append(gchar op, const char *uid, icalcomponent *c)
+{
+#undef P_N
+#define P_N "ic_change_log_append: "
+    gchar *file, *rec;
+    char *text;
+    struct stat s;
+    int fd;
+    gboolean ok;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (!g_par.use_change_log)
+        return(FALSE);
+    if (!ORAGE_STR_EXISTS(uid) || strchr(uid, '\n')) {
+        orage_message(150, P_N "can not log uid (%s), writing whole file"
+                , uid ? uid : "");
+        ic_change_log_commit();
+        return(TRUE);
+    }
+    text = c ? icalcomponent_as_ical_string(c) : "";
+    rec = g_strdup_printf("%c %lu %s\n%s"
+            , op, (gulong)strlen(text), uid, text);
+    file = change_log_file();
+    if ((fd = g_open(file, O_WRONLY | O_APPEND | O_CREAT, 0600)) < 0)
+        ok = FALSE;
+    else {
+        ok = change_log_write(fd, rec, strlen(rec)) && fsync(fd) == 0
+                && fstat(fd, &s) == 0;
+        if (close(fd) < 0)
+            ok = FALSE;
+    }
+    if (ok)
+        change_log_schedule(s.st_size);
+    else {
+        orage_message(250, P_N "writing %s failed: %d (%s), writing whole file"
+                , file, errno, strerror(errno));
+        ic_change_log_commit();
+    }
+    g_free(rec);
+    g_free(file);
+    return(TRUE);
+}
+
+static void change_log_apply(gchar op, const char *uid, char *data)
+{
+#undef P_N
+#define P_N "change_log_apply: "
+    icalcomponent *c, *new_c = NULL;
+
+    if (op != 'D' && (new_c = icalparser_parse_string(data)) == NULL) {
+        orage_message(250, P_N "could not parse change of uid %s", uid);
+        return;
+    }
+    if ((c = ic_uid_index_lookup(ic_ical, uid)) != NULL) {
+        ic_uid_index_remove(ic_ical, c);
+        icalcomponent_remove_component(ic_ical, c);
+        icalcomponent_free(c);
+    }
+    if (new_c) {
+        icalcomponent_add_component(ic_ical, new_c);
+        ic_uid_index_add(ic_ical, new_c);
+    }
+}
+
+/* TRUE when the log has changes which are not yet in the Orage file */
+gboolean ic_change_log_pending(void)
+{
+    gchar *file;
+    gboolean pending;
+
+    file = change_log_file();
+    pending = g_file_test(file, G_FILE_TEST_EXISTS);
+    g_free(file);
+    return(pending);
+}
+
+/* Apply the change log to the just read Orage file. */
+void ic_change_log_replay(void)
+{
+#undef P_N
+#define P_N "ic_change_log_replay: "
+    gchar *file, *contents, *p, *end, *nl, *uid, *data, saved;
+    gsize len;
+    gulong size;
+    gint cnt = 0;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    file = change_log_file();
+    if (!g_file_test(file, G_FILE_TEST_EXISTS)
+    ||  !g_file_get_contents(file, &contents, &len, NULL)) {
+        g_free(file);
+        return;
+    }
+    for (p = contents, end = contents+len; p < end; p = data+size) {
+        if ((nl = memchr(p, '\n', end-p)) == NULL)
+            break;
+        *nl = '\0';
+        if (strchr("ARD", p[0]) == NULL || p[1] != ' ')
+            break;
+        size = strtoul(p+2, &uid, 10);
+        if (*uid++ != ' ')
+            break;
+        data = nl+1;
+        if (size > (gulong)(end-data))
+            break; /* partial record */
+        /* libical needs null terminated string */
+        saved = data[size];
+        data[size] = '\0';
+        change_log_apply(p[0], uid, data);
+        data[size] = saved;
+        cnt++;
+    }
+    if (p < end) {
+        orage_message(150, P_N "dropping broken end of change log %s", file);
+        if (truncate(file, p-contents) < 0)
+            orage_message(250, P_N "truncate of %s failed: %d (%s)"
+                    , file, errno, strerror(errno));
+    }
+    orage_message(10, P_N "%d changes read from %s", cnt, file);
+    g_free(contents);
+    g_free(file);
+
+    if (!g_par.use_change_log) /* old log, we do not use it anymore */
+        ic_change_log_commit();
+    else if (cnt)
+        change_log_schedule(len);
+}
+
+/* Write the whole Orage file from memory and empty the change log.
+ * Orage file must be open. */
+void ic_change_log_commit(void)
+{
+#undef P_N
+#define P_N "ic_change_log_commit: "
+    gchar *file;
+    struct stat s;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (ic_fical == NULL) {
+        orage_message(250, P_N "Orage file is not open");
+        return;
+    }
+    icalset_mark(ic_fical);
+    if (icalset_commit(ic_fical) != ICAL_NO_ERROR) {
+        /* keep the log, it still has the changes */
+        orage_message(250, P_N "writing %s failed. %s"
+                , g_par.orage_file, icalerror_strerror(icalerrno));
+        return;
+    }
+    file = change_log_file();
+    if (g_unlink(file) < 0 && errno != ENOENT)
+        orage_message(250, P_N "removing %s failed: %d (%s)"
+                , file, errno, strerror(errno));
+    g_free(file);
+    change_log_unschedule();
+    /* we wrote it ourselves, so it is not an external update */
+    if (g_stat(g_par.orage_file, &s) == 0)
+        g_par.latest_file_change = s.st_mtime;
+    ic_snapshot_schedule();
+}
+
+/* Fold the change log into the Orage file. Used by the compact timers and
+ * before the Orage file is copied or moved. */
+void xfical_change_log_compact(void)
+{
+#undef P_N
+#define P_N "xfical_change_log_compact: "
+    gchar *file;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    file = change_log_file();
+    if (g_file_test(file, G_FILE_TEST_EXISTS) && xfical_file_open(FALSE)) {
+        ic_change_log_commit();
+        xfical_file_close(FALSE);
+    }
+    g_free(file);
+}
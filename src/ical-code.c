@@ -73,7 +73,12 @@
 #include "parameters.h"
 #include "interface.h"
 
-static void xfical_alarm_build_list_internal(gboolean first_list_today);
+static void xfical_alarm_build_list_uid(char *ext_uid, icalcomponent *base);
+static void mark_cache_add(icalcomponent *base, icalcomponent *c);
+static void mark_cache_remove(icalcomponent *c);
+static void mark_cache_add_file(icalcomponent *base);
+static void mark_cache_remove_file(icalcomponent *base);
+static void mark_cache_free(void);
 
 /*
 #define ORAGE_DEBUG 1
@@ -98,13 +103,6 @@ typedef struct _xfical_timezone_array
 } xfical_timezone_array;
 
 
-static guint    file_close_timer = 0;  /* delayed file close timer */
-
-typedef struct _excluded_time
-{
-    struct icaltimetype e_time;
-} excluded_time;
-
 /* timezone handling */
 static icaltimezone *utc_icaltimezone = NULL;
 static icaltimezone *local_icaltimezone = NULL;
@@ -194,6 +192,7 @@ gboolean xfical_set_local_timezone(gboolean testing)
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
+    mark_cache_free(); /* marked days depend on the local timezone */
     local_icaltimezone = NULL;
     g_par.local_timezone_utc = FALSE;
     if (!utc_icaltimezone)
@@ -266,27 +265,158 @@ static void xfical_add_timezone(icalcomponent *p_ical, icalset *p_fical
 }
 */
 
-gboolean ic_internal_file_open(icalcomponent **p_ical
-        , icalset **p_fical, gchar *file_icalpath, gboolean read_only
-        , gboolean test)
+/* Bundled libical can keep a binary snapshot of each parsed calendar
+ * file in the cache directory. Files which have not changed since the
+ * snapshot was written are loaded from it instead of parsing them. The
+ * snapshot is written from an idle callback after the file has been read
+ * or written (ic_snapshot_schedule). */
+static gchar *file_snapshot_location(gchar *file_icalpath)
+{
+#ifndef HAVE_LIBICAL
+    gchar *name, *location;
+
+    if (!g_par.use_snapshot)
+        return(NULL);
+    name = g_strdup_printf(ORAGE_DIR "snapshot-%08x"
+            , g_str_hash(file_icalpath));
+    location = orage_cache_file_location(name);
+    g_free(name);
+    return(location);
+#else
+    return(NULL);
+#endif
+}
+
+/* snapshot may be NULL. Also called from worker threads, so no glib or
+ * gtk calls here. */
+static icalset *file_set_new(gchar *file_icalpath, gboolean read_only
+        , gchar *snapshot)
+{
+#ifndef HAVE_LIBICAL
+    icalfileset_options options = icalfileset_options_default;
+
+    if (read_only)
+        options.flags = O_RDONLY;
+    options.snapshot = snapshot;
+    return(icalset_new(ICAL_FILE_SET, file_icalpath, &options));
+#else
+    if (read_only)
+        return(icalset_new_file_reader(file_icalpath));
+    else 
+        return(icalset_new_file(file_icalpath));
+#endif
+}
+
+static guint snapshot_idle_id = 0;
+
+static gboolean snapshot_write(gpointer user_data)
 {
 #undef P_N
-#define P_N "ic_internal_file_open: "
+#define P_N "snapshot_write: "
+#ifndef HAVE_LIBICAL
+    gint i;
+#endif
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    snapshot_idle_id = 0;
+#ifndef HAVE_LIBICAL
+    /* does nothing when the snapshot is current already. The Orage file
+     * may also contain changes from the change log, which is fine: 
+     * replaying the log again on top of them gives the same result. */
+    if (ic_fical != NULL)
+        icalfileset_write_snapshot(ic_fical);
+    for (i = 0; i < g_par.foreign_count; i++)
+        if (ic_f_ical[i].fical != NULL)
+            icalfileset_write_snapshot(ic_f_ical[i].fical);
+#endif
+    return(FALSE); /* once only */
+}
+
+/* Write snapshots of the loaded files when there is nothing else to do.
+ * Files which are released right away (file close delay 0) do not get
+ * snapshots. */
+void ic_snapshot_schedule(void)
+{
+    if (g_par.use_snapshot && !snapshot_idle_id)
+        snapshot_idle_id = g_idle_add_full(G_PRIORITY_LOW, snapshot_write
+                , NULL, NULL);
+}
+
+/* file is open, let's find last VCALENDAR entry */
+static gboolean file_find_calendar(icalcomponent **p_ical
+        , icalset **p_fical, gchar *file_icalpath, gboolean test)
+{
+#undef P_N
+#define P_N "file_find_calendar: "
     icalcomponent *iter;
     gint cnt=0;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    if (file_close_timer) { 
-        /* We are opening main ical file and delayed close is in progress. 
-         * Closing must be cancelled since we are now opening the file. */
-        g_source_remove(file_close_timer);
-        file_close_timer = 0;
+    for (iter = icalset_get_first_component(*p_fical); 
+         iter != 0;
+         iter = icalset_get_next_component(*p_fical)) {
+        cnt++;
+        *p_ical = iter; /* last valid component */
+    }
+    if (cnt == 0) {
+        if (test) { /* failed */
+            orage_message(150, P_N "no top level (VCALENDAR) component in calendar file %s", file_icalpath);
+            return(FALSE);
+        }
+    /* calendar missing, need to add one.  
+     * Note: According to standard rfc2445 calendar always needs to
+     *       contain at least one other component. So strictly speaking
+     *       this is not valid entry before adding an event or timezone
+     */
+        *p_ical = icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT
+               , icalproperty_new_version("2.0")
+               , icalproperty_new_prodid("-//Xfce//Orage//EN")
+               , NULL);
+        /*
+        xfical_add_timezone(*p_ical, *p_fical, g_par.local_timezone);
+        */
+        icalset_add_component(*p_fical, *p_ical);
+        /*
+        icalset_add_component(*p_fical
+               , icalcomponent_new_clone(*p_ical));
+
+        *p_ical = icalset_get_first_component(*p_fical);
+        */
+        icalset_commit(*p_fical);
+    }
+    else { /* VCALENDAR found */
+        if (cnt > 1) {
+            orage_message(150, P_N "too many top level components in calendar file %s", file_icalpath);
+            if (test) { /* failed */
+                return(FALSE);
+            }
+        }
+        if (test 
+        && icalcomponent_isa(*p_ical) != ICAL_VCALENDAR_COMPONENT) {
+            orage_message(250, P_N "top level component is not VCALENDAR %s", file_icalpath);
+            return(FALSE);
+        }
+    }
+
+    ic_file_modified = FALSE;
+    return(TRUE);
+}
+
+gboolean ic_internal_file_open(icalcomponent **p_ical
+        , icalset **p_fical, gchar *file_icalpath, gboolean read_only
+        , gboolean test)
+{
+#undef P_N
+#define P_N "ic_internal_file_open: "
+    gchar *snapshot;
+
 #ifdef ORAGE_DEBUG
-        orage_message(-10, P_N "canceling delayed close");
+    orage_message(-200, P_N);
 #endif
-    }
     if (*p_fical != NULL) {
 #ifdef ORAGE_DEBUG
         orage_message(-50, P_N "file already open");
@@ -300,10 +430,10 @@ gboolean ic_internal_file_open(icalcomponent **p_ical
             orage_message(350, P_N "file empty");
         return(FALSE);
     }
-    if (read_only)
-        *p_fical = icalset_new_file_reader(file_icalpath);
-    else 
-        *p_fical = icalset_new_file(file_icalpath);
+    /* files only checked are not worth a snapshot */
+    snapshot = test ? NULL : file_snapshot_location(file_icalpath);
+    *p_fical = file_set_new(file_icalpath, read_only, snapshot);
+    g_free(snapshot);
     if (*p_fical == NULL) {
         if (test)
             orage_message(150, P_N "Could not open ical file (%s) %s"
@@ -313,65 +443,694 @@ gboolean ic_internal_file_open(icalcomponent **p_ical
                     , file_icalpath, icalerror_strerror(icalerrno));
         return(FALSE);
     }
-    else { /* file open, let's find last VCALENDAR entry */
-        for (iter = icalset_get_first_component(*p_fical); 
-             iter != 0;
-             iter = icalset_get_next_component(*p_fical)) {
-            cnt++;
-            *p_ical = iter; /* last valid component */
+    return(file_find_calendar(p_ical, p_fical, file_icalpath, test));
+}
+
+/* Occurrence index: for each loaded calendar we keep the occurrences of
+ * its events, todos and journals which fall into a window of
+ * OCC_INDEX_MONTHS months around the last queried date. The occurrences
+ * are sorted by start time and every entry also knows the latest end time
+ * in its part of the implicit binary tree over the array, so that a range
+ * query only visits entries which can overlap the range (interval tree).
+ * Changed components are expanded again one by one through
+ * ic_uid_index_add and ic_uid_index_remove: removed entries are only
+ * marked dead (c == NULL) and new ones go to a short unsorted pending
+ * array, which queries scan as is. When there are enough of either, they
+ * are merged into the sorted array in one linear pass, so single changes
+ * never sort the whole index. */
+#define OCC_INDEX_MONTHS 3
+#define OCC_PENDING_MAX 64
+
+typedef struct _occ_entry
+{
+    icaltime_span span;
+    icalcomponent *c;
+    time_t max_end;        /* biggest span.end in this subtree */
+} occ_entry;
+
+typedef struct _occ_index
+{
+    struct icaltimetype win_start, win_end;
+    icaltime_span window;
+    GArray *occ;           /* occ_entry sorted by span.start */
+    gboolean dirty;        /* occ needs sorting and max_end update */
+    GArray *pending;       /* occ_entry added after occ was sorted */
+    guint dead;            /* removed entries (c == NULL) in occ */
+    GList *unindexed;      /* components starting before 1970, BUG 9507 */
+} occ_index;
+
+static GHashTable *occ_indexes = NULL; /* base -> occ_index */
+
+static void occ_index_destroy(occ_index *oi)
+{
+    g_array_free(oi->occ, TRUE);
+    g_array_free(oi->pending, TRUE);
+    g_list_free(oi->unindexed);
+    g_free(oi);
+}
+
+static void occ_collect(icalcomponent *c, struct icaltime_span *span
+        , void *data)
+{
+    occ_entry e;
+
+    e.span = *span;
+    e.c = c;
+    e.max_end = span->end;
+    g_array_append_val((GArray *)data, e);
+}
+
+/* add occurrences of c into occ */
+static void occ_index_expand(occ_index *oi, icalcomponent *c, GArray *occ)
+{
+#undef P_N
+#define P_N "occ_index_expand: "
+    icalcomponent_kind kind;
+    icalproperty *p;
+
+    kind = icalcomponent_isa(c);
+    if (kind != ICAL_VEVENT_COMPONENT && kind != ICAL_VTODO_COMPONENT
+    &&  kind != ICAL_VJOURNAL_COMPONENT)
+        return;
+    p = icalcomponent_get_first_property(c, ICAL_DTSTART_PROPERTY);
+    if (p == NULL)
+        return;
+    if (icalproperty_get_dtstart(p).year < 1970) {
+        /* these need the temporary clone hack every time */
+        oi->unindexed = g_list_prepend(oi->unindexed, c);
+        return;
+    }
+    icalcomponent_foreach_recurrence(c, oi->win_start, oi->win_end
+            , occ_collect, (void *)occ);
+}
+
+static gint occ_order(gconstpointer a, gconstpointer b)
+{
+    time_t sa = ((occ_entry *)a)->span.start, sb = ((occ_entry *)b)->span.start;
+
+    return(sa < sb ? -1 : (sa > sb ? 1 : 0));
+}
+
+static time_t occ_tree_fill(occ_entry *e, guint lo, guint hi)
+{
+    guint mid;
+    time_t m, sub;
+
+    if (lo >= hi)
+        return((time_t)0);
+    mid = lo + (hi - lo) / 2;
+    m = e[mid].span.end;
+    if ((sub = occ_tree_fill(e, lo, mid)) > m)
+        m = sub;
+    if ((sub = occ_tree_fill(e, mid + 1, hi)) > m)
+        m = sub;
+    e[mid].max_end = m;
+    return(m);
+}
+
+/* (Re)build the whole index so that the window is centered on day */
+static void occ_index_build(occ_index *oi, icalcomponent *base
+        , struct icaltimetype day)
+{
+#undef P_N
+#define P_N "occ_index_build: "
+    icalcompiter ci;
+    icalcomponent *c;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    g_array_set_size(oi->occ, 0);
+    g_array_set_size(oi->pending, 0);
+    oi->dead = 0;
+    g_list_free(oi->unindexed);
+    oi->unindexed = NULL;
+
+    oi->win_start = icaltime_null_time();
+    oi->win_start.year = day.year;
+    oi->win_start.month = day.month - OCC_INDEX_MONTHS;
+    oi->win_start.day = 1;
+    oi->win_start.is_date = 1;
+    icaltime_adjust(&oi->win_start, 0, 0, 0, 0); /* normalize month */
+    oi->win_end = oi->win_start;
+    oi->win_end.month += 2*OCC_INDEX_MONTHS + 1;
+    icaltime_adjust(&oi->win_end, 0, 0, 0, 0);
+    oi->window.start = icaltime_as_timet_with_zone(oi->win_start
+            , utc_icaltimezone);
+    oi->window.end = icaltime_as_timet_with_zone(oi->win_end
+            , utc_icaltimezone);
+
+    for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+         (c = icalcompiter_deref(&ci)) != 0;
+         icalcompiter_next(&ci)) {
+        occ_index_expand(oi, c, oi->occ);
+    }
+    oi->dirty = TRUE;
+}
+
+/* Merge pending entries into occ and drop the dead ones. Only the few
+ * pending entries are sorted, the rest is one linear merge. */
+static void occ_index_merge(occ_index *oi)
+{
+#undef P_N
+#define P_N "occ_index_merge: "
+    GArray *merged;
+    occ_entry *e, *p;
+    guint i = 0, j = 0;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    g_array_sort(oi->pending, occ_order);
+    merged = g_array_sized_new(FALSE, FALSE, sizeof(occ_entry)
+            , oi->occ->len - oi->dead + oi->pending->len);
+    e = (occ_entry *)oi->occ->data;
+    p = (occ_entry *)oi->pending->data;
+    while (i < oi->occ->len || j < oi->pending->len) {
+        if (i < oi->occ->len && e[i].c == NULL)
+            i++;
+        else if (j >= oi->pending->len
+             || (i < oi->occ->len && occ_order(&e[i], &p[j]) <= 0))
+            g_array_append_val(merged, e[i++]);
+        else
+            g_array_append_val(merged, p[j++]);
+    }
+    g_array_free(oi->occ, TRUE);
+    oi->occ = merged;
+    g_array_set_size(oi->pending, 0);
+    oi->dead = 0;
+    occ_tree_fill((occ_entry *)oi->occ->data, 0, oi->occ->len);
+}
+
+static void occ_tree_query(occ_entry *e, guint lo, guint hi
+        , icaltime_span *range, icalcomponent_kind kind
+        , void (*callback)(icalcomponent *c, struct icaltime_span *span
+                , void *data)
+        , void *data)
+{
+    guint mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (e[mid].max_end < range->start)
+            return; /* nothing here ends late enough */
+        occ_tree_query(e, lo, mid, range, kind, callback, data);
+        if (e[mid].span.start > range->end)
+            return; /* the rest starts too late */
+        if (e[mid].c != NULL /* not removed */
+        &&  icalcomponent_isa(e[mid].c) == kind
+        &&  icaltime_span_overlaps(&e[mid].span, range))
+            (*callback)(e[mid].c, &e[mid].span, data);
+        lo = mid + 1;
+    }
+}
+
+/* Call callback like icalcomponent_foreach_recurrence would for each
+ * occurrence of each kind component of base between start and end.
+ * Components, which can not be indexed, are returned in unindexed.
+ * Returns FALSE if the range is too long for the index. */
+static gboolean occ_index_foreach(icalcomponent *base
+        , icalcomponent_kind kind
+        , struct icaltimetype start, struct icaltimetype end
+        , void (*callback)(icalcomponent *c, struct icaltime_span *span
+                , void *data)
+        , void *data, GList **unindexed)
+{
+#undef P_N
+#define P_N "occ_index_foreach: "
+    occ_index *oi;
+    icaltime_span range;
+    occ_entry *e;
+    guint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    range.start = icaltime_as_timet_with_zone(start, utc_icaltimezone);
+    range.end = icaltime_as_timet_with_zone(end, utc_icaltimezone);
+    if (range.end - range.start > OCC_INDEX_MONTHS*28*24*60*60)
+        return(FALSE);
+
+    if (occ_indexes == NULL)
+        occ_indexes = g_hash_table_new_full(g_direct_hash, g_direct_equal
+                , NULL, (GDestroyNotify)occ_index_destroy);
+    if ((oi = g_hash_table_lookup(occ_indexes, base)) == NULL) {
+        oi = g_new0(occ_index, 1);
+        oi->occ = g_array_new(FALSE, FALSE, sizeof(occ_entry));
+        oi->pending = g_array_new(FALSE, FALSE, sizeof(occ_entry));
+        occ_index_build(oi, base, start);
+        g_hash_table_insert(occ_indexes, base, oi);
+    }
+    else if (range.start <= oi->window.start || range.end >= oi->window.end)
+        occ_index_build(oi, base, start); /* roll the window */
+
+    if (oi->dirty) {
+        g_array_sort(oi->occ, occ_order);
+        occ_tree_fill((occ_entry *)oi->occ->data, 0, oi->occ->len);
+        oi->dirty = FALSE;
+    }
+    else if (oi->pending->len > OCC_PENDING_MAX
+         ||  oi->dead > oi->occ->len / 4)
+        occ_index_merge(oi);
+    occ_tree_query((occ_entry *)oi->occ->data, 0, oi->occ->len
+            , &range, kind, callback, data);
+    e = (occ_entry *)oi->pending->data;
+    for (i = 0; i < oi->pending->len; i++) {
+        if (icalcomponent_isa(e[i].c) == kind
+        &&  icaltime_span_overlaps(&e[i].span, &range))
+            (*callback)(e[i].c, &e[i].span, data);
+    }
+    *unindexed = oi->unindexed;
+    return(TRUE);
+}
+
+static void occ_index_add(icalcomponent *base, icalcomponent *c)
+{
+    occ_index *oi;
+
+    if (occ_indexes && (oi = g_hash_table_lookup(occ_indexes, base)))
+        occ_index_expand(oi, c, oi->dirty ? oi->occ : oi->pending);
+}
+
+static void occ_index_remove(icalcomponent *base, icalcomponent *c)
+{
+    occ_index *oi;
+    occ_entry *e;
+    guint i, j;
+
+    if (occ_indexes == NULL 
+    || (oi = g_hash_table_lookup(occ_indexes, base)) == NULL)
+        return;
+    /* sorted entries are only marked dead to keep the order and the tree,
+     * occ_index_merge drops them later */
+    e = (occ_entry *)oi->occ->data;
+    for (i = 0; i < oi->occ->len; i++) {
+        if (e[i].c == c) {
+            e[i].c = NULL;
+            oi->dead++;
         }
-        if (cnt == 0) {
-            if (test) { /* failed */
-                orage_message(150, P_N "no top level (VCALENDAR) component in calendar file %s", file_icalpath);
-                return(FALSE);
-            }
-        /* calendar missing, need to add one.  
-         * Note: According to standard rfc2445 calendar always needs to
-         *       contain at least one other component. So strictly speaking
-         *       this is not valid entry before adding an event or timezone
-         */
-            *p_ical = icalcomponent_vanew(ICAL_VCALENDAR_COMPONENT
-                   , icalproperty_new_version("2.0")
-                   , icalproperty_new_prodid("-//Xfce//Orage//EN")
-                   , NULL);
-            /*
-            xfical_add_timezone(*p_ical, *p_fical, g_par.local_timezone);
-            */
-            icalset_add_component(*p_fical, *p_ical);
-            /*
-            icalset_add_component(*p_fical
-                   , icalcomponent_new_clone(*p_ical));
+    }
+    e = (occ_entry *)oi->pending->data;
+    for (i = j = 0; i < oi->pending->len; i++) {
+        if (e[i].c != c)
+            e[j++] = e[i];
+    }
+    g_array_set_size(oi->pending, j);
+    oi->unindexed = g_list_remove(oi->unindexed, c);
+}
 
-            *p_ical = icalset_get_first_component(*p_fical);
-            */
-            icalset_commit(*p_fical);
+/* UID index: for each loaded calendar (VCALENDAR component) we keep
+ * a hash table uid -> icalcomponent so that appointments can be found
+ * without scanning the whole file. It is built on first lookup and kept
+ * up to date with ic_uid_index_add and ic_uid_index_remove, which also
+ * keep the occurrence index above current.
+ * A recurring event with RECURRENCE-ID overrides has several components
+ * with the same uid. Only one of them is indexed, the main appointment
+ * if there is one, and the uid is remembered in dups, so that the others
+ * can be found again when the indexed one is removed. */
+typedef struct _uid_index
+{
+    GHashTable *comps;     /* uid -> first icalcomponent with it */
+    GHashTable *dups;      /* uids, which more than one component has */
+} uid_index;
+
+static GHashTable *uid_indexes = NULL; /* base -> uid_index */
+
+static void uid_index_destroy(uid_index *ui)
+{
+    g_hash_table_destroy(ui->comps);
+    g_hash_table_destroy(ui->dups);
+    g_free(ui);
+}
+
+static gboolean uid_index_is_override(icalcomponent *c)
+{
+    return(icalcomponent_get_first_property(c, ICAL_RECURRENCEID_PROPERTY)
+            != NULL);
+}
+
+static void uid_index_insert(uid_index *ui, icalcomponent *c)
+{
+    const char *uid;
+
+    icalcomponent *old;
+
+    uid = icalcomponent_get_uid(c);
+    if (!ORAGE_STR_EXISTS(uid))
+        return;
+    /* first one wins like in the linear scan, except that the main
+     * appointment wins over its RECURRENCE-ID overrides */
+    if ((old = g_hash_table_lookup(ui->comps, uid)) == NULL)
+        g_hash_table_insert(ui->comps, g_strdup(uid), c);
+    else if (old != c) {
+        g_hash_table_insert(ui->dups, g_strdup(uid), GINT_TO_POINTER(1));
+        if (uid_index_is_override(old) && !uid_index_is_override(c))
+            g_hash_table_insert(ui->comps, g_strdup(uid), c);
+    }
+}
+
+static uid_index *uid_index_get(icalcomponent *base, gboolean build)
+{
+#undef P_N
+#define P_N "uid_index_get: "
+    uid_index *ui;
+    icalcompiter ci;
+    icalcomponent *c;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (uid_indexes == NULL) {
+        if (!build)
+            return(NULL);
+        uid_indexes = g_hash_table_new_full(g_direct_hash, g_direct_equal
+                , NULL, (GDestroyNotify)uid_index_destroy);
+    }
+    ui = g_hash_table_lookup(uid_indexes, base);
+    if (ui == NULL && build) {
+        ui = g_new(uid_index, 1);
+        ui->comps = g_hash_table_new_full(g_str_hash, g_str_equal
+                , g_free, NULL);
+        ui->dups = g_hash_table_new_full(g_str_hash, g_str_equal
+                , g_free, NULL);
+        /* external iterator so that we do not disturb callers, which
+         * may be in the middle of walking the same calendar */
+        for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+             (c = icalcompiter_deref(&ci)) != 0;
+             icalcompiter_next(&ci)) {
+            uid_index_insert(ui, c);
         }
-        else { /* VCALENDAR found */
-            if (cnt > 1) {
-                orage_message(150, P_N "too many top level components in calendar file %s", file_icalpath);
-                if (test) { /* failed */
-                    return(FALSE);
-                }
+        g_hash_table_insert(uid_indexes, base, ui);
+    }
+    return(ui);
+}
+
+/* The indexed component of a duplicate uid is going away: find the next
+ * one with the same uid, skipping the removed one, which may still be in
+ * base. */
+static void uid_index_rescan(uid_index *ui, icalcomponent *base
+        , icalcomponent *removed, const char *uid)
+{
+#undef P_N
+#define P_N "uid_index_rescan: "
+    icalcompiter ci;
+    icalcomponent *c, *first = NULL;
+    const char *c_uid;
+    gint found = 0;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+         (c = icalcompiter_deref(&ci)) != 0;
+         icalcompiter_next(&ci)) {
+        if (c == removed)
+            continue;
+        c_uid = icalcomponent_get_uid(c);
+        if (ORAGE_STR_EXISTS(c_uid) && strcmp(c_uid, uid) == 0) {
+            if (first == NULL
+            || (uid_index_is_override(first) && !uid_index_is_override(c)))
+                first = c;
+            found++;
+        }
+    }
+    if (first != NULL)
+        g_hash_table_insert(ui->comps, g_strdup(uid), first);
+    if (found < 2)
+        g_hash_table_remove(ui->dups, uid);
+}
+
+icalcomponent *ic_uid_index_lookup(icalcomponent *base, const char *uid)
+{
+#undef P_N
+#define P_N "ic_uid_index_lookup: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (base == NULL || !ORAGE_STR_EXISTS(uid))
+        return(NULL);
+    return((icalcomponent *)g_hash_table_lookup(
+            uid_index_get(base, TRUE)->comps, uid));
+}
+
+/* All components of base with uid in file order: the main appointment
+ * and its RECURRENCE-ID overrides. Only uids with duplicates need a scan.
+ * Free the list with g_list_free. */
+static GList *uid_index_lookup_all(icalcomponent *base, const char *uid)
+{
+#undef P_N
+#define P_N "uid_index_lookup_all: "
+    icalcompiter ci;
+    icalcomponent *c;
+    const char *c_uid;
+    GList *comps = NULL;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if ((c = ic_uid_index_lookup(base, uid)) == NULL)
+        return(NULL);
+    if (!g_hash_table_lookup(uid_index_get(base, FALSE)->dups, uid))
+        return(g_list_prepend(NULL, c));
+    for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+         (c = icalcompiter_deref(&ci)) != 0;
+         icalcompiter_next(&ci)) {
+        c_uid = icalcomponent_get_uid(c);
+        if (ORAGE_STR_EXISTS(c_uid) && strcmp(c_uid, uid) == 0)
+            comps = g_list_prepend(comps, c);
+    }
+    return(g_list_reverse(comps));
+}
+
+void ic_uid_index_add(icalcomponent *base, icalcomponent *c)
+{
+#undef P_N
+#define P_N "ic_uid_index_add: "
+    uid_index *ui;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    occ_index_add(base, c);
+    mark_cache_add(base, c);
+    ic_search_index_add(base, c);
+    if ((ui = uid_index_get(base, FALSE)) == NULL)
+        return; /* not built yet, it will be done when needed */
+    uid_index_insert(ui, c);
+}
+
+void ic_uid_index_remove(icalcomponent *base, icalcomponent *c)
+{
+#undef P_N
+#define P_N "ic_uid_index_remove: "
+    uid_index *ui;
+    const char *uid;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    occ_index_remove(base, c);
+    mark_cache_remove(c);
+    ic_search_index_remove(base, c);
+    if ((ui = uid_index_get(base, FALSE)) == NULL)
+        return;
+    uid = icalcomponent_get_uid(c);
+    if (!ORAGE_STR_EXISTS(uid) || g_hash_table_lookup(ui->comps, uid) != c)
+        return;
+    g_hash_table_remove(ui->comps, uid);
+    if (g_hash_table_lookup(ui->dups, uid))
+        uid_index_rescan(ui, base, c, uid);
+}
+
+/* must be called before base is freed */
+void ic_uid_index_free(icalcomponent *base)
+{
+#undef P_N
+#define P_N "ic_uid_index_free: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (uid_indexes != NULL && base != NULL)
+        g_hash_table_remove(uid_indexes, base);
+    if (occ_indexes != NULL && base != NULL)
+        g_hash_table_remove(occ_indexes, base);
+    ic_search_index_free(base);
+}
+
+static void file_store_change_time(gchar *file_name, time_t *file_change)
+{
+#undef P_N
+#define P_N "file_store_change_time: "
+    struct stat s;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (g_stat(file_name, &s) < 0) {
+        orage_message(150, P_N "stat of %s failed: %d (%s)",
+                file_name, errno, strerror(errno));
+        *file_change = (time_t)0;
+    }
+    else {
+        *file_change = s.st_mtime;
+    }
+}
+
+/* Foreign files which are not in memory yet are read in parallel, one
+ * worker thread per file, so that startup and reload after external changes
+ * take as long as the slowest file instead of the sum of all files.
+ * Workers only run libical (open and parse); the results are taken into use
+ * in the main thread as soon as each file is ready. libical keeps its
+ * temporary buffers and error number per thread only when built with
+ * pthread support. */
+#if defined(HAVE_LIBICAL) || defined(HAVE_PTHREAD)
+#define FOREIGN_LOAD_THREADS 1
+#endif
+
+typedef struct _foreign_load
+{
+    gint i;              /* index to ic_f_ical and g_par.foreign_data */
+    gchar *file;
+    gboolean read_only;
+    gchar *snapshot;
+    icalset *fical;      /* result from the worker */
+    icalerrorenum error; /* icalerrno of the worker */
+    gboolean ok;         /* final result after main thread checks */
+} foreign_load;
+
+#ifdef FOREIGN_LOAD_THREADS
+static void foreign_load_thread(gpointer data, gpointer user_data)
+{
+    foreign_load *fl = (foreign_load *)data;
+
+    /* only reading the file here: no gtk calls and no access to the
+     * shared ical state (ic_* globals, indexes, caches), main thread does
+     * all the rest. The queue is thread safe. */
+    fl->fical = file_set_new(fl->file, fl->read_only, fl->snapshot);
+    fl->error = icalerrno;
+    g_async_queue_push((GAsyncQueue *)user_data, fl);
+}
+#endif
+
+/* store the result of one foreign file open into ic_f_ical */
+static void foreign_file_opened(gint i, gboolean ok, gboolean loaded)
+{
+    if (!ok) {
+        ic_f_ical[i].ical = NULL;
+        ic_f_ical[i].fical = NULL;
+        g_par.foreign_data[i].latest_file_change = (time_t)0;
+    }
+    else if (!loaded) {
+        /* store last access time */
+        file_store_change_time(g_par.foreign_data[i].file
+                , &g_par.foreign_data[i].latest_file_change);
+        mark_cache_add_file(ic_f_ical[i].ical);
+        ic_snapshot_schedule();
+    }
+}
+
+/* returns the result of the last foreign file like the sequential 
+ * version always did */
+static gboolean foreign_files_open(void)
+{
+#undef P_N
+#define P_N "foreign_files_open: "
+    foreign_load *load[10], *fl;
+    gboolean ok = TRUE, loaded;
+    gint i;
+#ifdef FOREIGN_LOAD_THREADS
+    GThreadPool *pool = NULL;
+    GAsyncQueue *done = NULL;
+    icalerrorstate es;
+    gint cnt = 0;
+#endif
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    for (i = 0; i < 10; i++)
+        load[i] = NULL;
+#ifdef FOREIGN_LOAD_THREADS
+    for (i = 0; i < g_par.foreign_count; i++)
+        if (ic_f_ical[i].fical == NULL 
+        && ORAGE_STR_EXISTS(g_par.foreign_data[i].file))
+            cnt++;
+    if (cnt > 1 && g_thread_supported()) {
+        done = g_async_queue_new();
+        pool = g_thread_pool_new(foreign_load_thread, done, cnt, FALSE, NULL);
+    }
+    if (pool) {
+        /* parser changes this global error state temporarily. Set it
+         * here already so that parallel parsers do not mix it up */
+        es = icalerror_get_error_state(ICAL_MALFORMEDDATA_ERROR);
+        icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR
+                , ICAL_ERROR_NONFATAL);
+        cnt = 0;
+        for (i = 0; i < g_par.foreign_count; i++) {
+            if (ic_f_ical[i].fical != NULL 
+            || !ORAGE_STR_EXISTS(g_par.foreign_data[i].file))
+                continue;
+            fl = g_new0(foreign_load, 1);
+            fl->i = i;
+            fl->file = g_strdup(g_par.foreign_data[i].file);
+            fl->read_only = g_par.foreign_data[i].read_only;
+            fl->snapshot = file_snapshot_location(fl->file);
+            load[i] = fl;
+            g_thread_pool_push(pool, fl, NULL);
+            cnt++;
+        }
+        for (; cnt > 0; cnt--) {
+            fl = (foreign_load *)g_async_queue_pop(done);
+            i = fl->i;
+            if (fl->fical == NULL) {
+                orage_message(250, P_N "Could not open ical file (%s) %s"
+                        , fl->file, icalerror_strerror(fl->error));
+                ok = FALSE;
             }
-            if (test 
-            && icalcomponent_isa(*p_ical) != ICAL_VCALENDAR_COMPONENT) {
-                orage_message(250, P_N "top level component is not VCALENDAR %s", file_icalpath);
-                return(FALSE);
+            else {
+                ic_f_ical[i].fical = fl->fical;
+                ok = file_find_calendar(&(ic_f_ical[i].ical)
+                        , &(ic_f_ical[i].fical), fl->file, FALSE);
             }
+            foreign_file_opened(i, ok, FALSE);
+            fl->ok = ok;
         }
+        g_thread_pool_free(pool, FALSE, TRUE);
+        icalerror_set_error_state(ICAL_MALFORMEDDATA_ERROR, es);
     }
+    if (done)
+        g_async_queue_unref(done);
+#endif
 
-    ic_file_modified = FALSE;
-    return(TRUE);
+    for (i = 0; i < g_par.foreign_count; i++) {
+        if ((fl = load[i]) != NULL) { /* already read in parallel */
+            ok = fl->ok;
+            g_free(fl->file);
+            g_free(fl->snapshot);
+            g_free(fl);
+            continue;
+        }
+        loaded = (ic_f_ical[i].fical != NULL);
+        ok = ic_internal_file_open(&(ic_f_ical[i].ical)
+                , &(ic_f_ical[i].fical), g_par.foreign_data[i].file
+                , g_par.foreign_data[i].read_only , FALSE);
+        foreign_file_opened(i, ok, loaded);
+    }
+    return(ok);
 }
 
+/* Calendar files are kept in memory after they have been read once.
+ * Opening a file which is already loaded is cheap and only checks that
+ * the file has not been changed outside of Orage. Real reload only happens
+ * when orage_external_update_check finds a change and reloads the changed
+ * file with xfical_file_reload. */
 gboolean xfical_file_open(gboolean foreign)
 { 
 #undef P_N
 #define P_N "xfical_file_open: "
-    gboolean ok;
-    gint i;
-    struct stat s;
+    gboolean ok, loaded;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
@@ -379,41 +1138,19 @@ gboolean xfical_file_open(gboolean foreign)
     /* make sure there are no external updates or they will be overwritten */
     if (g_par.latest_file_change)
         orage_external_update_check(NULL);
+    loaded = (ic_fical != NULL);
     ok = ic_internal_file_open(&ic_ical, &ic_fical, g_par.orage_file, FALSE
             , FALSE);
     /* store last access time */
-    if (ok)
-        if (g_stat(g_par.orage_file, &s) < 0) {
-            orage_message(150, P_N "stat of %s failed: %d (%s)",
-                    g_par.orage_file, errno, strerror(errno));
-            g_par.latest_file_change = (time_t)0;
-        }
-        else {
-            g_par.latest_file_change = s.st_mtime;
-        }
+    if (ok && !loaded) {
+        file_store_change_time(g_par.orage_file, &g_par.latest_file_change);
+        ic_change_log_replay();
+        mark_cache_add_file(ic_ical);
+        ic_snapshot_schedule();
+    }
 
     if (ok && foreign) /* let's open foreign files */
-        for (i = 0; i < g_par.foreign_count; i++) {
-            ok = ic_internal_file_open(&(ic_f_ical[i].ical)
-                    , &(ic_f_ical[i].fical), g_par.foreign_data[i].file
-                    , g_par.foreign_data[i].read_only , FALSE);
-            if (!ok) {
-                ic_f_ical[i].ical = NULL;
-                ic_f_ical[i].fical = NULL;
-                g_par.foreign_data[i].latest_file_change = (time_t)0;
-            }
-            else {
-                /* store last access time */
-                if (g_stat(g_par.foreign_data[i].file, &s) < 0) {
-                    orage_message(150, P_N "stat of %s failed: %d (%s)",
-                            g_par.foreign_data[i].file, errno, strerror(errno));
-                    g_par.foreign_data[i].latest_file_change = (time_t)0;
-                }
-                else {
-                    g_par.foreign_data[i].latest_file_change = s.st_mtime;
-                }
-            }
-        }
+        ok = foreign_files_open();
 
     return(ok);
 }
@@ -431,103 +1168,85 @@ gboolean xfical_file_check(gchar *file_name)
     return(ic_internal_file_open(&x_ical, &x_fical, file_name, FALSE, TRUE));
 }
 
-static gboolean delayed_file_close(gpointer user_data)
+static void file_unload(icalset **p_fical, icalcomponent **p_ical)
 {
 #undef P_N
-#define P_N "delayed_file_close: "
+#define P_N "file_unload: "
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    if (ic_fical == NULL)
-        return(FALSE); /* closed already, nothing to do */
-    icalset_free(ic_fical);
-    ic_fical = NULL;
-#ifdef ORAGE_DEBUG
-    orage_message(-10, P_N "closing ical file");
-#endif
-    /* we only close file once, so end here */
-    file_close_timer = 0;
-    return(FALSE); 
+    if (*p_fical == NULL)
+        return; /* not loaded, nothing to do */
+    ic_uid_index_free(*p_ical);
+    mark_cache_remove_file(*p_ical); /* marks point to the freed components */
+    icalset_free(*p_fical); /* this also writes pending changes */
+    *p_fical = NULL;
+    *p_ical = NULL;
 }
 
+/* Write changes back to disk, but keep the calendar data in memory.
+ * Files are only released when file close delay is 0 or 
+ * xfical_file_close_force is called. */
 void xfical_file_close(gboolean foreign)
 {
 #undef  P_N 
 #define P_N "xfical_file_close: "
     gint i;
-    struct stat s;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
     if (ic_fical == NULL)
-        orage_message(250, P_N "ic_fical is NULL");
-    else {
-        if (file_close_timer) { 
-            /* We are closing main ical file and delayed close is in progress. 
-             * Closing must be cancelled since we are now closing the file. */
-            g_source_remove(file_close_timer);
-            file_close_timer = 0;
-#ifdef ORAGE_DEBUG
-            orage_message(-10, P_N "canceling delayed close");
-#endif
-        }
-        if (ic_file_modified || g_par.file_close_delay == 0) { /* close it now */
-#ifdef ORAGE_DEBUG
-            orage_message(-10, P_N "closing file now");
-#endif
-            delayed_file_close(NULL);
-            /* store last access time */
-            if (g_stat(g_par.orage_file, &s) < 0) {
-                orage_message(150, P_N "stat of %s failed: %d (%s)",
-                        g_par.orage_file, errno, strerror(errno));
-                g_par.latest_file_change = (time_t)0;
-            }
-            else {
-                g_par.latest_file_change = s.st_mtime;
-            }
-        }
-        else { /* close it later (to save time) */
+        orage_message(250, P_N "ic_fical is NULL");
+    else if (ic_file_modified) {
 #ifdef ORAGE_DEBUG
-            orage_message(-10, P_N "closing file after %d seconds",
-                    g_par.file_close_delay);
+        orage_message(-10, P_N "writing changes");
 #endif
-            file_close_timer = g_timeout_add_seconds(g_par.file_close_delay
-                    , (GtkFunction)delayed_file_close, NULL);
-        }
+        icalset_commit(ic_fical);
+        /* store last access time */
+        file_store_change_time(g_par.orage_file, &g_par.latest_file_change);
     }
     
-    if (foreign) 
+    /* foreign files can be modified also when caller did not ask for them,
+     * so they are always committed. Commit does nothing if not changed. */
+    if (ic_file_modified) 
         for (i = 0; i < g_par.foreign_count; i++) {
-            if (ic_f_ical[i].fical == NULL)
-                orage_message(150, P_N "foreign fical is NULL");
-            else {
-                icalset_free(ic_f_ical[i].fical);
-                ic_f_ical[i].fical = NULL;
+            if (ic_f_ical[i].fical == NULL) {
+                if (foreign)
+                    orage_message(150, P_N "foreign fical is NULL");
+            }
+            else if (!g_par.foreign_data[i].read_only) {
+                icalset_commit(ic_f_ical[i].fical);
                 /* store last access time */
-                if (g_stat(g_par.foreign_data[i].file, &s) < 0) {
-                    orage_message(150, P_N "stat of %s failed: %d (%s)",
-                            g_par.foreign_data[i].file, errno, strerror(errno));
-                    g_par.foreign_data[i].latest_file_change = (time_t)0;
-                }
-                else {
-                    g_par.foreign_data[i].latest_file_change = s.st_mtime;
-                }
+                file_store_change_time(g_par.foreign_data[i].file
+                        , &g_par.foreign_data[i].latest_file_change);
             }
         }
+    ic_file_modified = FALSE;
+
+    if (g_par.file_close_delay == 0) /* do not keep files in memory */
+        xfical_file_close_force();
+    else
+        ic_snapshot_schedule();
 }
 
+/* Release all calendar files from memory. Next xfical_file_open reads
+ * them again from disk. */
 void xfical_file_close_force(void)
 {
 #undef  P_N 
 #define P_N "xfical_file_close_force: "
+    gint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    ic_file_modified = TRUE;
-    xfical_file_close(TRUE);
+    file_unload(&ic_fical, &ic_ical);
+    /* we release all slots since foreign file list may have changed */
+    for (i = 0; i < 10; i++)
+        file_unload(&(ic_f_ical[i].fical), &(ic_f_ical[i].ical));
+    ic_file_modified = FALSE;
 }
 
 char *ic_get_char_timezone(icalproperty *p)
@@ -798,6 +1517,29 @@ static int local_compare_date_only(struct icaltimetype a
     return retval;
 }
 
+/* Make the recurrence iterator skip occurrences starting before start_time.
+ * Internal libical steps over whole periods without generating them;
+ * with an external one callers just walk through them as before.
+ * Callers still check each occurrence they get, so we go back one extra
+ * day to be safe with timezone differences between the times.
+ */
+static void recur_skip_to(icalrecur_iterator *ri
+        , struct icaltimetype start_time)
+{
+#undef P_N
+#define P_N "recur_skip_to: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+#ifndef HAVE_LIBICAL
+    if (ri && !icaltime_is_null_time(start_time)) {
+        icaltime_adjust(&start_time, -1, 0, 0, 0);
+        icalrecur_iterator_set_start(ri, start_time);
+    }
+#endif
+}
+
 static struct icaltimetype convert_to_zone(struct icaltimetype t, gchar *tz)
 {
 #undef  P_N 
@@ -1474,7 +2216,7 @@ static char *appt_add_internal(xfical_appt *appt, gboolean add, char *uid
 {
 #undef P_N
 #define P_N "appt_add_internal: "
-    icalcomponent *icmp;
+    icalcomponent *icmp, *base;
     struct icaltimetype dtstamp, create_time;
     gchar *int_uid, *ext_uid;
     gchar **tmp_cat;
@@ -1567,13 +2309,19 @@ static char *appt_add_internal(xfical_appt *appt, gboolean add, char *uid
     }
 
     if (ext_uid[0] == 'O') {
-        icalcomponent_add_component(ic_ical, icmp);
-        icalset_mark(ic_fical);
+        base = ic_ical;
+        icalcomponent_add_component(base, icmp);
+        ic_uid_index_add(base, icmp);
+        if (!ic_change_log_append(add ? 'A' : 'R'
+                    , icalcomponent_get_uid(icmp), icmp))
+            icalset_mark(ic_fical);
     }
     else if (ext_uid[0] == 'F') {
         sscanf(ext_uid, "F%02d", &i);
         if (i < g_par.foreign_count && ic_f_ical[i].ical != NULL) {
-            icalcomponent_add_component(ic_f_ical[i].ical, icmp);
+            base = ic_f_ical[i].ical;
+            icalcomponent_add_component(base, icmp);
+            ic_uid_index_add(base, icmp);
             icalset_mark(ic_f_ical[i].fical);
         }
         else {
@@ -1585,7 +2333,7 @@ static char *appt_add_internal(xfical_appt *appt, gboolean add, char *uid
         orage_message(260, P_N "unknown file type %s", ext_uid);
         return(NULL);
     }
-    xfical_alarm_build_list_internal(FALSE);
+    xfical_alarm_build_list_uid(ext_uid, base);
     ic_file_modified = TRUE;
     return(ext_uid);
 }
@@ -2260,21 +3008,12 @@ static xfical_appt *xfical_appt_get_internal(char *ical_uid
     xfical_appt appt;
     icalcomponent *c = NULL;
     gboolean key_found = FALSE;
-    const char *text;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    for (c = icalcomponent_get_first_component(base, ICAL_ANY_COMPONENT); 
-         c != 0 && !key_found;
-         c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
-        text = icalcomponent_get_uid(c);
-
-        if (ORAGE_STR_EXISTS(text) && strcmp(text, ical_uid) == 0) { 
-            /* we found our uid (=component) */
-            key_found = get_appt_from_icalcomponent(c, &appt);
-        }
-    }
+    if ((c = ic_uid_index_lookup(base, ical_uid)) != NULL)
+        key_found = get_appt_from_icalcomponent(c, &appt);
     if (key_found) {
         return(g_memdup(&appt, sizeof(xfical_appt)));
     }
@@ -2426,9 +3165,8 @@ gboolean xfical_appt_mod(char *ical_uid, xfical_appt *appt)
 #undef P_N
 #define P_N "xfical_appt_mod: "
     icalcomponent *c, *base;
-    char *uid, *int_uid;
+    char *int_uid;
     icalproperty *p = NULL;
-    gboolean key_found = FALSE;
     struct icaltimetype create_time = icaltime_null_time();
     int i;
 
@@ -2459,22 +3197,15 @@ gboolean xfical_appt_mod(char *ical_uid, xfical_appt *appt)
         orage_message(260, P_N "unknown file type %s", ical_uid);
         return(FALSE);
     }
-    for (c = icalcomponent_get_first_component(base, ICAL_ANY_COMPONENT); 
-         c != 0 && !key_found;
-         c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
-        uid = (char *)icalcomponent_get_uid(c);
-        if (ORAGE_STR_EXISTS(uid) && (strcmp(uid, int_uid) == 0)) {
-            if ((p = icalcomponent_get_first_property(c,
-                            ICAL_CREATED_PROPERTY)))
-                create_time = icalproperty_get_created(p);
-            icalcomponent_remove_component(base, c);
-            key_found = TRUE;
-        }
-    } 
-    if (!key_found) {
+    if ((c = ic_uid_index_lookup(base, int_uid)) == NULL) {
         orage_message(130, P_N "uid %s not found. Doing nothing", ical_uid);
         return(FALSE);
     }
+    if ((p = icalcomponent_get_first_property(c, ICAL_CREATED_PROPERTY)))
+        create_time = icalproperty_get_created(p);
+    ic_uid_index_remove(base, c);
+    icalcomponent_remove_component(base, c);
+    icalcomponent_free(c);
 
     appt_add_internal(appt, FALSE, ical_uid, create_time);
     return(TRUE);
@@ -2490,7 +3221,7 @@ gboolean xfical_appt_del(char *ical_uid)
 #define P_N "xfical_appt_del: "
     icalcomponent *c, *base;
     icalset *fbase;
-    char *uid, *int_uid;
+    char *int_uid;
     int i;
     struct stat s;
 
@@ -2526,20 +3257,18 @@ gboolean xfical_appt_del(char *ical_uid)
         return(FALSE);
     }
 
-    for (c = icalcomponent_get_first_component(base, ICAL_ANY_COMPONENT); 
-         c != 0;
-         c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
-        uid = (char *)icalcomponent_get_uid(c);
-        if (ORAGE_STR_EXISTS(uid) && strcmp(uid, int_uid) == 0) {
-            icalcomponent_remove_component(base, c);
-            icalset_mark(fbase);
-            xfical_alarm_build_list_internal(FALSE);
-            ic_file_modified = TRUE;
-            return(TRUE);
-        }
-    } 
-    orage_message(130, P_N "uid %s not found. Doing nothing", ical_uid);
-    return(FALSE);
+    if ((c = ic_uid_index_lookup(base, int_uid)) == NULL) {
+        orage_message(130, P_N "uid %s not found. Doing nothing", ical_uid);
+        return(FALSE);
+    }
+    ic_uid_index_remove(base, c);
+    icalcomponent_remove_component(base, c);
+    icalcomponent_free(c);
+    if (ical_uid[0] != 'O' || !ic_change_log_append('D', int_uid, NULL))
+        icalset_mark(fbase);
+    xfical_alarm_build_list_uid(ical_uid, base); /* overrides may remain */
+    ic_file_modified = TRUE;
+    return(TRUE);
 }
 
 static void set_todo_times(icalcomponent *c, xfical_period *per)
@@ -2628,8 +3357,8 @@ static gint exclude_order(gconstpointer a, gconstpointer b)
 {
 #undef P_N
 #define P_N "exclude_order: "
-    return(icaltime_compare(((excluded_time *)a)->e_time
-                          , ((excluded_time *)b)->e_time));
+    return(icaltime_compare(*(struct icaltimetype *)a
+                          , *(struct icaltimetype *)b));
 }
 
 static icaltimezone *build_excluded_list_dtstart(icalcomponent *c) 
@@ -2652,15 +3381,19 @@ static icaltimezone *build_excluded_list_dtstart(icalcomponent *c)
     return((icaltimezone *)zone);
 }
 
-static void build_excluded_list(GList **exclude_l, icalcomponent *comp
+/* Collect the EXDATEs of comp into an array sorted by time, so that
+ * time_is_excluded can use binary search. Free with g_array_free.
+ */
+static GArray *build_excluded_list(icalcomponent *comp
         , const icaltimezone *zone)
 {
 #undef P_N
 #define P_N "build_excluded_list: "
     icalproperty *exdate;
     struct icaltimetype exdatetime;
-    excluded_time *l_etime;
+    GArray *exclude_a;
 
+    exclude_a = g_array_new(FALSE, FALSE, sizeof(struct icaltimetype));
     for (exdate = icalcomponent_get_first_property(comp,ICAL_EXDATE_PROPERTY);
          exdate != NULL;
          exdate = icalcomponent_get_next_property(comp,ICAL_EXDATE_PROPERTY)) {
@@ -2668,52 +3401,43 @@ static void build_excluded_list(GList **exclude_l, icalcomponent *comp
         exdatetime = ic_convert_to_timezone(exdatetime, exdate);
         if (!exdatetime.zone) 
             icaltime_set_timezone(&exdatetime, zone);
-
-        l_etime = g_new(excluded_time, 1);
-        l_etime->e_time = exdatetime;
-        *exclude_l = g_list_prepend(*exclude_l, l_etime);
+        g_array_append_val(exclude_a, exdatetime);
     }
+    g_array_sort(exclude_a, exclude_order);
+    return(exclude_a);
 }
 
-static void free_exclude_time(gpointer e_t, gpointer dummy)
-{
-    g_free(e_t);
-}
-
-static void free_excluded_list(GList *exclude_l)
-{
-
-    g_list_foreach(exclude_l, free_exclude_time, NULL);
-    g_list_free(exclude_l);
-    exclude_l = NULL;
-}
-
-static gboolean time_is_excluded(GList *exclude_l, struct icaltimetype *time)
+static gboolean time_is_excluded(GArray *exclude_a, struct icaltimetype *time)
 {
 #undef P_N
 #define P_N "time_is_excluded: "
-    GList *e_l=NULL;
-    excluded_time *excl_time;
     struct icaltimetype e_time;
+    guint lower, upper, middle;
 
-    if (exclude_l == NULL || time == NULL || icaltime_is_null_time(*time))
-        return 0;
-
-    for (e_l = g_list_first(exclude_l); e_l != NULL; e_l = g_list_next(e_l)) {
-        excl_time = (excluded_time *)e_l->data;
-        e_time = excl_time->e_time;
-        if ((icaltime_is_date(e_time)
-             && icaltime_compare_date_only(e_time, *time) == 0)
-            || (icaltime_compare(e_time, *time) == 0))
-            return(1);
-        else if ((icaltime_is_date(e_time)
-                  && icaltime_compare_date_only(e_time, *time) > 0)
-                 || (icaltime_compare(e_time, *time) > 0))
-        /* remember that it is sorted list, so when e_time is bigger than
-           searched time, we know that we did not find a match */
-            return(0);
+    if (exclude_a == NULL || exclude_a->len == 0 || time == NULL 
+    || icaltime_is_null_time(*time))
+        return(FALSE);
+
+    /* find the first excluded time on the same day as time... */
+    lower = 0;
+    upper = exclude_a->len;
+    while (lower < upper) {
+        middle = (lower + upper) / 2;
+        e_time = g_array_index(exclude_a, struct icaltimetype, middle);
+        if (icaltime_compare_date_only(e_time, *time) < 0)
+            lower = middle + 1;
+        else
+            upper = middle;
     }
-    return(0); /* end of list reached */
+    /* ...and check all of that day. Dates exclude the whole day */
+    for (; lower < exclude_a->len; lower++) {
+        e_time = g_array_index(exclude_a, struct icaltimetype, lower);
+        if (icaltime_compare_date_only(e_time, *time) != 0)
+            break;
+        if (icaltime_is_date(e_time) || icaltime_compare(e_time, *time) == 0)
+            return(TRUE);
+    }
+    return(FALSE);
 }
 
 /* let's find the trigger and check that it is active.
@@ -2740,7 +3464,7 @@ static alarm_struct *process_alarm_trigger(icalcomponent *c
     struct icaldurationtype alarm_start_diff;
     struct icaldatetimeperiodtype rdate_period;
     gchar *tmp1, *tmp2;
-    GList *excluded_list = NULL;
+    GArray *excluded_list = NULL;
     icaltimezone *dtstart_zone;
     /* pvl_elem property_iterator;   */ /* for saving the iterator */
 
@@ -2803,8 +3527,7 @@ icalproperty *exdate;
 struct icaltimetype exdatetime;
         /* check recurring EVENTs */
         dtstart_zone = build_excluded_list_dtstart(c);
-        build_excluded_list(&excluded_list, c, dtstart_zone);
-        excluded_list = g_list_sort(excluded_list, exclude_order);
+        excluded_list = build_excluded_list(c, dtstart_zone);
         rrule = icalproperty_get_rrule(p);
         set_todo_times(c, &per); /* may change per.stime to be per.ctime */
         next_alarm_time = count_first_alarm_time(per, trg.duration, rel);
@@ -2816,6 +3539,13 @@ orage_message(120, P_N "rec Alarm %s %s", icaltime_as_ical_string(next_alarm_tim
 */
         alarm_start_diff = icaltime_subtract(next_alarm_time, per.stime);
         ri = icalrecur_iterator_new(rrule, per.stime);
+        if (per.ikind == ICAL_VTODO_COMPONENT)
+            recur_skip_to(ri, per.ctime);
+        else {
+            alarm_start_diff.is_neg = !alarm_start_diff.is_neg;
+            recur_skip_to(ri, icaltime_add(cur_time, alarm_start_diff));
+            alarm_start_diff.is_neg = !alarm_start_diff.is_neg;
+        }
         for (next_start_time = icalrecur_iterator_next(ri),
              next_alarm_time = count_next_alarm_time(next_start_time
                     , alarm_start_diff);
@@ -2858,7 +3588,7 @@ orage_message(120, P_N "Alarm rec loop next_start:%s next_alarm:%s per.stime:%s"
         if (icaltime_compare(cur_time, next_alarm_time) <= 0) {
             trg_active = TRUE;
         }
-        free_excluded_list(excluded_list);
+        g_array_free(excluded_list, TRUE);
         /*
 orage_message(120, P_N "Alarm rec loop END next_start:%s next_alarm:%s per.stime:%s excluded:%d", icaltime_as_ical_string(next_start_time), icaltime_as_ical_string(next_alarm_time), icaltime_as_ical_string(per.stime), icalproperty_recurrence_is_excluded(c, &per.stime, &next_start_time));
 exdate = icalcomponent_get_first_property(c,ICAL_EXDATE_PROPERTY);
@@ -3111,19 +3841,77 @@ static void process_alarm_data(icalcomponent *ca, alarm_struct *new_alarm)
 */
 }
 
+/* find active alarm of component c and add it to the alarm list.
+ * returns TRUE if alarm was added */
+static gboolean xfical_alarm_add_component(icalcomponent *c
+        , struct icaltimetype cur_time, char *file_type
+        , gint *cnt_alarm, gint *cnt_act_alarm, gint *cnt_repeat)
+{
+#undef P_N
+#define P_N "xfical_alarm_add_component: "
+    icalcomponent *ca;
+    char *suid;
+    gboolean trg_processed = FALSE, trg_active = FALSE;
+    icalcompiter ci;
+    alarm_struct *new_alarm = NULL;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    for (ci = icalcomponent_begin_component(c, ICAL_VALARM_COMPONENT);
+            icalcompiter_deref(&ci) != 0;
+            icalcompiter_next(&ci)) {
+        ca = icalcompiter_deref(&ci);
+        (*cnt_alarm)++;
+        if (!trg_processed) {
+            trg_processed = TRUE;
+            new_alarm = process_alarm_trigger(c, ca, cur_time, cnt_repeat);
+            if (new_alarm) {
+                trg_active = TRUE;
+                suid = (char *)icalcomponent_get_uid(c);
+                new_alarm->uid = g_strconcat(file_type, suid, NULL);
+                new_alarm->title = orage_process_text_commands(
+                        (char *)icalcomponent_get_summary(c));
+                new_alarm->description = orage_process_text_commands(
+                        (char *)icalcomponent_get_description(c));
+            }
+        }
+        if (trg_active) {
+            (*cnt_act_alarm)++;
+            process_alarm_data(ca, new_alarm);
+        }
+        /*
+        if (trg_processed) {
+            if (trg_active) {
+                cnt_act_alarm++;
+                process_alarm_data(ca, new_alarm);
+            }
+        }
+        else {
+            orage_message(140, P_N "Found alarm without trigger %s. Skipping it"
+                    , icalcomponent_get_uid(c));
+        }
+        */
+    }  /* ALARM */
+    if (trg_active) {
+        alarm_add(new_alarm);
+        /*
+        orage_message(60, "new alarm: alarm:%s action:%s title:%s\n"
+        , new_alarm->alarm_time, new_alarm->action_time, new_alarm->title);
+        */
+    }
+    return(trg_active);
+}
+
 static void xfical_alarm_build_list_internal_real(gboolean first_list_today
         , icalcomponent *base, char *file_type, char *file_name)
 {
 #undef P_N
 #define P_N "xfical_alarm_build_list_internal_real: "
-    icalcomponent *c, *ca;
+    icalcomponent *c;
     struct icaltimetype cur_time;
-    char *suid;
-    gboolean trg_processed = FALSE, trg_active = FALSE;
     gint cnt_alarm=0, cnt_repeat=0, cnt_event=0, cnt_act_alarm=0
         , cnt_alarm_add=0;
-    icalcompiter ci;
-    alarm_struct *new_alarm = NULL;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
@@ -3135,51 +3923,9 @@ static void xfical_alarm_build_list_internal_real(gboolean first_list_today
             c != 0;
             c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
         cnt_event++;
-        trg_processed = FALSE;
-        trg_active = FALSE;
-        for (ci = icalcomponent_begin_component(c, ICAL_VALARM_COMPONENT);
-                icalcompiter_deref(&ci) != 0;
-                icalcompiter_next(&ci)) {
-            ca = icalcompiter_deref(&ci);
-            cnt_alarm++;
-            if (!trg_processed) {
-                trg_processed = TRUE;
-                new_alarm = process_alarm_trigger(c, ca, cur_time, &cnt_repeat);
-                if (new_alarm) {
-                    trg_active = TRUE;
-                    suid = (char *)icalcomponent_get_uid(c);
-                    new_alarm->uid = g_strconcat(file_type, suid, NULL);
-                    new_alarm->title = orage_process_text_commands(
-                            (char *)icalcomponent_get_summary(c));
-                    new_alarm->description = orage_process_text_commands(
-                            (char *)icalcomponent_get_description(c));
-                }
-            }
-            if (trg_active) {
-                cnt_act_alarm++;
-                process_alarm_data(ca, new_alarm);
-            }
-            /*
-            if (trg_processed) {
-                if (trg_active) {
-                    cnt_act_alarm++;
-                    process_alarm_data(ca, new_alarm);
-                }
-            }
-            else {
-                orage_message(140, P_N "Found alarm without trigger %s. Skipping it"
-                        , icalcomponent_get_uid(c));
-            }
-            */
-        }  /* ALARM */
-        if (trg_active) {
-            alarm_add(new_alarm);
-            /*
-            orage_message(60, "new alarm: alarm:%s action:%s title:%s\n"
-            , new_alarm->alarm_time, new_alarm->action_time, new_alarm->title);
-            */
+        if (xfical_alarm_add_component(c, cur_time, file_type
+                    , &cnt_alarm, &cnt_act_alarm, &cnt_repeat))
             cnt_alarm_add++;
-        }
     }  /* COMPONENT */
     if (first_list_today) {
         if (strcmp(file_type, "O00.") == 0)
@@ -3194,46 +3940,387 @@ static void xfical_alarm_build_list_internal_real(gboolean first_list_today
     }
 }
 
-static void xfical_alarm_build_list_internal(gboolean first_list_today)
+/* Only alarms of one appointment have changed, so there is no need to 
+ * go through all files. Full rebuild is only done when day changes or
+ * files have been changed outside of Orage.
+ * Alarms are kept by uid, so alarms of all components with the uid, like
+ * RECURRENCE-ID overrides, are built again like delta_apply does.
+ * ext_uid: uid with file type prefix (O00., F01.,...)
+ * base: calendar, which holds the appointment or NULL if unknown */
+static void xfical_alarm_build_list_uid(char *ext_uid, icalcomponent *base)
+{
+#undef P_N
+#define P_N "xfical_alarm_build_list_uid: "
+    struct icaltimetype cur_time;
+    gchar file_type[8];
+    gint cnt_alarm=0, cnt_repeat=0, cnt_act_alarm=0;
+    GList *comps, *l;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    alarm_remove_uid(ext_uid);
+    comps = uid_index_lookup_all(base, ext_uid+4);
+    if (comps) {
+        cur_time = icaltime_current_time_with_zone(utc_icaltimezone);
+        g_strlcpy(file_type, ext_uid, 5);
+        for (l = comps; l != NULL; l = g_list_next(l))
+            xfical_alarm_add_component((icalcomponent *)l->data, cur_time
+                    , file_type, &cnt_alarm, &cnt_act_alarm, &cnt_repeat);
+        g_list_free(comps);
+    }
+    setup_orage_alarm_clock(); /* keep reminders upto date */
+    build_mainbox_info();      /* refresh main calendar window lists */
+}
+
+static void xfical_alarm_build_list_internal(gboolean first_list_today)
+{
+#undef P_N
+#define P_N "xfical_alarm_build_list_internal: "
+    gchar file_type[8];
+    gint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    /* first remove all old alarms by cleaning the whole structure */
+    alarm_list_free();
+
+    /* first search base orage file */
+    strcpy(file_type, "O00.");
+    xfical_alarm_build_list_internal_real(first_list_today, ic_ical, file_type
+            , NULL);
+    /* then process all foreign files */
+    for (i = 0; i < g_par.foreign_count; i++) {
+        g_sprintf(file_type, "F%02d.", i);
+        xfical_alarm_build_list_internal_real(first_list_today
+                , ic_f_ical[i].ical, file_type, g_par.foreign_data[i].name);
+    }
+    setup_orage_alarm_clock(); /* keep reminders upto date */
+    build_mainbox_info();      /* refresh main calendar window lists */
+}
+
+/* alarm of ext_uid has fired, find its next alarm time. A recurring
+ * appointment may have RECURRENCE-ID overrides with alarms of their own
+ * under the same uid, so all of them are refreshed and not only the
+ * main appointment, which the uid index returns. */
+void xfical_alarm_refresh_uid(char *ext_uid)
+{
+#undef P_N
+#define P_N "xfical_alarm_refresh_uid: "
+    icalcomponent *base = NULL;
+    gint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (strlen(ext_uid) < 5) {
+        orage_message(150, P_N "unknown appointment name %s", ext_uid);
+        return;
+    }
+    if (!xfical_file_open(TRUE))
+        return;
+    if (ext_uid[0] == 'O')
+        base = ic_ical;
+    else if (ext_uid[0] == 'F') {
+        sscanf(ext_uid, "F%02d", &i);
+        if (i < g_par.foreign_count)
+            base = ic_f_ical[i].ical;
+    }
+    if (base == NULL) /* its alarms are just dropped */
+        orage_message(150, P_N "unknown file type %s", ext_uid);
+    xfical_alarm_build_list_uid(ext_uid, base);
+    xfical_file_close(TRUE);
+}
+
+void xfical_alarm_build_list(gboolean first_list_today)
+{
+#undef P_N
+#define P_N "xfical_alarm_build_list: "
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (xfical_file_open(TRUE)) {
+        xfical_alarm_build_list_internal(first_list_today);
+        xfical_file_close(TRUE);
+    }
+}
+
+/* Delta reload: the new version of a changed file is read into a separate
+ * set and compared with the one in memory. Components are grouped by UID
+ * (overridden recurrences share the UID of their base event), components
+ * without UID by their content. Only groups which were added, changed or
+ * removed are moved into the calendar in memory, so indexes, marks and
+ * alarms of the rest stay as they are. */
+typedef struct _delta_group
+{
+    GList *old_l;  /* components in memory */
+    GList *new_l;  /* components of the new version */
+} delta_group;
+
+static void delta_group_free(delta_group *g)
+{
+    g_list_free(g->old_l);
+    g_list_free(g->new_l);
+    g_free(g);
+}
+
+static gchar *delta_key(icalcomponent *c)
+{
+    const char *uid;
+
+    if (ORAGE_STR_EXISTS(uid = icalcomponent_get_uid(c)))
+        return(g_strdup(uid));
+    /* newline can not be part of uid, so these can not clash */
+    return(g_strconcat("\n", icalcomponent_as_ical_string(c), NULL));
+}
+
+static GList *delta_collect(GHashTable *groups, GList *order
+        , icalcomponent *ical, gboolean new)
+{
+    icalcompiter ci;
+    icalcomponent *c;
+    delta_group *g;
+    gchar *key;
+
+    for (ci = icalcomponent_begin_component(ical, ICAL_ANY_COMPONENT);
+         (c = icalcompiter_deref(&ci)) != 0;
+         icalcompiter_next(&ci)) {
+        key = delta_key(c);
+        if ((g = g_hash_table_lookup(groups, key)) == NULL) {
+            g = g_new0(delta_group, 1);
+            g_hash_table_insert(groups, key, g);
+            order = g_list_prepend(order, g);
+        }
+        else
+            g_free(key);
+        if (new)
+            g->new_l = g_list_prepend(g->new_l, c);
+        else
+            g->old_l = g_list_prepend(g->old_l, c);
+    }
+    return(order);
+}
+
+static gboolean delta_same_property(icalcomponent *a, icalcomponent *b
+        , icalproperty_kind kind)
+{
+    icalproperty *pa, *pb;
+
+    pa = icalcomponent_get_first_property(a, kind);
+    pb = icalcomponent_get_first_property(b, kind);
+    if (pa == NULL || pb == NULL)
+        return(pa == pb);
+    return(strcmp(icalproperty_get_value_as_string(pa)
+                , icalproperty_get_value_as_string(pb)) == 0);
+}
+
+static gboolean delta_same(icalcomponent *a, icalcomponent *b)
+{
+    if (icalcomponent_isa(a) != icalcomponent_isa(b)
+    ||  !delta_same_property(a, b, ICAL_RECURRENCEID_PROPERTY))
+        return(FALSE);
+    /* programs which write LAST-MODIFIED keep it (and SEQUENCE) current,
+     * without it we need to compare the whole content */
+    if (icalcomponent_get_first_property(a, ICAL_LASTMODIFIED_PROPERTY)
+    &&  icalcomponent_get_first_property(b, ICAL_LASTMODIFIED_PROPERTY))
+        return(delta_same_property(a, b, ICAL_LASTMODIFIED_PROPERTY)
+            && delta_same_property(a, b, ICAL_SEQUENCE_PROPERTY));
+    return(strcmp(icalcomponent_as_ical_string(a)
+                , icalcomponent_as_ical_string(b)) == 0);
+}
+
+static gboolean delta_group_changed(delta_group *g)
+{
+    GList *o, *n;
+
+    for (o = g->old_l, n = g->new_l; o && n; o = o->next, n = n->next) {
+        if (!delta_same((icalcomponent *)o->data, (icalcomponent *)n->data))
+            return(TRUE);
+    }
+    return(o != n); /* different count, one of them is not NULL */
+}
+
+static gchar *delta_calendar_properties(icalcomponent *ical)
+{
+    GString *props;
+    icalproperty *p;
+
+    props = g_string_new(NULL);
+    for (p = icalcomponent_get_first_property(ical, ICAL_ANY_PROPERTY);
+         p != 0;
+         p = icalcomponent_get_next_property(ical, ICAL_ANY_PROPERTY))
+        g_string_append(props, icalproperty_as_ical_string(p));
+    return(g_string_free(props, FALSE));
+}
+
+/* replace components of one group in base with the new ones */
+static void delta_apply(delta_group *g, icalcomponent *base
+        , icalcomponent *new_ical, char *file_type)
+{
+    GList *l;
+    icalcomponent *c;
+    const char *uid = NULL;
+    gchar *ext_uid;
+    struct icaltimetype cur_time;
+    gint cnt_alarm=0, cnt_repeat=0, cnt_act_alarm=0;
+
+    for (l = g->old_l; l; l = l->next) {
+        c = (icalcomponent *)l->data;
+        if (uid == NULL && (uid = icalcomponent_get_uid(c)) != NULL) {
+            /* alarms of the whole group are built again */
+            ext_uid = g_strconcat(file_type, uid, NULL);
+            alarm_remove_uid(ext_uid);
+            g_free(ext_uid);
+        }
+        ic_uid_index_remove(base, c);
+        icalcomponent_remove_component(base, c);
+        icalcomponent_free(c);
+    }
+    cur_time = icaltime_current_time_with_zone(utc_icaltimezone);
+    for (l = g->new_l; l; l = l->next) {
+        c = (icalcomponent *)l->data;
+        icalcomponent_remove_component(new_ical, c);
+        icalcomponent_add_component(base, c);
+        ic_uid_index_add(base, c);
+        if (icalcomponent_get_uid(c))
+            xfical_alarm_add_component(c, cur_time, file_type
+                    , &cnt_alarm, &cnt_act_alarm, &cnt_repeat);
+    }
+}
+
+/* returns FALSE if delta reload is not possible and nothing was done */
+static gboolean file_reload_delta(gint foreign, char *file_type
+        , icalset **p_fical, icalcomponent **p_ical)
+{
+#undef P_N
+#define P_N "file_reload_delta: "
+    icalset *new_fical = NULL;
+    icalcomponent *new_ical = NULL;
+    gchar *file, *old_props, *new_props;
+    gboolean read_only, same_props;
+    GHashTable *groups;
+    GList *order, *l;
+    delta_group *g;
+    gint cnt_add = 0, cnt_mod = 0, cnt_del = 0;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (*p_fical == NULL  /* not in memory, so nothing to compare */
+    ||  ic_file_modified) /* our own changes are not written yet */
+        return(FALSE);
+    if (foreign < 0) {
+        /* log changes are applied on top of the file when it is read */
+        if (ic_change_log_pending())
+            return(FALSE);
+        file = g_par.orage_file;
+        read_only = FALSE;
+    }
+    else {
+        file = g_par.foreign_data[foreign].file;
+        read_only = g_par.foreign_data[foreign].read_only;
+    }
+    if (!ic_internal_file_open(&new_ical, &new_fical, file, read_only, FALSE))
+        return(FALSE);
+    old_props = delta_calendar_properties(*p_ical);
+    new_props = delta_calendar_properties(new_ical);
+    same_props = (strcmp(old_props, new_props) == 0);
+    g_free(old_props);
+    g_free(new_props);
+    if (!same_props) { /* rare, simply read the whole file */
+        icalset_free(new_fical);
+        return(FALSE);
+    }
+
+    groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free
+            , (GDestroyNotify)delta_group_free);
+    order = delta_collect(groups, NULL, new_ical, TRUE);
+    order = delta_collect(groups, order, *p_ical, FALSE);
+    order = g_list_reverse(order);
+    for (l = order; l; l = l->next) {
+        g = (delta_group *)l->data;
+        g->old_l = g_list_reverse(g->old_l);
+        g->new_l = g_list_reverse(g->new_l);
+        if (g->old_l == NULL)
+            cnt_add++;
+        else if (g->new_l == NULL)
+            cnt_del++;
+        else if (delta_group_changed(g))
+            cnt_mod++;
+        else
+            continue;
+        delta_apply(g, *p_ical, new_ical, file_type);
+    }
+    g_list_free(order);
+    g_hash_table_destroy(groups);
+
+    /* calendar in memory is now the same as the new file. Give it to the
+     * new set, which knows the new file (and its snapshot), and throw
+     * away the unchanged copies. Neither set is marked changed, so
+     * nothing is written. */
+    icalcomponent_remove_component(icalfileset_get_component(*p_fical)
+            , *p_ical);
+    icalcomponent_remove_component(icalfileset_get_component(new_fical)
+            , new_ical);
+    icalcomponent_free(new_ical);
+    icalcomponent_add_component(icalfileset_get_component(new_fical)
+            , *p_ical);
+    icalset_free(*p_fical);
+    *p_fical = new_fical;
+    ic_snapshot_schedule();
+    orage_message(10, P_N "%s: %d added, %d changed and %d removed"
+            , file, cnt_add, cnt_mod, cnt_del);
+    return(TRUE);
+}
+
+/* Read one calendar file again after it has been changed outside of Orage.
+ * Only alarms, calendar marks and indexes of that file are built again,
+ * the other files stay as they are. When the file is in memory, only the
+ * components which changed are replaced (file_reload_delta).
+ * foreign: index of the foreign file or -1 for the main Orage file */
+void xfical_file_reload(gint foreign)
 {
 #undef P_N
-#define P_N "xfical_alarm_build_list_internal: "
-    gchar file_type[8];
-    gint i;
+#define P_N "xfical_file_reload: "
+    icalset **p_fical;
+    icalcomponent **p_ical;
+    gchar file_type[8], *name = NULL;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    /* first remove all old alarms by cleaning the whole structure */
-    alarm_list_free();
-
-    /* first search base orage file */
-    strcpy(file_type, "O00.");
-    xfical_alarm_build_list_internal_real(first_list_today, ic_ical, file_type
-            , NULL);
-    /* then process all foreign files */
-    for (i = 0; i < g_par.foreign_count; i++) {
-        g_sprintf(file_type, "F%02d.", i);
-        xfical_alarm_build_list_internal_real(first_list_today
-                , ic_f_ical[i].ical, file_type, g_par.foreign_data[i].name);
+    if (foreign < 0) {
+        strcpy(file_type, "O00.");
+        p_fical = &ic_fical;
+        p_ical = &ic_ical;
+    }
+    else if (foreign < g_par.foreign_count) {
+        g_sprintf(file_type, "F%02d.", foreign);
+        p_fical = &(ic_f_ical[foreign].fical);
+        p_ical = &(ic_f_ical[foreign].ical);
+        name = g_par.foreign_data[foreign].name;
+    }
+    else {
+        orage_message(150, P_N "unknown foreign file %d", foreign);
+        return;
+    }
+    if (!file_reload_delta(foreign, file_type, p_fical, p_ical)) {
+        /* read the whole file again */
+        file_unload(p_fical, p_ical);
+        alarm_remove_file(file_type);
+        /* opens only the file we just released, others are in memory */
+        if (xfical_file_open(foreign >= 0)) {
+            if (*p_ical != NULL)
+                xfical_alarm_build_list_internal_real(FALSE, *p_ical
+                        , file_type, name);
+            xfical_file_close(foreign >= 0);
+        }
     }
     setup_orage_alarm_clock(); /* keep reminders upto date */
     build_mainbox_info();      /* refresh main calendar window lists */
 }
 
-void xfical_alarm_build_list(gboolean first_list_today)
-{
-#undef P_N
-#define P_N "xfical_alarm_build_list: "
-#ifdef ORAGE_DEBUG
-    orage_message(-100, P_N);
-#endif
-    if (xfical_file_open(TRUE)) {
-        xfical_alarm_build_list_internal(first_list_today);
-        xfical_file_close(TRUE);
-    }
-}
-
  /* Read next EVENT/TODO/JOURNAL component on the specified date from 
   * ical datafile.
   * a_day:  start date of ical component which is to be read
@@ -3316,6 +4403,13 @@ static xfical_appt *xfical_appt_get_next_on_day_internal(char *a_day
             nsdate = icaltime_null_time();
             rrule = icalproperty_get_rrule(p);
             ri = icalrecur_iterator_new(rrule, per.stime);
+            if (type == XFICAL_TYPE_TODO)
+                recur_skip_to(ri, per.ctime);
+            else {
+                per.duration.is_neg = !per.duration.is_neg;
+                recur_skip_to(ri, icaltime_add(asdate, per.duration));
+                per.duration.is_neg = !per.duration.is_neg;
+            }
             for (nsdate = icalrecur_iterator_next(ri),
                     nedate = icaltime_add(nsdate, per.duration);
                  !icaltime_is_null_time(nsdate)
@@ -3433,7 +4527,7 @@ xfical_appt *xfical_appt_get_next_on_day(char *a_day, gboolean first, gint days
 
 }
 
-static gboolean xfical_mark_calendar_days(GtkCalendar *gtkcal
+static gboolean xfical_mark_calendar_days(guint32 *mask
         , int cur_year, int cur_month
         , int s_year, int s_month, int s_day
         , int e_year, int e_month, int e_day)
@@ -3466,7 +4560,7 @@ static gboolean xfical_mark_calendar_days(GtkCalendar *gtkcal
             end_day = monthdays[cur_month-1]; /* monthdays is 0...11 */
         }
         for (day_cnt = start_day; day_cnt <= end_day; day_cnt++) {
-            gtk_calendar_mark_day(gtkcal, day_cnt);
+            *mask |= 1u << day_cnt;
             marked = TRUE;
         }
     }
@@ -3482,7 +4576,7 @@ static void mark_calendar(icalcomponent *c, icaltime_span *span , void *data)
     struct icaltimetype sdate, edate;
     struct tm start_tm, end_tm;
     struct mark_calendar_data {
-        GtkCalendar *cal;
+        guint32 *mask;
         guint year; 
         guint month;
         gint orig_start_hour, orig_end_hour;
@@ -3540,16 +4634,16 @@ static void mark_calendar(icalcomponent *c, icaltime_span *span , void *data)
              , cal_data->appt.endtimecur
              );
              */
-    xfical_mark_calendar_days(cal_data->cal, cal_data->year, cal_data->month
+    xfical_mark_calendar_days(cal_data->mask, cal_data->year, cal_data->month
             , sdate.year, sdate.month, sdate.day
             , edate.year, edate.month, edate.day);
 }
 
- /* Mark days from appointment c into calendar
+ /* Mark days from appointment c into day mask (bit n = day n)
   * year: Year to be searched
   * month: Month to be searched
   */
-static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
+static void xfical_mark_calendar_from_component(guint32 *mask
         , icalcomponent *c, int year, int month)
 {
 #undef P_N
@@ -3565,7 +4659,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
     char *tmp;
     struct icaltimetype start;
     struct mark_calendar_data {
-        GtkCalendar *cal;
+        guint32 *mask;
         guint year; 
         guint month;
         gint orig_start_hour, orig_end_hour;
@@ -3597,7 +4691,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
         p = icalcomponent_get_first_property(c, ICAL_DTSTART_PROPERTY);
         start = icalproperty_get_dtstart(p);
         if (start.year >= 1970) {
-            cal_data.cal = gtkcal;
+            cal_data.mask = mask;
             cal_data.year = year;
             cal_data.month = month;
             key_found = get_appt_from_icalcomponent(c, &cal_data.appt);
@@ -3625,14 +4719,17 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
              , nedate.day , nedate.month , nedate.year);
     */
             per = ic_get_period(c, TRUE);
-            xfical_mark_calendar_days(gtkcal, year, month
+            xfical_mark_calendar_days(mask, year, month
                     , per.stime.year, per.stime.month, per.stime.day
                     , per.etime.year, per.etime.month, per.etime.day);
             if ((p = icalcomponent_get_first_property(c
                     , ICAL_RRULE_PROPERTY)) != 0) {
-                nsdate = icaltime_null_time();
                 rrule = icalproperty_get_rrule(p);
                 ri = icalrecur_iterator_new(rrule, per.stime);
+                /* nsdate is still the first day of the month here */
+                per.duration.is_neg = !per.duration.is_neg;
+                recur_skip_to(ri, icaltime_add(nsdate, per.duration));
+                per.duration.is_neg = !per.duration.is_neg;
                 for (nsdate = icalrecur_iterator_next(ri),
                         nedate = icaltime_add(nsdate, per.duration);
                      !icaltime_is_null_time(nsdate)
@@ -3641,7 +4738,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
                         nedate = icaltime_add(nsdate, per.duration)) {
                     if (!icalproperty_recurrence_is_excluded(c, &per.stime
                                 , &nsdate))
-                        xfical_mark_calendar_days(gtkcal, year, month
+                        xfical_mark_calendar_days(mask, year, month
                                 , nsdate.year, nsdate.month, nsdate.day
                                 , nedate.year, nedate.month, nedate.day);
                 }
@@ -3656,7 +4753,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
         || (local_compare(per.ctime, per.stime) < 0)) {
             /* VTODO needs to be checked either if it never completed 
              * or it has completed before start */
-            marked = xfical_mark_calendar_days(gtkcal, year, month
+            marked = xfical_mark_calendar_days(mask, year, month
                     , per.etime.year, per.etime.month, per.etime.day
                     , per.etime.year, per.etime.month, per.etime.day);
         }
@@ -3667,6 +4764,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
             rrule = icalproperty_get_rrule(p);
             set_todo_times(c, &per);/* may change per.stime to per.ctime */
             ri = icalrecur_iterator_new(rrule, per.stime);
+            recur_skip_to(ri, per.ctime);
             for (nsdate = icalrecur_iterator_next(ri);
                  !icaltime_is_null_time(nsdate)
                     && (((nsdate.year*12+nsdate.month) <= (year*12+month)
@@ -3680,7 +4778,7 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
             icalrecur_iterator_free(ri);
             if (!icaltime_is_null_time(nsdate)) {
                 nedate = icaltime_add(nsdate, per.duration);
-                marked = xfical_mark_calendar_days(gtkcal, year, month
+                marked = xfical_mark_calendar_days(mask, year, month
                         , nedate.year, nedate.month, nedate.day
                         , nedate.year, nedate.month, nedate.day);
             }
@@ -3688,6 +4786,22 @@ static void xfical_mark_calendar_from_component(GtkCalendar *gtkcal
     } /* ICAL_VTODO_COMPONENT */
 }
 
+static void mark_calendar_apply(GtkCalendar *gtkcal, guint32 mask)
+{
+#undef P_N
+#define P_N "mark_calendar_apply: "
+    gint day;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    gtk_calendar_clear_marks(gtkcal);
+    for (day = 1; day <= 31; day++) {
+        if (mask & (1u << day))
+            gtk_calendar_mark_day(gtkcal, day);
+    }
+}
+
 void xfical_mark_calendar_recur(GtkCalendar *gtkcal, xfical_appt *appt)
 {
 #undef P_N
@@ -3695,12 +4809,12 @@ void xfical_mark_calendar_recur(GtkCalendar *gtkcal, xfical_appt *appt)
     guint year, month, day;
     icalcomponent_kind ikind = ICAL_VEVENT_COMPONENT;
     icalcomponent *icmp;
+    guint32 mask = 0;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
     gtk_calendar_get_date(gtkcal, &year, &month, &day);
-    gtk_calendar_clear_marks(gtkcal);
     if (appt->type == XFICAL_TYPE_EVENT)
         ikind = ICAL_VEVENT_COMPONENT;
     else if (appt->type == XFICAL_TYPE_TODO)
@@ -3718,42 +4832,264 @@ void xfical_mark_calendar_recur(GtkCalendar *gtkcal, xfical_appt *appt)
     appt_add_completedtime_internal(appt, icmp);
     appt_add_recur_internal(appt, icmp);
     appt_add_exception_internal(appt, icmp);
-    xfical_mark_calendar_from_component(gtkcal, icmp, year, month+1);
+    xfical_mark_calendar_from_component(&mask, icmp, year, month+1);
     icalcomponent_free(icmp);
+    mark_calendar_apply(gtkcal, mask);
 }
 
- /* Get all appointments from the file and mark calendar for EVENTs and TODOs
-  */
-static void xfical_mark_calendar_file(GtkCalendar *gtkcal
-        , icalcomponent *base, int year, int month)
+/* Month mark cache: for every month (key year*12+month-1) we keep the
+ * days each appointment marks as a bit mask, but only for appointments
+ * which mark something. Changing one appointment recomputes only that
+ * appointment through ic_uid_index_add and ic_uid_index_remove, and
+ * showing a month just ORs the masks together. Months next to the shown
+ * one are filled in idle time so that paging the calendar is fast. */
+#define MARK_CACHE_MONTHS 6 /* months kept around the shown month */
+
+static GHashTable *mark_cache = NULL; /* key -> GHashTable(comp -> mask) */
+static gint mark_cache_shown = 0;     /* key of the shown month */
+static guint mark_cache_idle_id = 0;
+
+static gboolean mark_cache_base(icalcomponent *base)
 {
-#undef P_N
-#define P_N "xfical_mark_calendar_file: "
+    gint i;
+
+    if (base == NULL)
+        return(FALSE);
+    if (base == ic_ical)
+        return(TRUE);
+    for (i = 0; i < g_par.foreign_count; i++) {
+        if (base == ic_f_ical[i].ical)
+            return(TRUE);
+    }
+    return(FALSE);
+}
+
+static void mark_cache_file(GHashTable *month_cache, icalcomponent *base
+        , gint key)
+{
+    icalcompiter ci;
     icalcomponent *c;
+    guint32 mask;
 
-    for (c = icalcomponent_get_first_component(base, ICAL_ANY_COMPONENT);
-         c != 0;
-         c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
-        xfical_mark_calendar_from_component(gtkcal, c, year, month);
-    } 
+    if (base == NULL)
+        return;
+    /* external iterator so that we do not disturb callers, which
+     * may be in the middle of walking the same calendar */
+    for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+         (c = icalcompiter_deref(&ci)) != 0;
+         icalcompiter_next(&ci)) {
+        mask = 0;
+        xfical_mark_calendar_from_component(&mask, c, key/12, key%12+1);
+        if (mask)
+            g_hash_table_insert(month_cache, c, GUINT_TO_POINTER(mask));
+    }
+}
+
+static GHashTable *mark_cache_month(gint key, gboolean build)
+{
+#undef P_N
+#define P_N "mark_cache_month: "
+    GHashTable *month_cache;
+    gint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    if (mark_cache == NULL) {
+        if (!build)
+            return(NULL);
+        mark_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal
+                , NULL, (GDestroyNotify)g_hash_table_destroy);
+    }
+    month_cache = g_hash_table_lookup(mark_cache, GINT_TO_POINTER(key));
+    if (month_cache == NULL && build) {
+        month_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+        mark_cache_file(month_cache, ic_ical, key);
+        for (i = 0; i < g_par.foreign_count; i++)
+            mark_cache_file(month_cache, ic_f_ical[i].ical, key);
+        g_hash_table_insert(mark_cache, GINT_TO_POINTER(key), month_cache);
+    }
+    return(month_cache);
+}
+
+static void mark_cache_add_month(gpointer key, gpointer value
+        , gpointer c)
+{
+    guint32 mask = 0;
+
+    xfical_mark_calendar_from_component(&mask, (icalcomponent *)c
+            , GPOINTER_TO_INT(key)/12, GPOINTER_TO_INT(key)%12+1);
+    if (mask)
+        g_hash_table_insert((GHashTable *)value, c, GUINT_TO_POINTER(mask));
+    else
+        g_hash_table_remove((GHashTable *)value, c);
+}
+
+static void mark_cache_add(icalcomponent *base, icalcomponent *c)
+{
+    /* archive file is not shown in the calendar */
+    if (mark_cache != NULL && mark_cache_base(base))
+        g_hash_table_foreach(mark_cache, mark_cache_add_month, c);
+}
+
+static void mark_cache_remove_month(gpointer key, gpointer value
+        , gpointer c)
+{
+    g_hash_table_remove((GHashTable *)value, c);
+}
+
+static void mark_cache_remove(icalcomponent *c)
+{
+    if (mark_cache != NULL)
+        g_hash_table_foreach(mark_cache, mark_cache_remove_month, c);
+}
+
+static void mark_cache_add_file_month(gpointer key, gpointer value
+        , gpointer base)
+{
+    mark_cache_file((GHashTable *)value, (icalcomponent *)base
+            , GPOINTER_TO_INT(key));
+}
+
+/* base has just been read, add its marks to the months we already have */
+static void mark_cache_add_file(icalcomponent *base)
+{
+    if (mark_cache != NULL && base != NULL)
+        g_hash_table_foreach(mark_cache, mark_cache_add_file_month, base);
+}
+
+static gboolean mark_cache_in_file(gpointer c, gpointer mask
+        , gpointer base)
+{
+    return(icalcomponent_get_parent((icalcomponent *)c) == base);
+}
+
+static void mark_cache_remove_file_month(gpointer key, gpointer value
+        , gpointer base)
+{
+    g_hash_table_foreach_remove((GHashTable *)value, mark_cache_in_file
+            , base);
+}
+
+/* base is going to be freed, forget its marks but keep the other files */
+static void mark_cache_remove_file(icalcomponent *base)
+{
+    if (mark_cache != NULL && base != NULL)
+        g_hash_table_foreach(mark_cache, mark_cache_remove_file_month, base);
+}
+
+static void mark_cache_free(void)
+{
+    if (mark_cache != NULL) {
+        g_hash_table_destroy(mark_cache);
+        mark_cache = NULL;
+    }
+}
+
+static gboolean mark_cache_too_far(gpointer key, gpointer value
+        , gpointer shown)
+{
+    return(ABS(GPOINTER_TO_INT(key) - GPOINTER_TO_INT(shown)) 
+            > MARK_CACHE_MONTHS);
+}
+
+static void mark_cache_or(gpointer c, gpointer mask, gpointer total)
+{
+    *(guint32 *)total |= GPOINTER_TO_UINT(mask);
+}
+
+/* fill one neighbour month per call so that we do not block the gui */
+static gboolean mark_cache_idle(gpointer user_data)
+{
+#undef P_N
+#define P_N "mark_cache_idle: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    /* files may have been closed after marking; we do not reopen them
+     * here but wait until the next xfical_mark_calendar */
+    if (ic_ical != NULL) {
+        if (!mark_cache_month(mark_cache_shown+1, FALSE)) {
+            mark_cache_month(mark_cache_shown+1, TRUE);
+            return(TRUE);
+        }
+        if (!mark_cache_month(mark_cache_shown-1, FALSE)) {
+            mark_cache_month(mark_cache_shown-1, TRUE);
+            return(TRUE);
+        }
+    }
+    mark_cache_idle_id = 0;
+    return(FALSE);
 }
 
 void xfical_mark_calendar(GtkCalendar *gtkcal)
 {
 #undef P_N
 #define P_N "xfical_mark_calendar: "
-    gint i;
     guint year, month, day;
+    guint32 mask = 0;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
     gtk_calendar_get_date(gtkcal, &year, &month, &day);
-    gtk_calendar_clear_marks(gtkcal);
-    xfical_mark_calendar_file(gtkcal, ic_ical, year, month+1);
-    for (i = 0; i < g_par.foreign_count; i++) {
-        xfical_mark_calendar_file(gtkcal, ic_f_ical[i].ical, year, month+1);
-    }
+    mark_cache_shown = year*12+month; /* gtk month is 0...11 */
+    g_hash_table_foreach(mark_cache_month(mark_cache_shown, TRUE)
+            , mark_cache_or, &mask);
+    mark_calendar_apply(gtkcal, mask);
+    g_hash_table_foreach_remove(mark_cache, mark_cache_too_far
+            , GINT_TO_POINTER(mark_cache_shown));
+    if (!mark_cache_idle_id)
+        mark_cache_idle_id = g_idle_add(mark_cache_idle, NULL);
+}
+
+/* Appointment data shared by all occurrences of one component in
+ * xfical_get_each_app_within_time results. appt must be the first member
+ * so that the last xfical_occurrence_free can use xfical_appt_free. */
+typedef struct _shared_appt
+{
+    xfical_appt appt;
+    gint ref_count; /* occurrences using this appt */
+} shared_appt;
+
+typedef struct _app_data
+{
+    GList **list;
+    gchar *file_type;
+    /* Need to check that returned value is withing limits.
+       Check more from BUG 5764 and 7886. */
+    gchar asdate[17], aedate[17];
+    gint orig_start_hour, orig_end_hour;
+    GHashTable *shared; /* icalcomponent -> shared_appt */
+    icalcomponent *orig_c; /* real component when called with a clone */
+} app_data;
+
+void xfical_occurrence_free(xfical_occurrence *occ)
+{
+#undef P_N
+#define P_N "xfical_occurrence_free: "
+    shared_appt *shared;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (!occ)
+        return;
+    shared = (shared_appt *)occ->appt;
+    if (--shared->ref_count == 0)
+        xfical_appt_free(occ->appt);
+    g_free(occ);
+}
+
+/* free appointments which did not get any occurrence in the period */
+static void shared_appt_free_unused(gpointer c, gpointer value
+        , gpointer user_data)
+{
+    shared_appt *shared = (shared_appt *)value;
+
+    if (shared->ref_count == 0)
+        xfical_appt_free(&shared->appt);
 }
 
 /* note that this not understand timezones, but gets always raw time,
@@ -3763,20 +5099,12 @@ static void add_appt_to_list(icalcomponent *c, icaltime_span *span , void *data)
 #undef P_N
 #define P_N "add_appt_to_list: "
     xfical_appt *appt;
+    xfical_occurrence *occ;
+    shared_appt *shared;
+    icalcomponent *key;
     struct icaltimetype sdate, edate;
     struct tm start_tm, end_tm;
-    time_t temp_t;
-    gboolean key_found;
     icalproperty *p = NULL;
-    typedef struct _app_data
-    {
-        GList **list;
-        gchar *file_type;
-        /* Need to check that returned value is withing limits.
-           Check more from BUG 5764 and 7886. */
-        gchar asdate[17], aedate[17];
-        gint orig_start_hour, orig_end_hour;
-    } app_data;
     app_data *data1;
         /* Need to check that returned value is withing limits.
            Check more from BUG 5764 and 7886. */
@@ -3786,11 +5114,18 @@ static void add_appt_to_list(icalcomponent *c, icaltime_span *span , void *data)
     orage_message(-100, P_N);
 #endif
     data1 = (app_data *)data;
-    appt = g_new0(xfical_appt, 1);
-    /* FIXME: we could check if UID is the same and only get all data
-     * when UID changes. This seems to be fast enough as it is though */
-    key_found = get_appt_from_icalcomponent(c, appt);
-    xfical_appt_get_fill_internal(appt, data1->file_type);
+    /* BUG 7929. see xfical_get_each_app_within_time_internal */
+    p = icalcomponent_get_first_property(c, ICAL_DTSTART_PROPERTY);
+    data1->orig_start_hour = icalproperty_get_dtstart(p).hour;
+    /* read the appointment only once and share it between occurrences */
+    key = data1->orig_c ? data1->orig_c : c;
+    if ((shared = g_hash_table_lookup(data1->shared, key)) == NULL) {
+        shared = g_new0(shared_appt, 1);
+        get_appt_from_icalcomponent(c, &shared->appt);
+        xfical_appt_get_fill_internal(&shared->appt, data1->file_type);
+        g_hash_table_insert(data1->shared, key, shared);
+    }
+    appt = &shared->appt;
     gmtime_r(&span->start, &start_tm);
     gmtime_r(&span->end, &end_tm);
     /*
@@ -3841,11 +5176,11 @@ static void add_appt_to_list(icalcomponent *c, icaltime_span *span , void *data)
     sdate = icaltime_convert_to_zone(sdate, local_icaltimezone);
     edate = icaltime_convert_to_zone(edate, local_icaltimezone);
 
-
-    strncpy(appt->starttimecur, icaltime_as_ical_string(sdate), 16);
-    appt->starttimecur[16] = '\0';
-    strncpy(appt->endtimecur, icaltime_as_ical_string(edate), 16);
-    appt->endtimecur[16] = '\0';
+    occ = g_new(xfical_occurrence, 1);
+    strncpy(occ->starttimecur, icaltime_as_ical_string(sdate), 16);
+    occ->starttimecur[16] = '\0';
+    strncpy(occ->endtimecur, icaltime_as_ical_string(edate), 16);
+    occ->endtimecur[16] = '\0';
     /*
             */
         /* Need to check that returned value is withing limits.
@@ -3864,19 +5199,49 @@ static void add_appt_to_list(icalcomponent *c, icaltime_span *span , void *data)
             );
     }
     */
-    if (strncmp(appt->endtimecur, data1->asdate, 16) <= 0
-    || strncmp(appt->starttimecur, data1->aedate, 16) >= 0) {
-        /* we do not need this. Free the memory */
-        xfical_appt_free(appt);
+    if (strncmp(occ->endtimecur, data1->asdate, 16) <= 0
+    || strncmp(occ->starttimecur, data1->aedate, 16) >= 0) {
+        /* we do not need this. The appointment itself is freed after
+         * the query if no other occurrence uses it */
+        g_free(occ);
     } 
     else {/* add to list like with internal libical */
-        *data1->list = g_list_prepend(*data1->list, appt);
+        occ->start = icaltime_as_timet_with_zone(sdate, utc_icaltimezone);
+        occ->end = icaltime_as_timet_with_zone(edate, utc_icaltimezone);
+        occ->appt = appt;
+        shared->ref_count++;
+        *data1->list = g_list_prepend(*data1->list, occ);
     } 
 }
 
+/* FIXME: hack to fix year to be newer than 1970 based on BUG 9507 */
+static void foreach_recurrence_before_1970(icalcomponent *c
+        , struct icaltimetype asdate, struct icaltimetype aedate
+        , app_data *data)
+{
+#undef P_N
+#define P_N "foreach_recurrence_before_1970: "
+    icalcomponent *c2;
+    icalproperty *p;
+    struct icaltimetype start;
+
+    c2 = icalcomponent_new_clone(c);
+    p = icalcomponent_get_first_property(c2, ICAL_DTSTART_PROPERTY);
+    start = icalproperty_get_dtstart(p);
+    orage_message(-10, P_N "Adjusting temporarily old DTSTART time %d"
+            , start.year);
+    start.year = 1970;
+    icalproperty_set_dtstart(p, start);
+    data->orig_c = c; /* c2 is freed below, so share by c */
+    icalcomponent_foreach_recurrence(c2, asdate, aedate
+            , add_appt_to_list, (void *)data);
+    data->orig_c = NULL;
+    icalcomponent_free(c2);
+}
+
 /* Fetch each appointment within the specified time period and add those
- * to the data GList. Note that each repeating appointment is real full 
- * appt */
+ * to the data GList as xfical_occurrence. Each repeating appointment
+ * gets its own occurrence, but they all share the same appt */
 static void xfical_get_each_app_within_time_internal(char *a_day, gint days
         , xfical_type type, icalcomponent *base, gchar *file_type, GList **data)
 {
@@ -3885,18 +5250,9 @@ static void xfical_get_each_app_within_time_internal(char *a_day, gint days
     struct icaltimetype asdate, aedate;    /* period to check */
     icalcomponent *c=NULL;
     icalcomponent_kind ikind = ICAL_VEVENT_COMPONENT;
-    icalcomponent *c2=NULL;
     icalproperty *p = NULL;
     struct icaltimetype start;
-    typedef struct _app_data
-    {
-        GList **list;
-        gchar *file_type;
-        /* Need to check that returned value is withing limits.
-           Check more from BUG 5764 and 7886. */
-        gchar asdate[17], aedate[17];
-        gint orig_start_hour, orig_end_hour;
-    } app_data;
+    GList *unindexed, *l;
     app_data data1;
 
 #ifdef ORAGE_DEBUG
@@ -3918,6 +5274,8 @@ static void xfical_get_each_app_within_time_internal(char *a_day, gint days
 
     data1.list = data;
     data1.file_type = file_type;
+    data1.shared = g_hash_table_new(g_direct_hash, g_direct_equal);
+    data1.orig_c = NULL;
         /* Need to check that returned value is withing limits.
            Check more from BUG 5764 and 7886. */
     g_strlcpy((char *)&data1.asdate, icaltime_as_ical_string(asdate), 17);
@@ -3928,45 +5286,34 @@ static void xfical_get_each_app_within_time_internal(char *a_day, gint days
        due to UTC conversion. (And drop those days later then.) */
     icaltime_adjust(&asdate, -1, 0, 0, 0);
     icaltime_adjust(&aedate, 1, 0, 0, 0);
-    for (c = icalcomponent_get_first_component(base, ikind);
-         c != 0;
-         c = icalcomponent_get_next_component(base, ikind)) {
-        /* BUG 7929. If calendar file contains same timezone definition than
-           what the time is in, libical returns wrong time in span.
-           But as the hour only changes with HOURLY repeating appointments,
-           we can replace received hour with the hour from start time */
-        /*
-        p = icalcomponent_get_first_property(c, ICAL_DTEND_PROPERTY);
-            if (p != NULL) {
-        start = icalproperty_get_dtend(p);
-        data1.orig_end_hour = start.hour;
-            }
-            else {
-                g_print("NULL ***********\n");
-            }
-            g_print("ORIG END HOUR %d ***********\n", data1.orig_end_hour);
-            */
-        p = icalcomponent_get_first_property(c, ICAL_DTSTART_PROPERTY);
-        start = icalproperty_get_dtstart(p);
-        data1.orig_start_hour = start.hour;
-        /* FIXME: hack to fix year to be newer than 1970 based on BUG 9507 */
-        if (start.year < 1970) {
-            c2 = icalcomponent_new_clone(c);
-            p = icalcomponent_get_first_property(c2, ICAL_DTSTART_PROPERTY);
-            start = icalproperty_get_dtstart(p);
-            orage_message(-10, P_N "Adjusting temporarily old DTSTART time %d"
-                    , start.year);
-            start.year = 1970;
-            icalproperty_set_dtstart(p, start);
-            icalcomponent_foreach_recurrence(c2, asdate, aedate
-                    , add_appt_to_list, (void *)&data1);
+    if (occ_index_foreach(base, ikind, asdate, aedate
+                , add_appt_to_list, (void *)&data1, &unindexed)) {
+        for (l = unindexed; l != NULL; l = g_list_next(l)) {
+            c = (icalcomponent *)l->data;
+            if (icalcomponent_isa(c) == ikind)
+                foreach_recurrence_before_1970(c, asdate, aedate, &data1);
         }
-        /* FIXME: end of hack */
-        else {
-            icalcomponent_foreach_recurrence(c, asdate, aedate
-                    , add_appt_to_list, (void *)&data1);
+    }
+    else { /* too long period for the occurrence index */
+        for (c = icalcomponent_get_first_component(base, ikind);
+             c != 0;
+             c = icalcomponent_get_next_component(base, ikind)) {
+            /* BUG 7929. If calendar file contains same timezone definition
+               than what the time is in, libical returns wrong time in span.
+               But as the hour only changes with HOURLY repeating
+               appointments, we can replace received hour with the hour
+               from start time. add_appt_to_list reads it from DTSTART */
+            p = icalcomponent_get_first_property(c, ICAL_DTSTART_PROPERTY);
+            start = icalproperty_get_dtstart(p);
+            if (start.year < 1970)
+                foreach_recurrence_before_1970(c, asdate, aedate, &data1);
+            else
+                icalcomponent_foreach_recurrence(c, asdate, aedate
+                        , add_appt_to_list, (void *)&data1);
         }
     }
+    g_hash_table_foreach(data1.shared, shared_appt_free_unused, NULL);
+    g_hash_table_destroy(data1.shared);
 }
 
 /* This will (probably) replace xfical_appt_get_next_on_day */
@@ -4004,290 +5351,115 @@ void xfical_get_each_app_within_time(char *a_day, gint days
     }
 }
 
-/* let's find next VEVENT or VTODO or VJOURNAL BEGIN or END
- * We rely that str is either BEGIN: or END: to show if we search the
- * beginning or the end */
-static gchar *find_next(gchar *cur, gchar *end, gchar *str)
+/* one found appointment and how well it matched, for sorting the results
+ * best first */
+typedef struct _search_result
 {
-#undef P_N
-#define P_N "find_next: "
-    gchar *next;
-    gboolean found_valid = FALSE;
-
-#ifdef ORAGE_DEBUG
-    orage_message(-300, P_N);
-#endif
-    next = cur;
-    do {
-        next = g_strstr_len(next, end-next, str);
-        if (next) {
-         /* we found it. Need to check that it is valid.
-          * First skip BEGIN: or END: and point to the component type */
-            next += strlen(str);
-            if (g_str_has_prefix(next, "VEVENT\n")
-            ||  g_str_has_prefix(next, "VEVENT\r\n")
-            ||  g_str_has_prefix(next, "VTODO\n")
-            ||  g_str_has_prefix(next, "VTODO\r\n")
-            ||  g_str_has_prefix(next, "VJOURNAL\n")
-            ||  g_str_has_prefix(next, "VJOURNAL\r\n"))
-                found_valid = TRUE;
-        }
-    } while (next && !found_valid);
-    return(next);
-}
+    xfical_appt *appt;
+    gint score;
+} search_result;
 
-/* find the last str before cur. start from beg.
- * Idea is to find str, which is actually always BEGIN:
- * and then check that it is the beginning of VEVENT/VTODO/VJOURNAL
- * if it is not, repeat search, but move cur up to found string by
- * making len (prev-beg) smaller
- */
-static gchar *find_prev(gchar *beg, gchar *cur, gchar *str)
+static gint search_result_order(gconstpointer a, gconstpointer b)
 {
-#undef P_N
-#define P_N "find_prev: "
-    gchar *prev;
-    gboolean found_valid = FALSE;
+    const search_result *ra = a, *rb = b;
 
-#ifdef ORAGE_DEBUG
-    orage_message(-300, P_N);
-#endif
-    prev = cur;
-    do {
-         prev = g_strrstr_len(beg, prev-beg, str);
-         if (prev) {
-         /* we found it. Need to check that it is valid.
-          * First skip BEGIN: or END: and point to the component type */
-            prev += strlen(str);
-            if (g_str_has_prefix(prev, "VEVENT\n")
-            ||  g_str_has_prefix(prev, "VEVENT\r\n")
-            ||  g_str_has_prefix(prev, "VTODO\n")
-            ||  g_str_has_prefix(prev, "VTODO\r\n")
-            ||  g_str_has_prefix(prev, "VJOURNAL\n")
-            ||  g_str_has_prefix(prev, "VJOURNAL\r\n"))
-                found_valid = TRUE;
-            else
-                prev -= strlen(str);
-         }
-    } while (prev && !found_valid);
-    return(prev);
-}
-
- /* Read next EVENT/TODO/JOURNAL which contains the specified string 
-  * from ical datafile.
-  * str:     string to search
-  * first:   get first appointment is TRUE, if not get next.
-  * returns: NULL if failed.
-  *          xfical_appt pointer to xfical_appt struct filled with data if 
-  *          successfull. 
-  *          You must deallocate the appt after the call
-  */
-static xfical_appt *xfical_appt_get_next_with_string_internal(char *str
-        , gboolean first, char *search_file, icalcomponent *base
+    if (ra->score != rb->score)
+        return(rb->score - ra->score);
+    return(strcmp(ra->appt->starttimecur, rb->appt->starttimecur));
+}
+
+static void search_file(GArray *results, char *str, icalcomponent *base
         , gchar *file_type)
 {
 #undef P_N
-#define P_N "xfical_appt_get_next_with_string_internal: "
-    static gchar *text_upper, *text, *beg, *end;
-    static gboolean upper_text;
-    gchar *cur, *tmp, mem;
-    gsize text_len, len;
-    char *uid, ical_uid[XFICAL_UID_LEN+1];
+#define P_N "search_file: "
+    GArray *hits;
+    GHashTable *found;
+    ic_search_hit *hit;
+    search_result result;
     xfical_appt *appt;
-    gboolean found_valid, search_done = FALSE;
     struct icaltimetype it;
     const char *stime;
+    char *uid;
+    guint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    if (!ORAGE_STR_EXISTS(str))
-        return(NULL);
-    if (first) {
-        if (!g_file_get_contents(search_file, &text, &text_len, NULL)) {
-            orage_message(250, P_N "Could not open Orage ical file (%s)", search_file);
-            return(NULL);
-        }
-        text_upper = g_utf8_strup(text, -1);
-        if (text_len == strlen(text_upper)) {
-            /* we can do upper case search since uppercase and original
-             * string have same format. In other words we can find UID since
-             * it starts in the same place in both strings (not 100 % sure, 
-             * but works reliable enough until somebody files a bug...) */
-            end = text_upper+text_len;
-            beg = find_next(text_upper, end, "\nBEGIN:");
-            upper_text = TRUE;
-        }
-        else { /* sorry, has to settle for normal comparison */
-        /* let's find first BEGIN:VEVENT or BEGIN:VTODO or BEGIN:VJOURNAL
-         * to start our search */
-            end = text+text_len;
-            beg = find_next(text, end, "\nBEGIN:");
-            upper_text = FALSE;
-            orage_message(90, P_N "Can not do case independent comparison (%d/%d)"
-                    , text_len, strlen(text_upper));
-        }
-        if (!beg) {
-        /* the file can actually be empty and not have any events, so this
-           may be quite ok */
-            if (text_len > 100)
-                orage_message(50, P_N "Could not find initial BEGIN:V-type from Orage ical file (%s). Maybe file is empty."
-                    , search_file);
-            return(NULL);
-        }
-        beg -= strlen("\nBEGIN:"); /* we need to be able to find first, too */
-        first = FALSE;
-    }
-
-    if (!first) {
-        for (cur = g_strstr_len(beg, end-beg, str), found_valid = FALSE; 
-             cur && !found_valid; ) {
-            /* We have found a match, let's check that it is valid. 
-             * We only accept SUMMARY, DESCRIPTION and LOCATION ical strings
-             * to be valid. */
-            /* First we need to find the beginning of our row */
-            /* FIXME: this does not work if description has line changes */
-            for (tmp = cur; tmp > beg && *tmp != '\n'; tmp--)
-                ;
-            tmp++; /* skip the '\n' */
-            /* Then let's check that it is valid. Mark the end temporarily. */
-            mem = *cur;
-            *cur = '\0';
-            /* FIXME: vcs files may contain charset like this:
-             * SUMMARY;CHARSET=UTF-8:Text of summary
-             * so matching to : is not ok 
-             */
-            if (g_str_has_prefix(tmp, "SUMMARY")
-            ||  g_str_has_prefix(tmp, "DESCRIPTION")
-            ||  g_str_has_prefix(tmp, "LOCATION")) 
-                found_valid = TRUE;
-            *cur = mem;
-            if (!found_valid) {
-                cur++;
-                cur = g_strstr_len(cur, end-cur, str);
-            }
+    hits = ic_search_index_query(base, str);
+    /* overridden recurrences have the same uid as their base event */
+    found = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < hits->len; i++) {
+        hit = &g_array_index(hits, ic_search_hit, i);
+        uid = (char *)icalcomponent_get_uid(hit->c);
+        if (!ORAGE_STR_EXISTS(uid) || g_hash_table_lookup(found, uid))
+            continue;
+        g_hash_table_insert(found, uid, uid);
+        if ((appt = appt_get_any(uid, base, file_type)) == NULL) {
+            orage_message(150, P_N "UID not found in ical file %s", uid);
+            continue;
         }
-        if (!cur) {
-            search_done = TRUE;
+        if (strcmp(g_par.local_timezone, "floating") == 0) {
+            g_strlcpy(appt->starttimecur, appt->starttime, 17);
+            g_strlcpy(appt->endtimecur, appt->endtime, 17);
         }
         else {
-            /* first find ^BEGIN:<type> which shows the start 
-             * of the component.
-             * then find UID: and get the appointment and finally locate the
-             * ^END:<type> and setup search for he next time 
-             */
-            beg = find_prev(beg, cur, "\nBEGIN:");
-            if (!beg) {
-                orage_message(250, P_N "BEGIN:V-type not found %s", str);
-                search_done = TRUE;
-            }
-            else {
-                uid = g_strstr_len(beg, end-beg, "UID:");
-                if (!uid) {
-                    orage_message(150, P_N "UID not found %s", str);
-                    search_done = TRUE;
-                }
-                else {
-                    if (upper_text) {
-                        /* we need to take UID from the original text, which
-                         * has not been converted to upper case */
-                        len = uid-text_upper;
-                        tmp = text+len;
-                        sscanf(tmp, "UID:%sXFICAL_UID_LEN", ical_uid);
-                    }
-                    else
-                        sscanf(uid, "UID:%sXFICAL_UID_LEN", ical_uid);
-                    if (strlen(ical_uid) > XFICAL_UID_LEN-2) {
-                        orage_message(250, P_N "too long UID %s", ical_uid);
-                        return(NULL);
-                    }
-                    appt = appt_get_any(ical_uid, base, file_type);
-                    if (!appt) {
-                        orage_message(150, P_N "UID not found in ical file %s", ical_uid);
-                        search_done = TRUE;
-                    }
-                    else {
-                        if (strcmp(g_par.local_timezone, "floating") == 0) {
-                            g_strlcpy(appt->starttimecur, appt->starttime, 17);
-                            g_strlcpy(appt->endtimecur, appt->endtime, 17);
-                        }
-                        else {
-                            it = icaltime_from_string(appt->starttime);
-                            it = convert_to_zone(it, appt->start_tz_loc);
-                            it = icaltime_convert_to_zone(it
-                                    , local_icaltimezone);
-                            stime = icaltime_as_ical_string(it);
-                            g_strlcpy(appt->starttimecur, stime, 17);
-                            it = icaltime_from_string(appt->endtime);
-                            it = convert_to_zone(it, appt->end_tz_loc);
-                            it = icaltime_convert_to_zone(it
-                                    , local_icaltimezone);
-                            stime = icaltime_as_ical_string(it);
-                            g_strlcpy(appt->endtimecur, stime, 17);
-                        }
-                        beg = find_next(uid, end, "\nEND:");
-                        if (!beg) {
-                            orage_message(250, P_N "END:V-type not found %s", str);
-                            search_done = TRUE;
-                        }
-                        else {
-                            return(appt);
-                        }
-                    }
-                }
-            }
+            it = icaltime_from_string(appt->starttime);
+            it = convert_to_zone(it, appt->start_tz_loc);
+            it = icaltime_convert_to_zone(it, local_icaltimezone);
+            stime = icaltime_as_ical_string(it);
+            g_strlcpy(appt->starttimecur, stime, 17);
+            it = icaltime_from_string(appt->endtime);
+            it = convert_to_zone(it, appt->end_tz_loc);
+            it = icaltime_convert_to_zone(it, local_icaltimezone);
+            stime = icaltime_as_ical_string(it);
+            g_strlcpy(appt->endtimecur, stime, 17);
         }
+        result.appt = appt;
+        result.score = hit->score;
+        g_array_append_val(results, result);
     }
-
-    g_free(text);
-    g_free(text_upper);
-    if (!search_done) {
-        orage_message(250, P_N "illegal ending %s", str);
-    }
-    return(NULL);
+    g_hash_table_destroy(found);
+    g_array_free(hits, TRUE);
 }
 
- /* Read next EVENT/TODO/JOURNAL which contains the specified string 
-  * from ical datafile.
-  * str:     string to search
-  * first:   get first appointment is TRUE, if not get next.
-  * returns: NULL if failed.
-  *          xfical_appt pointer to xfical_appt struct filled with data if 
-  *          successfull. 
-  *          You must deallocate the appt after the call
+ /* Find EVENTs/TODOs/JOURNALs which contain all words of str in their
+  * summary, location, categories or description. Words of str may also
+  * be beginnings of words in the appointment.
+  * Searches the Orage file, all foreign files and the archive file when
+  * it is open. Files must be open.
+  * returns: list of xfical_appt, best match first.
+  *          You must deallocate the appts and the list after the call.
   */
-xfical_appt *xfical_appt_get_next_with_string(char *str, gboolean first
-        , gchar *file_type)
+GList *xfical_appt_search(char *str)
 {
 #undef P_N
-#define P_N "xfical_appt_get_next_with_string: "
+#define P_N "xfical_appt_search: "
+    GArray *results;
+    GList *appts = NULL;
+    gchar file_type[8];
     gint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    if (file_type[0] == 'O') {
-        return(xfical_appt_get_next_with_string_internal(str, first
-                , g_par.orage_file , ic_ical, file_type));
+    if (!ORAGE_STR_EXISTS(str))
+        return(NULL);
+    results = g_array_new(FALSE, FALSE, sizeof(search_result));
+    strcpy(file_type, "O00.");
+    search_file(results, str, ic_ical, file_type);
+    for (i = 0; i < g_par.foreign_count; i++) {
+        g_sprintf(file_type, "F%02d.", i);
+        search_file(results, str, ic_f_ical[i].ical, file_type);
     }
 #ifdef HAVE_ARCHIVE
-    else if (file_type[0] == 'A') {
-        return(xfical_appt_get_next_with_string_internal(str, first
-                , g_par.archive_file, ic_aical, file_type));
-    }
+    strcpy(file_type, "A00.");
+    search_file(results, str, ic_aical, file_type);
 #endif
-    else if (file_type[0] == 'F') {
-        sscanf(file_type, "F%02d", &i);
-        if (i < g_par.foreign_count && ic_f_ical[i].ical != NULL)
-            return(xfical_appt_get_next_with_string_internal(str, first
-                    , g_par.foreign_data[i].file, ic_f_ical[i].ical, file_type));
-        else {
-            orage_message(250, P_N "unknown foreign file number %s", file_type);
-            return(NULL);
-        }
-    }
-    else {
-        orage_message(250, P_N "unknown file type");
-        return(NULL);
-    }
+    g_array_sort(results, search_result_order);
+    for (i = results->len; i > 0; i--)
+        appts = g_list_prepend(appts
+                , g_array_index(results, search_result, i-1).appt);
+    g_array_free(results, TRUE);
+    return(appts);
 }
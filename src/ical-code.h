@@ -131,11 +131,27 @@ typedef struct _xfical_appt
     GList  *recur_exceptions; /* EXDATE and RDATE list xfical_exception */
 } xfical_appt;
 
+/* One occurrence of an appointment returned by
+ * xfical_get_each_app_within_time. appt is shared by all occurrences
+ * of the same appointment and must not be modified or freed directly;
+ * its starttimecur and endtimecur are not set. Use xfical_appt_get
+ * to get a full copy of the appointment. */
+typedef struct _xfical_occurrence
+{
+    time_t start;            /* occurrence start and end, seconds in UTC */
+    time_t end;
+    gchar  starttimecur[17]; /* same in local timezone */
+    gchar  endtimecur[17];
+    xfical_appt *appt;
+} xfical_occurrence;
+
 gboolean xfical_set_local_timezone(gboolean testing);
 
 gboolean xfical_file_open(gboolean foreign);
 void xfical_file_close(gboolean foreign);
 void xfical_file_close_force(void);
+void xfical_file_reload(gint foreign);
+void xfical_change_log_compact(void);
 
 xfical_appt *xfical_appt_alloc();
 char *xfical_appt_add(char *ical_file_id, xfical_appt *appt);
@@ -146,23 +162,27 @@ gboolean xfical_appt_del(char *ical_id);
 
 xfical_appt *xfical_appt_get_next_on_day(char *a_day, gboolean first, gint days
         , xfical_type type,  gchar *file_type);
-xfical_appt *xfical_appt_get_next_with_string(char *str, gboolean first
-        , gchar *file_type);
+GList *xfical_appt_search(char *str);
 void xfical_get_each_app_within_time(char *a_day, int days
         , xfical_type type, gchar *file_type , GList **data);
+void xfical_occurrence_free(xfical_occurrence *occ);
 
 void xfical_mark_calendar(GtkCalendar *gtkcal);
 void xfical_mark_calendar_recur(GtkCalendar *gtkcal, xfical_appt *appt);
 
 void xfical_alarm_build_list(gboolean first_list_today);
+void xfical_alarm_refresh_uid(char *ext_uid);
 
 int xfical_compare_times(xfical_appt *appt);
 #ifdef HAVE_ARCHIVE
 gboolean xfical_archive_open(void);
+gboolean xfical_archive_open_period(char *a_day, gint days, xfical_type type);
 void xfical_archive_close(void);
 gboolean xfical_archive(void);
 gboolean xfical_unarchive(void);
 gboolean xfical_unarchive_uid(char *uid);
+gboolean xfical_archive_copy(gchar *new_file, gboolean move);
+gboolean xfical_archive_check(gchar *file);
 #endif
 
 gboolean xfical_import_file(char *file_name);
@@ -94,145 +94,159 @@ static gboolean add_event(icalcomponent *c)
         g_free(uid);
 
     }
-    if (!xfical_file_open(FALSE)) {
-        orage_message(250, P_N "ical file open failed");
-        return(FALSE);
-    }
+    /* main file is open and it is committed only once after all
+     * events have been added. See xfical_import_file */
     icalcomponent_add_component(ic_ical, ca);
-    ic_file_modified = TRUE;
-    icalset_mark(ic_fical);
-    icalset_commit(ic_fical);
-    xfical_file_close(FALSE);
+    ic_uid_index_add(ic_ical, ca);
     return(TRUE);
 }
 
+/* Absolute timezone in a TZID parameter. At least evolution uses them.
+ * We assume format has /xxx/xxx/timezone and we should remove the
+ * extra /xxx/xxx/ from it. tzid points to the value of the parameter
+ * (after the quote if it is quoted) and end to the end of the line.
+ * returns: start of the real timezone name or NULL if not found */
+static gchar *pre_format_tzid(gchar *tzid, gchar *end)
+{
+    gchar *p;
+    gint slashes = 0;
+
+    for (p = tzid; p < end && *p != ':' && *p != ';' && *p != '"'; p++) {
+        if (*p == '/' && ++slashes == 3)
+            return(p+1);
+    }
+    return(NULL);
+}
+
 /* pre process the file to rule out some features, which orage does not
- * support so that we can do better conversion 
- */
-static gboolean pre_format(char *file_name_in, char *file_name_out)
+ * support so that we can do better conversion. 
+ * Everything is done in one pass over the text, line by line:
+ * - check that the text is utf8
+ * - change DCREATED to CREATED
+ * - change absolute timezones into libical format
+ * Lines only get shorter, so the text is rewritten in place.
+ * returns: the converted text, which must be freed, or NULL if failed */
+static gchar *pre_format(char *file_name)
 {
 #undef P_N
 #define P_N "pre_format: "
-    gchar *text, *tmp, *tmp2, *tmp3;
-    gsize text_len;
+    gchar *text, *line, *end, *next, *out, *tzid, *tz;
+    gsize text_len, len;
     GError *error = NULL;
+    gint cnt_created = 0, cnt_tzid = 0;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
     orage_message(15, _("Starting import file preprocessing"));
-    if (!g_file_get_contents(file_name_in, &text, &text_len, &error)) {
+    if (!g_file_get_contents(file_name, &text, &text_len, &error)) {
         orage_message(250, P_N "Could not open ical file (%s) error:%s"
-                , file_name_in, error->message);
+                , file_name, error->message);
         g_error_free(error);
-        return(FALSE);
-    }
-    /***** Check utf8 conformability *****/
-    if (!g_utf8_validate(text, -1, NULL)) {
-        orage_message(250, P_N "is not in utf8 format. Conversion needed.\n (Use iconv and convert it into UTF-8 and import it again.)\n");
-        return(FALSE);
-        /* we don't know the real characterset, so we can't convert
-        tmp = g_locale_to_utf8(text, -1, NULL, &cnt, NULL);
-        if (tmp) {
-            g_strlcpy(text, tmp, text_len);
-            g_free(tmp);
-        }*/
+        return(NULL);
     }
-
-    /***** 1: change DCREATED to CREATED *****/
-    for (tmp = g_strstr_len(text, text_len, "DCREATED:"); 
-         tmp != NULL;
-         tmp = g_strstr_len(tmp, strlen(tmp), "DCREATED:")) {
-        tmp2 = tmp+strlen("DCREATED:yyyymmddThhmmss");
-        if (*tmp2 == 'Z') {
-            /* it is already in UTC, so just fix the parameter name */
-            *tmp = ' ';
-        }
-        else {
-            /* needs to be converted to UTC also */
-            for (tmp3 = tmp; tmp3 < tmp2; tmp3++) {
-                *tmp3 = *(tmp3+1); 
-            }
-            *(tmp3-1) = 'Z'; /* this is 'bad'...but who cares...it is fast */
+    for (line = out = text; line < text+text_len; line = next) {
+        if ((end = memchr(line, '\n', text+text_len-line)) == NULL)
+            end = next = text+text_len;
+        else
+            next = end+1;
+        /***** Check utf8 conformability *****/
+        if (!g_utf8_validate(line, next-line, NULL)) {
+            orage_message(250, P_N "is not in utf8 format. Conversion needed.\n (Use iconv and convert it into UTF-8 and import it again.)\n");
+            g_free(text);
+            return(NULL);
         }
-        orage_message(15, _("... Patched DCREATED to be CREATED."));
-    }
 
-    /***** 2: change absolute timezones into libical format *****/
-    /* At least evolution uses absolute timezones.
-     * We assume format has /xxx/xxx/timezone and we should remove the
-     * extra /xxx/xxx/ from it */
-    for (tmp = g_strstr_len(text, text_len, ";TZID=/"); 
-         tmp != NULL;
-         tmp = g_strstr_len(tmp, strlen(tmp), ";TZID=/")) {
-        /* tmp = original TZID start
-         * tmp2 = end of line 
-         * tmp3 = current search and eventually the real tzid */
-        tmp = tmp+6; /* 6 = skip ";TZID=" */
-        if (!(tmp2 = g_strstr_len(tmp, 100, "\n"))) { /* no end of line */
-            orage_message(150, P_N "timezone patch failed 1. no end-of-line found: %s", tmp);
-            continue;
+        /***** 1: change DCREATED to CREATED *****/
+        if (g_str_has_prefix(line, "DCREATED:")) {
+            line++; /* drop the D */
+            len = strlen("CREATED:yyyymmddThhmmss");
+            if (end-line >= (gssize)len && line[len] != 'Z') {
+                /* needs to be converted to UTC also. 
+                 * this is 'bad'...but who cares...it is fast */
+                memmove(out, line, len);
+                out += len;
+                *out++ = 'Z'; /* the D we dropped makes room for Z */
+                line += len;
+            }
+            cnt_created++;
         }
-        tmp3 = tmp;
 
-        tmp3++; /* skip '/' */
-        if (!(tmp3 = g_strstr_len(tmp3, tmp2-tmp3, "/"))) { /* no more '/' */
-            orage_message(150, P_N "timezone patch failed 2. no / found: %s", tmp);
-            continue;
-        }
-        tmp3++; /* skip '/' */
-        if (!(tmp3 = g_strstr_len(tmp3, tmp2-tmp3, "/"))) { /* no more '/' */
-            orage_message(150, P_N "timezone patch failed 3. no / found: %s", tmp);
-            continue;
+        /***** 2: change absolute timezones into libical format *****/
+        while ((tzid = g_strstr_len(line, end-line, ";TZID=")) != NULL) {
+            tzid += strlen(";TZID=");
+            if (*tzid == '"')
+                tzid++;
+            len = tzid-line;
+            memmove(out, line, len);
+            out += len;
+            line = tzid;
+            if (*tzid != '/') /* normal timezone */
+                continue;
+            if ((tz = pre_format_tzid(tzid, end)) != NULL) {
+                line = tz; /* skip the extra /xxx/xxx/ */
+                cnt_tzid++;
+            }
+            else
+                orage_message(150, P_N "timezone patch failed. not enough / found: %.*s"
+                        , (int)(end-tzid), tzid);
         }
 
-        /* we found the real tzid since we came here */
-        tmp3++; /* skip '/' */
-        /* move the real tzid (=tmp3) to the beginning (=tmp) */
-        for (; tmp3 < tmp2; tmp3++, tmp++)
-            *tmp = *tmp3;
-        /* fill the end of the line with spaces */
-        for (; tmp < tmp2; tmp++)
-            *tmp = ' ';
-        orage_message(15, _("... Patched timezone to Orage format."));
+        len = next-line;
+        memmove(out, line, len);
+        out += len;
     }
-
-    /***** All done: write file *****/
-    if (!g_file_set_contents(file_name_out, text, -1, NULL)) {
-        orage_message(250, P_N "Could not write ical file (%s)", file_name_out);
-        return(FALSE);
-    }
-    g_free(text);
+    *out = '\0';
+    if (cnt_created)
+        orage_message(15, _("... Patched DCREATED to be CREATED."));
+    if (cnt_tzid)
+        orage_message(15, _("... Patched timezone to Orage format."));
     orage_message(15, _("Import file preprocessing done"));
-    return(TRUE);
+    return(text);
 }
 
 gboolean xfical_import_file(char *file_name)
 {
 #undef P_N
 #define P_N "xfical_import_file: "
-    icalset *file_ical = NULL;
-    char *ical_file_name = NULL;
-    icalcomponent *c1, *c2;
+    icalcomponent *root, *c1, *c2;
+    gchar *text;
     int cnt1 = 0, cnt2 = 0;
+    GTimer *timer;
+    gdouble secs;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    ical_file_name = g_strdup_printf("%s.orage", file_name);
-    if (!pre_format(file_name, ical_file_name)) {
-        g_free(ical_file_name);
+    timer = g_timer_new();
+    if ((text = pre_format(file_name)) == NULL) {
+        g_timer_destroy(timer);
         return(FALSE);
     }
-    if ((file_ical = icalset_new_file(ical_file_name)) == NULL) {
-        orage_message(250, P_N "Could not open ical file (%s) %s"
-                , ical_file_name, icalerror_strerror(icalerrno));
-        g_free(ical_file_name);
+    root = icalparser_parse_string(text);
+    g_free(text);
+    if (root == NULL) {
+        orage_message(250, P_N "Could not parse ical file (%s) %s"
+                , file_name, icalerror_strerror(icalerrno));
+        g_timer_destroy(timer);
+        return(FALSE);
+    }
+    if (icalcomponent_isa(root) != ICAL_XROOT_COMPONENT) {
+        /* parser got a single component, so it did not put it in XROOT */
+        c1 = root;
+        root = icalcomponent_new(ICAL_XROOT_COMPONENT);
+        icalcomponent_add_component(root, c1);
+    }
+    /* all events are added in one go and Orage file is written only once */
+    if (!xfical_file_open(FALSE)) {
+        orage_message(250, P_N "ical file open failed");
+        icalcomponent_free(root);
+        g_timer_destroy(timer);
         return(FALSE);
     }
-    for (c1 = icalset_get_first_component(file_ical);
+    for (c1 = icalcomponent_get_first_component(root, ICAL_ANY_COMPONENT);
          c1 != 0;
-         c1 = icalset_get_next_component(file_ical)) {
+         c1 = icalcomponent_get_next_component(root, ICAL_ANY_COMPONENT)) {
         if (icalcomponent_isa(c1) == ICAL_VCALENDAR_COMPONENT) {
             cnt1++;
             for (c2=icalcomponent_get_first_component(c1, ICAL_ANY_COMPONENT);
@@ -250,27 +264,34 @@ gboolean xfical_import_file(char *file_name)
                     orage_message(140, P_N "unknown component %s %s"
                             , icalcomponent_kind_to_string(
                                     icalcomponent_isa(c2))
-                            , ical_file_name);
+                            , file_name);
             }
 
         }
         else
             orage_message(140, P_N "unknown icalset component %s in %s"
                     , icalcomponent_kind_to_string(icalcomponent_isa(c1))
-                    , ical_file_name);
+                    , file_name);
+    }
+    if (cnt2) {
+        ic_file_modified = TRUE;
+        ic_change_log_commit();
     }
+    xfical_file_close(FALSE);
+    icalcomponent_free(root);
+    secs = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
     if (cnt1 == 0) {
         orage_message(150, P_N "No valid icalset components found");
-        g_free(ical_file_name);
         return(FALSE);
     }
     if (cnt2 == 0) {
         orage_message(150, P_N "No valid ical components found");
-        g_free(ical_file_name);
         return(FALSE);
     }
 
-    g_free(ical_file_name);
+    orage_message(20, _("Imported %d components from %s in %.2f seconds (%.0f components/second)")
+            , cnt2, file_name, secs, secs > 0 ? cnt2 / secs : (gdouble)cnt2);
     return(TRUE);
 }
 
@@ -303,58 +324,112 @@ static gboolean export_prepare_write_file(char *file_name)
     return(TRUE);
 }
 
+/* Export writer: components are written property by property into a
+ * buffered stream, so the exported calendar is never built in memory as
+ * one big string (icalcomponent_as_ical_string). Output is the same.
+ * Also used by archiving. */
+void ic_write_component(FILE *file, icalcomponent *c)
+{
+    const char *kind;
+    icalproperty *p;
+    icalcompiter ci;
+
+    kind = icalcomponent_kind_to_string(icalcomponent_isa(c));
+    fprintf(file, "BEGIN:%s\n", kind);
+    for (p = icalcomponent_get_first_property(c, ICAL_ANY_PROPERTY);
+         p != 0;
+         p = icalcomponent_get_next_property(c, ICAL_ANY_PROPERTY))
+        fputs(icalproperty_as_ical_string(p), file);
+    /* external iterator so that we do not disturb callers, which
+     * may be in the middle of walking the same calendar */
+    for (ci = icalcomponent_begin_component(c, ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&ci) != 0;
+         icalcompiter_next(&ci))
+        ic_write_component(file, icalcompiter_deref(&ci));
+    fprintf(file, "END:%s\n", kind);
+}
+
+#define EXPORT_BUFFER_SIZE 65536
+
+static FILE *export_open(char *file_name)
+{
+#undef P_N
+#define P_N "export_open: "
+    FILE *file;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    if (!export_prepare_write_file(file_name))
+        return(NULL);
+    if ((file = g_fopen(file_name, "w")) == NULL) {
+        orage_message(150, P_N "Could not write file (%s): %s"
+                , file_name, g_strerror(errno));
+        return(NULL);
+    }
+    setvbuf(file, NULL, _IOFBF, EXPORT_BUFFER_SIZE);
+    return(file);
+}
+
+static gboolean export_close(FILE *file, char *file_name, gboolean ok)
+{
+#undef P_N
+#define P_N "export_close: "
+
+#ifdef ORAGE_DEBUG
+    orage_message(-200, P_N);
+#endif
+    if (ferror(file))
+        ok = FALSE;
+    if (fclose(file) != 0)
+        ok = FALSE;
+    if (!ok) {
+        orage_message(150, P_N "Could not write file (%s)", file_name);
+        g_remove(file_name);
+    }
+    return(ok);
+}
+
 static gboolean export_all(char *file_name)
 {
 #undef P_N
 #define P_N "export_all: "
-    gchar *text;
-    gsize text_len;
+    FILE *file;
+    icalcompiter ci;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    if (!export_prepare_write_file(file_name))
+    if ((file = export_open(file_name)) == NULL)
         return(FALSE);
-    /* read Orage's ical file */
-    if (!g_file_get_contents(g_par.orage_file, &text, &text_len, NULL)) {
+    /* write from memory, which also has the changes in the change log */
+    if (!xfical_file_open(FALSE)) {
         orage_message(250, P_N "Could not open Orage ical file (%s)"
                 , g_par.orage_file);
-        return(FALSE);
+        return(export_close(file, file_name, FALSE));
     }
-    if (!g_file_set_contents(file_name, text, -1, NULL)) {
-        orage_message(150, P_N "Could not write file (%s)"
-                , file_name);
-        g_free(text);
-        return(FALSE);
-    }
-    g_free(text);
-    return(TRUE);
+    for (ci = icalcomponent_begin_component(
+                icalfileset_get_component(ic_fical), ICAL_ANY_COMPONENT);
+         icalcompiter_deref(&ci) != 0;
+         icalcompiter_next(&ci))
+        ic_write_component(file, icalcompiter_deref(&ci));
+    xfical_file_close(FALSE);
+    return(export_close(file, file_name, TRUE));
 }
 
 static void export_selected_uid(icalcomponent *base, gchar *uid_int
-        , icalcomponent *x_ical)
+        , FILE *file)
 {
 #undef P_N
 #define P_N "export_selected_uid: "
-    icalcomponent *c, *d;
-    gboolean key_found = FALSE;
-    gchar *uid_ical;
+    icalcomponent *c;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    key_found = FALSE;
-    for (c = icalcomponent_get_first_component(base, ICAL_ANY_COMPONENT);
-         c != 0 && !key_found;
-         c = icalcomponent_get_next_component(base, ICAL_ANY_COMPONENT)) {
-        uid_ical = (char *)icalcomponent_get_uid(c);
-        if (strcmp(uid_int, uid_ical) == 0) { /* we found our uid */
-            d = icalcomponent_new_clone(c);
-            icalcomponent_add_component(x_ical, d);
-            key_found = TRUE;
-        }
-    }
-    if (!key_found)
+    if ((c = ic_uid_index_lookup(base, uid_int)) != NULL)
+        ic_write_component(file, c);
+    else
         orage_message(150, P_N "not found %s from Orage", uid_int);
 }
 
@@ -362,54 +437,51 @@ static gboolean export_selected(char *file_name, char *uids)
 {
 #undef P_N
 #define P_N "export_selected: "
-    icalcomponent *x_ical = NULL;
-    icalset *x_fical = NULL;
+    FILE *file;
     gchar *uid, *uid_end, *uid_int;
-    gboolean more_uids;
+    gboolean ok = TRUE;
     int i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-200, P_N);
 #endif
-    if (!export_prepare_write_file(file_name))
-        return(FALSE);
     if (!ORAGE_STR_EXISTS(uids)) {
         orage_message(150, P_N "UID list is empty");
         return(FALSE);
     }
-    if (!ic_internal_file_open(&x_ical, &x_fical, file_name, FALSE, FALSE)) {
+    if ((file = export_open(file_name)) == NULL) {
         orage_message(150, P_N "Failed to create export file %s"
                 , file_name);
         return(FALSE);
     }
     if (!xfical_file_open(TRUE)) {
-        return(FALSE);
+        return(export_close(file, file_name, FALSE));
     }
 
     /* checks done, let's start the real work */
-    more_uids = TRUE;
-    for (uid = uids; more_uids; ) {
+    fputs("BEGIN:VCALENDAR\nVERSION:2.0\nPRODID:-//Xfce//Orage//EN\n", file);
+    for (uid = uids; uid != NULL && ok; ) {
+        if ((uid_end = strchr(uid, ',')) != NULL)
+            *uid_end = 0; /* uid ends here */
         if (strlen(uid) < 5) {
             orage_message(150, P_N "unknown appointment name %s", uid);
-            return(FALSE);
+            ok = FALSE;
+            break;
         }
         uid_int = uid+4;
-        uid_end = g_strstr_len((const gchar *)uid, strlen(uid), ",");
-        if (uid_end != NULL)
-            *uid_end = 0; /* uid ends here */
         /* FIXME: proper messages to screen */
         if (uid[0] == 'O') {
-            export_selected_uid(ic_ical, uid_int, x_ical);
+            export_selected_uid(ic_ical, uid_int, file);
         }
         else if (uid[0] == 'F') {
             sscanf(uid, "F%02d", &i);
             if (i < g_par.foreign_count && ic_f_ical[i].ical != NULL) {
-                export_selected_uid(ic_f_ical[i].ical, uid_int, x_ical);
+                export_selected_uid(ic_f_ical[i].ical, uid_int, file);
             }
             else {
                 orage_message(150, P_N "unknown foreign file number %d, %s"
                         , i, uid);
-                return(FALSE);
+                ok = FALSE;
             }
 
         }
@@ -417,17 +489,13 @@ static gboolean export_selected(char *file_name, char *uids)
             orage_message(150, P_N "Unknown uid type (%s)", uid);
         }
         
-        if (uid_end != NULL)  /* we have more uids */
-            uid = uid_end+1;  /* next uid starts here */
-        else
-            more_uids = FALSE;
+        /* next uid starts after the comma */
+        uid = (uid_end != NULL) ? uid_end+1 : NULL;
     }
+    fputs("END:VCALENDAR\n", file);
 
     xfical_file_close(TRUE);
-    icalset_mark(x_fical);
-    icalset_commit(x_fical);
-    icalset_free(x_fical);
-    return(TRUE);
+    return(export_close(file, file_name, ok));
 }
 
 gboolean xfical_export_file(char *file_name, int type, char *uids)
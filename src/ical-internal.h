@@ -39,12 +39,17 @@ typedef struct _foreign_ical_files
     icalcomponent *ical;
 } ic_foreign_ical_files;
 
+typedef struct _ic_search_hit
+{
+    icalcomponent *c;
+    gint score;      /* bigger is better */
+} ic_search_hit;
+
 #ifdef ICAL_MAIN
 icalset *ic_fical = NULL;
 icalcomponent *ic_ical = NULL;
 #ifdef HAVE_ARCHIVE
-icalset *ic_afical = NULL;
-icalcomponent *ic_aical = NULL;
+icalcomponent *ic_aical = NULL; /* open archive partitions */
 #endif
 gboolean ic_file_modified = FALSE; /* has any ical file been changed */
 ic_foreign_ical_files ic_f_ical[10];
@@ -52,8 +57,7 @@ ic_foreign_ical_files ic_f_ical[10];
 extern icalset *ic_fical;
 extern icalcomponent *ic_ical;
 #ifdef HAVE_ARCHIVE
-extern icalset *ic_afical;
-extern icalcomponent *ic_aical;
+extern icalcomponent *ic_aical; /* open archive partitions */
 #endif
 extern gboolean ic_file_modified; /* has any ical file been changed */
 extern ic_foreign_ical_files ic_f_ical[10];
@@ -62,10 +66,24 @@ extern ic_foreign_ical_files ic_f_ical[10];
 gboolean ic_internal_file_open(icalcomponent **p_ical
         , icalset **p_fical, gchar *file_icalpath, gboolean read_only
         , gboolean test);
+void ic_snapshot_schedule(void);
+icalcomponent *ic_uid_index_lookup(icalcomponent *base, const char *uid);
+void ic_uid_index_add(icalcomponent *base, icalcomponent *c);
+void ic_uid_index_remove(icalcomponent *base, icalcomponent *c);
+void ic_uid_index_free(icalcomponent *base);
+void ic_search_index_add(icalcomponent *base, icalcomponent *c);
+void ic_search_index_remove(icalcomponent *base, icalcomponent *c);
+void ic_search_index_free(icalcomponent *base);
+GArray *ic_search_index_query(icalcomponent *base, const char *str);
 char *ic_get_char_timezone(icalproperty *p);
 xfical_period ic_get_period(icalcomponent *c, gboolean local);
 char *ic_generate_uid(void);
 struct icaltimetype ic_convert_to_timezone(struct icaltimetype t
         , icalproperty *p);
+gboolean ic_change_log_append(gchar op, const char *uid, icalcomponent *c);
+gboolean ic_change_log_pending(void);
+void ic_change_log_replay(void);
+void ic_change_log_commit(void);
+void ic_write_component(FILE *file, icalcomponent *c);
 
 #endif /* !__ICAL_INTERNAL_H__ */
@@ -0,0 +1,397 @@
+/*      Orage - Calendar and alarm handler
+ *
+ * Copyright (c) 2005-2011 Juha Kautto  (juha at xfce.org)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+       Free Software Foundation
+       51 Franklin Street, 5th Floor
+       Boston, MA 02110-1301 USA
+
+ */
+
+/* Search index of appointment texts.
+ *
+ * For each loaded calendar (VCALENDAR component) we keep an inverted index
+ * from words of SUMMARY, LOCATION, CATEGORIES and DESCRIPTION to the
+ * events, todos and journals which contain them. Like the UID index it is
+ * built on first search and then kept up to date through
+ * ic_uid_index_add and ic_uid_index_remove, so it lives as long as the
+ * file stays in memory.
+ *
+ * Words are case folded strings of letters and digits. Every word of the
+ * search string must match the beginning of some word of the appointment.
+ * Matches are scored by the field they were found in (summary is worth
+ * most) and exact word matches count double compared to prefix matches.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <gtk/gtk.h>
+#ifdef HAVE_LIBICAL
+#include <libical/ical.h>
+#include <libical/icalss.h>
+#else
+#include <ical.h>
+#include <icalss.h>
+#endif
+
+#include "orage-i18n.h"
+#include "functions.h"
+#include "ical-code.h"
+#include "ical-internal.h"
+#include "parameters.h"
+
+
+/*
+#define ORAGE_DEBUG 1
+*/
+
+#define SEARCH_WEIGHT_SUMMARY     8
+#define SEARCH_WEIGHT_LOCATION    4
+#define SEARCH_WEIGHT_CATEGORIES  4
+#define SEARCH_WEIGHT_DESCRIPTION 1
+
+typedef struct _search_index
+{
+    GHashTable *postings; /* word -> GHashTable(comp -> weight) */
+    GHashTable *words;    /* comp -> GPtrArray of its words (postings keys) */
+    GPtrArray *sorted;    /* all words in order for prefix search.
+                           * NULL when words have changed */
+} search_index;
+
+static GHashTable *search_indexes = NULL; /* base -> search_index */
+
+static void search_words_free(GPtrArray *c_words)
+{
+    g_ptr_array_free(c_words, TRUE); /* words belong to postings */
+}
+
+static void search_index_destroy(search_index *si)
+{
+    g_hash_table_destroy(si->words);
+    g_hash_table_destroy(si->postings);
+    if (si->sorted)
+        g_ptr_array_free(si->sorted, TRUE);
+    g_free(si);
+}
+
+/* add weight of every word in text into weights (word -> weight) */
+static void search_words(GHashTable *weights, const char *text, gint weight)
+{
+    gchar *fold, *p, *next, *start = NULL, *word;
+    gunichar ch;
+    gboolean valid, is_word;
+
+    if (!ORAGE_STR_EXISTS(text))
+        return;
+    if ((valid = g_utf8_validate(text, -1, NULL)))
+        fold = g_utf8_casefold(text, -1);
+    else /* broken file, we can still find ascii words */
+        fold = g_ascii_strdown(text, -1);
+    for (p = fold; ; p = next) {
+        if (valid) {
+            ch = g_utf8_get_char(p);
+            next = g_utf8_next_char(p);
+            is_word = g_unichar_isalnum(ch);
+        }
+        else {
+            ch = (guchar)*p;
+            next = p+1;
+            is_word = (ch >= 0x80 || g_ascii_isalnum(ch));
+        }
+        if (is_word) {
+            if (start == NULL)
+                start = p;
+        }
+        else if (start != NULL) {
+            word = g_strndup(start, p-start);
+            g_hash_table_replace(weights, word, GINT_TO_POINTER(weight
+                    + GPOINTER_TO_INT(g_hash_table_lookup(weights, word))));
+            start = NULL;
+        }
+        if (ch == 0)
+            break;
+    }
+    g_free(fold);
+}
+
+static void search_component_words(GHashTable *weights, icalcomponent *c
+        , icalproperty_kind kind, gint weight)
+{
+    icalproperty *p;
+    icalvalue *v;
+    const char *text;
+
+    for (p = icalcomponent_get_first_property(c, kind);
+         p != 0;
+         p = icalcomponent_get_next_property(c, kind)) {
+        if ((v = icalproperty_get_value(p)) == NULL)
+            continue;
+        if (icalvalue_isa(v) == ICAL_TEXT_VALUE)
+            text = icalvalue_get_text(v); /* without ical escapes */
+        else
+            text = icalproperty_get_value_as_string(p);
+        search_words(weights, text, weight);
+    }
+}
+
+static gboolean search_indexed_type(icalcomponent *c)
+{
+    icalcomponent_kind kind = icalcomponent_isa(c);
+
+    return(kind == ICAL_VEVENT_COMPONENT || kind == ICAL_VTODO_COMPONENT
+        || kind == ICAL_VJOURNAL_COMPONENT);
+}
+
+static void search_index_words_add(search_index *si, icalcomponent *c)
+{
+    GHashTable *weights, *posting;
+    GHashTableIter iter;
+    gpointer word, weight, key;
+    GPtrArray *c_words;
+
+    if (!search_indexed_type(c) || g_hash_table_lookup(si->words, c))
+        return;
+    weights = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    search_component_words(weights, c, ICAL_SUMMARY_PROPERTY
+            , SEARCH_WEIGHT_SUMMARY);
+    search_component_words(weights, c, ICAL_LOCATION_PROPERTY
+            , SEARCH_WEIGHT_LOCATION);
+    search_component_words(weights, c, ICAL_CATEGORIES_PROPERTY
+            , SEARCH_WEIGHT_CATEGORIES);
+    search_component_words(weights, c, ICAL_DESCRIPTION_PROPERTY
+            , SEARCH_WEIGHT_DESCRIPTION);
+    c_words = g_ptr_array_sized_new(g_hash_table_size(weights));
+    g_hash_table_iter_init(&iter, weights);
+    while (g_hash_table_iter_next(&iter, &word, &weight)) {
+        if (!g_hash_table_lookup_extended(si->postings, word, &key
+                    , (gpointer *)&posting)) {
+            key = g_strdup(word);
+            posting = g_hash_table_new(g_direct_hash, g_direct_equal);
+            g_hash_table_insert(si->postings, key, posting);
+            if (si->sorted) { /* new word */
+                g_ptr_array_free(si->sorted, TRUE);
+                si->sorted = NULL;
+            }
+        }
+        g_hash_table_insert(posting, c, weight);
+        g_ptr_array_add(c_words, key);
+    }
+    g_hash_table_insert(si->words, c, c_words);
+    g_hash_table_destroy(weights);
+}
+
+static void search_index_words_remove(search_index *si, icalcomponent *c)
+{
+    GPtrArray *c_words;
+    GHashTable *posting;
+    gchar *word;
+    guint i;
+
+    if ((c_words = g_hash_table_lookup(si->words, c)) == NULL)
+        return;
+    for (i = 0; i < c_words->len; i++) {
+        word = g_ptr_array_index(c_words, i);
+        posting = g_hash_table_lookup(si->postings, word);
+        g_hash_table_remove(posting, c);
+        if (g_hash_table_size(posting) == 0) {
+            if (si->sorted) { /* word is gone */
+                g_ptr_array_free(si->sorted, TRUE);
+                si->sorted = NULL;
+            }
+            g_hash_table_remove(si->postings, word); /* frees word */
+        }
+    }
+    g_hash_table_remove(si->words, c); /* frees c_words */
+}
+
+static search_index *search_index_get(icalcomponent *base, gboolean build)
+{
+#undef P_N
+#define P_N "search_index_get: "
+    search_index *si;
+    icalcompiter ci;
+    icalcomponent *c;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-300, P_N);
+#endif
+    if (search_indexes == NULL) {
+        if (!build)
+            return(NULL);
+        search_indexes = g_hash_table_new_full(g_direct_hash, g_direct_equal
+                , NULL, (GDestroyNotify)search_index_destroy);
+    }
+    si = g_hash_table_lookup(search_indexes, base);
+    if (si == NULL && build) {
+        si = g_new0(search_index, 1);
+        si->postings = g_hash_table_new_full(g_str_hash, g_str_equal
+                , g_free, (GDestroyNotify)g_hash_table_destroy);
+        si->words = g_hash_table_new_full(g_direct_hash, g_direct_equal
+                , NULL, (GDestroyNotify)search_words_free);
+        /* external iterator so that we do not disturb callers, which
+         * may be in the middle of walking the same calendar */
+        for (ci = icalcomponent_begin_component(base, ICAL_ANY_COMPONENT);
+             (c = icalcompiter_deref(&ci)) != 0;
+             icalcompiter_next(&ci))
+            search_index_words_add(si, c);
+        g_hash_table_insert(search_indexes, base, si);
+    }
+    return(si);
+}
+
+void ic_search_index_add(icalcomponent *base, icalcomponent *c)
+{
+    search_index *si;
+
+    if (search_indexes && (si = g_hash_table_lookup(search_indexes, base)))
+        search_index_words_add(si, c);
+}
+
+void ic_search_index_remove(icalcomponent *base, icalcomponent *c)
+{
+    search_index *si;
+
+    if (search_indexes && (si = g_hash_table_lookup(search_indexes, base)))
+        search_index_words_remove(si, c);
+}
+
+/* must be called before base is freed */
+void ic_search_index_free(icalcomponent *base)
+{
+    if (search_indexes != NULL && base != NULL)
+        g_hash_table_remove(search_indexes, base);
+}
+
+static gint search_word_order(gconstpointer a, gconstpointer b)
+{
+    return(strcmp(*(const gchar **)a, *(const gchar **)b));
+}
+
+static void search_sorted_add(gpointer word, gpointer posting
+        , gpointer sorted)
+{
+    g_ptr_array_add((GPtrArray *)sorted, word);
+}
+
+/* score of each component which has a word starting with prefix */
+static GHashTable *search_prefix(search_index *si, const gchar *prefix)
+{
+    GHashTable *scores, *posting;
+    GHashTableIter iter;
+    gpointer c, weight;
+    gchar *word;
+    guint lo, hi, mid;
+    gint score;
+
+    if (si->sorted == NULL) {
+        si->sorted = g_ptr_array_sized_new(g_hash_table_size(si->postings));
+        g_hash_table_foreach(si->postings, search_sorted_add, si->sorted);
+        g_ptr_array_sort(si->sorted, search_word_order);
+    }
+    /* first word which is not smaller than prefix */
+    for (lo = 0, hi = si->sorted->len; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if (strcmp(g_ptr_array_index(si->sorted, mid), prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    scores = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (; lo < si->sorted->len
+            && g_str_has_prefix(word = g_ptr_array_index(si->sorted, lo)
+                , prefix); lo++) {
+        posting = g_hash_table_lookup(si->postings, word);
+        g_hash_table_iter_init(&iter, posting);
+        while (g_hash_table_iter_next(&iter, &c, &weight)) {
+            score = GPOINTER_TO_INT(weight);
+            if (strcmp(word, prefix) == 0)
+                score *= 2; /* whole word */
+            if (score > GPOINTER_TO_INT(g_hash_table_lookup(scores, c)))
+                g_hash_table_insert(scores, c, GINT_TO_POINTER(score));
+        }
+    }
+    return(scores);
+}
+
+static gint search_hit_order(gconstpointer a, gconstpointer b)
+{
+    return(((const ic_search_hit *)b)->score
+         - ((const ic_search_hit *)a)->score);
+}
+
+ /* Find appointments of base which contain all words of str.
+  * returns: array of ic_search_hit, best first. Free with g_array_free.
+  */
+GArray *ic_search_index_query(icalcomponent *base, const char *str)
+{
+#undef P_N
+#define P_N "ic_search_index_query: "
+    search_index *si;
+    GHashTable *words, *total = NULL, *scores, *both;
+    GHashTableIter iter, word_iter;
+    gpointer c, score, word, word_score;
+    GArray *hits;
+    ic_search_hit hit;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    hits = g_array_new(FALSE, FALSE, sizeof(ic_search_hit));
+    if (base == NULL)
+        return(hits);
+    words = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    search_words(words, str, 1);
+    si = search_index_get(base, TRUE);
+    g_hash_table_iter_init(&word_iter, words);
+    while (g_hash_table_iter_next(&word_iter, &word, NULL)) {
+        scores = search_prefix(si, (gchar *)word);
+        if (total == NULL)
+            total = scores;
+        else { /* keep components which have all the words */
+            both = g_hash_table_new(g_direct_hash, g_direct_equal);
+            g_hash_table_iter_init(&iter, total);
+            while (g_hash_table_iter_next(&iter, &c, &score)) {
+                if ((word_score = g_hash_table_lookup(scores, c)) != NULL)
+                    g_hash_table_insert(both, c, GINT_TO_POINTER(
+                            GPOINTER_TO_INT(score)
+                            + GPOINTER_TO_INT(word_score)));
+            }
+            g_hash_table_destroy(total);
+            g_hash_table_destroy(scores);
+            total = both;
+        }
+        if (g_hash_table_size(total) == 0)
+            break;
+    }
+    g_hash_table_destroy(words);
+    if (total == NULL) /* nothing to search */
+        return(hits);
+    g_hash_table_iter_init(&iter, total);
+    while (g_hash_table_iter_next(&iter, &c, &score)) {
+        hit.c = (icalcomponent *)c;
+        hit.score = GPOINTER_TO_INT(score);
+        g_array_append_val(hits, hit);
+    }
+    g_hash_table_destroy(total);
+    g_array_sort(hits, search_hit_order);
+    return(hits);
+}
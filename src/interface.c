@@ -34,6 +34,7 @@
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkkeysyms.h>
@@ -70,6 +71,8 @@ static gboolean interface_lock = FALSE;
 
 static void refresh_foreign_files(intf_win *intf_w, gboolean first);
 
+/* Files changed outside of Orage are read again one by one, so that
+ * alarms and marks of the other files do not need to be built again. */
 gboolean orage_external_update_check(gpointer user_data)
 {
 #undef P_N
@@ -77,6 +80,7 @@ gboolean orage_external_update_check(gpointer user_data)
     struct stat s;
     gint i;
     gboolean external_changes_present = FALSE;
+    gboolean main_changed = FALSE, foreign_changed[10];
 
     /* check main Orage file */
     if (g_stat(g_par.orage_file, &s) < 0) {
@@ -88,12 +92,13 @@ gboolean orage_external_update_check(gpointer user_data)
             g_par.latest_file_change = s.st_mtime;
             orage_message(10, _("Found external update on file %s.")
                     , g_par.orage_file);  
-            external_changes_present = TRUE;
+            external_changes_present = main_changed = TRUE;
         }
     }
 
     /* check also foreign files */
     for (i = 0; i < g_par.foreign_count; i++) {
+        foreign_changed[i] = FALSE;
         if (g_stat(g_par.foreign_data[i].file, &s) < 0) {
             orage_message(150, P_N "stat of %s failed: %d (%s)",
                     g_par.foreign_data[i].file, errno, strerror(errno));
@@ -103,21 +108,159 @@ gboolean orage_external_update_check(gpointer user_data)
                 g_par.foreign_data[i].latest_file_change = s.st_mtime;
                 orage_message(10, _("Found external update on file %s.")
                         , g_par.foreign_data[i].file);
-                external_changes_present = TRUE;
+                external_changes_present = foreign_changed[i] = TRUE;
             }
         }
     }
     
+    /* all change times are stored before reading, so the checks done
+     * while reading (xfical_file_open) do not find the same changes */
     if (external_changes_present) {
         orage_message(80, _("Refreshing alarms and calendar due to external file update."));
-        xfical_file_close_force();
-        xfical_alarm_build_list(FALSE);
+        if (main_changed)
+            xfical_file_reload(-1);
+        for (i = 0; i < g_par.foreign_count; i++)
+            if (foreign_changed[i])
+                xfical_file_reload(i);
         orage_mark_appointments();
     }
 
     return(TRUE); /* keep running */
 }
 
+/* External updates are noticed by watching the directories of the calendar
+ * files. Directories and not the files themselves are watched since files
+ * are replaced (renamed over) when they are written. Programs often write
+ * in many steps, so the files are checked only after they have been quiet
+ * for FILE_MONITOR_DELAY seconds. If a directory can not be watched, we
+ * fall back to checking all files every FILE_POLL_INTERVAL seconds until
+ * all directories can be watched again. */
+#define FILE_MONITOR_DELAY 1
+#define FILE_POLL_INTERVAL 30
+
+static GHashTable *file_monitors = NULL; /* directory -> GFileMonitor */
+static guint file_monitor_timer_id = 0;
+static guint file_poll_timer_id = 0;
+
+static gboolean file_monitor_check(gpointer user_data)
+{
+    file_monitor_timer_id = 0;
+    orage_external_update_check(NULL);
+    return(FALSE); /* once only */
+}
+
+static gboolean file_monitor_is_calendar(GFile *file)
+{
+    GFile *cal;
+    gboolean found = FALSE;
+    gint i;
+
+    for (i = -1; i < g_par.foreign_count && !found; i++) {
+        cal = g_file_new_for_path(i < 0 ? g_par.orage_file
+                : g_par.foreign_data[i].file);
+        found = g_file_equal(file, cal);
+        g_object_unref(cal);
+    }
+    return(found);
+}
+
+static void file_monitor_changed(GFileMonitor *monitor, GFile *file
+        , GFile *other_file, GFileMonitorEvent event, gpointer user_data)
+{
+    /* change log, temporary files and other files in the same directory */
+    if (!file_monitor_is_calendar(file))
+        return;
+    if (file_monitor_timer_id)
+        g_source_remove(file_monitor_timer_id);
+    file_monitor_timer_id = g_timeout_add_seconds(FILE_MONITOR_DELAY
+            , file_monitor_check, NULL);
+}
+
+/* returns FALSE if the directory of file can not be watched */
+static gboolean file_monitor_add(GHashTable *old_monitors, const gchar *file)
+{
+#undef P_N
+#define P_N "file_monitor_add: "
+    gchar *dir;
+    gpointer old_dir, monitor;
+    GFile *gdir;
+    GError *error = NULL;
+
+    if (!ORAGE_STR_EXISTS(file))
+        return(TRUE);
+    dir = g_path_get_dirname(file);
+    if (g_hash_table_lookup(file_monitors, dir)) {
+        g_free(dir);
+        return(TRUE);
+    }
+    if (old_monitors 
+    && g_hash_table_lookup_extended(old_monitors, dir, &old_dir, &monitor)) {
+        /* already watched, keep it */
+        g_hash_table_steal(old_monitors, dir);
+        g_hash_table_insert(file_monitors, old_dir, monitor);
+        g_free(dir);
+        return(TRUE);
+    }
+    gdir = g_file_new_for_path(dir);
+    monitor = g_file_monitor_directory(gdir, G_FILE_MONITOR_NONE, NULL
+            , &error);
+    g_object_unref(gdir);
+    if (monitor == NULL) {
+        if (!file_poll_timer_id) /* already told */
+            orage_message(150, P_N "can not watch %s: %s"
+                    , dir, error->message);
+        g_error_free(error);
+        g_free(dir);
+        return(FALSE);
+    }
+    g_signal_connect(monitor, "changed", G_CALLBACK(file_monitor_changed)
+            , NULL);
+    g_hash_table_insert(file_monitors, dir, monitor);
+    return(TRUE);
+}
+
+/* Poll and try to watch again. Watching removes this timer when it
+ * works. */
+static gboolean file_poll_check(gpointer user_data)
+{
+    orage_external_update_check(NULL);
+    orage_external_update_watch();
+    return(file_poll_timer_id != 0);
+}
+
+/* Start watching the calendar files. Needs to be called again whenever
+ * the Orage file or the foreign file list changes. */
+void orage_external_update_watch(void)
+{
+#undef P_N
+#define P_N "orage_external_update_watch: "
+    GHashTable *old_monitors = file_monitors;
+    gboolean watched;
+    gint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    file_monitors = g_hash_table_new_full(g_str_hash, g_str_equal
+            , g_free, g_object_unref);
+    watched = file_monitor_add(old_monitors, g_par.orage_file);
+    for (i = 0; i < g_par.foreign_count; i++)
+        if (!file_monitor_add(old_monitors, g_par.foreign_data[i].file))
+            watched = FALSE;
+    /* directories which are not needed anymore */
+    if (old_monitors)
+        g_hash_table_destroy(old_monitors);
+
+    /* poll only while some directory can not be watched */
+    if (!watched && !file_poll_timer_id)
+        file_poll_timer_id = g_timeout_add_seconds(FILE_POLL_INTERVAL
+                , file_poll_check, NULL);
+    else if (watched && file_poll_timer_id) {
+        g_source_remove(file_poll_timer_id);
+        file_poll_timer_id = 0;
+    }
+}
+
 static void orage_file_entry_changed(GtkWidget *dialog, gpointer user_data)
 {
     intf_win *intf_w = (intf_win *)user_data;
@@ -140,6 +283,8 @@ static void orage_file_save_button_clicked(GtkButton *button
     gboolean ok = TRUE;
 
     s = g_strdup(gtk_entry_get_text(GTK_ENTRY(intf_w->orage_file_entry)));
+    /* pending changes must be in the file before it is copied or moved */
+    xfical_change_log_compact();
     if (gtk_toggle_button_get_active(
             GTK_TOGGLE_BUTTON(intf_w->orage_file_rename_rb))) {
         if (!g_file_test(s, G_FILE_TEST_EXISTS)) {
@@ -179,6 +324,7 @@ static void orage_file_save_button_clicked(GtkButton *button
         gtk_widget_set_sensitive(intf_w->orage_file_save_button, FALSE);
         write_parameters(); /* store file name */
         xfical_file_close_force(); /* close it so that we open new file */
+        orage_external_update_watch();
     }
     else {
         g_free(s);
@@ -210,29 +356,18 @@ static void archive_file_save_button_clicked(GtkButton *button
     s = g_strdup(gtk_entry_get_text(GTK_ENTRY(intf_w->archive_file_entry)));
     if (gtk_toggle_button_get_active(
             GTK_TOGGLE_BUTTON(intf_w->archive_file_rename_rb))) {
-        if (!g_file_test(s, G_FILE_TEST_EXISTS)) {
-            g_warning("New file %s does not exist. Rename not done", s);
-            ok = FALSE;
-        }
-        if (!xfical_file_check(s)) {
-            g_warning("New file %s is not valid ical calendar file. Rename not done", s);
+        if (!xfical_archive_check(s)) {
+            g_warning("New file %s is not valid ical archive file. Rename not done", s);
             ok = FALSE;
         }
     }
     else if (gtk_toggle_button_get_active(
             GTK_TOGGLE_BUTTON(intf_w->archive_file_copy_rb))) {
-        ok = orage_copy_file(g_par.archive_file, s);
+        ok = xfical_archive_copy(s, FALSE);
     }
     else if (gtk_toggle_button_get_active(
             GTK_TOGGLE_BUTTON(intf_w->archive_file_move_rb))) {
-        if (g_rename(g_par.archive_file, s)) { /* failed */
-            g_warning("rename failed. trying manual copy");
-            ok = orage_copy_file(g_par.archive_file, s);
-            if (ok) { /* this is move. so let's remove the orig */
-               if (g_remove(g_par.archive_file))
-                   g_warning("file remove failed %s", g_par.archive_file);
-            }
-        }
+        ok = xfical_archive_copy(s, TRUE);
     }
     else {
         g_warning("illegal file save toggle button status");
@@ -555,6 +690,8 @@ static void orage_foreign_file_remove_line(gint del_line)
 {
     int i;
 
+    /* foreign files are kept in memory by index, so release them first */
+    xfical_file_close_force();
     g_free(g_par.foreign_data[del_line].file);
     g_free(g_par.foreign_data[del_line].name);
     g_par.foreign_count--;
@@ -568,6 +705,7 @@ static void orage_foreign_file_remove_line(gint del_line)
     g_par.foreign_data[i].name = NULL;
 
     write_parameters();
+    orage_external_update_watch();
     orage_mark_appointments();
     xfical_alarm_build_list(FALSE);
 }
@@ -739,6 +877,7 @@ static gboolean orage_foreign_file_add_internal(gchar *filename
     g_par.foreign_count++;
 
     write_parameters();
+    orage_external_update_watch();
     orage_mark_appointments();
     xfical_alarm_build_list(FALSE);
     return(TRUE);
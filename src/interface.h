@@ -98,6 +98,7 @@ typedef struct _intf_win
 void orage_external_interface(CalWin *xfcal);
 
 gboolean orage_external_update_check(gpointer user_data);
+void orage_external_update_watch(void);
 gboolean orage_foreign_file_add(gchar *filename, gboolean read_only
         , gchar *name);
 gboolean orage_foreign_file_remove(gchar *filename);
@@ -580,6 +580,12 @@ int main(int argc, char *argv[])
 #endif
     textdomain(GETTEXT_PACKAGE);
 
+#if !GLIB_CHECK_VERSION(2,32,0)
+    /* foreign files are read in worker threads. Not needed after
+     * GLib 2.32 */
+    if (!g_thread_supported())
+        g_thread_init(NULL);
+#endif
     gtk_init(&argc, &argv);
 
     atom_alive = gdk_atom_intern("_XFCE_CALENDAR_RUNNING", FALSE);
@@ -637,7 +643,7 @@ int main(int argc, char *argv[])
             (GtkCalendar *)((CalWin *)g_par.xfcal)->mCalendar, NULL);
 
     /* start monitoring external file updates */
-    g_timeout_add_seconds(30, (GtkFunction)orage_external_update_check, NULL);
+    orage_external_update_watch();
 
     /* let's check if I got filename as a parameter */
     initialized = TRUE;
@@ -649,6 +655,7 @@ int main(int argc, char *argv[])
 #endif
 
     gtk_main();
+    xfical_file_close_force(); /* release calendar files kept in memory */
     keep_tidy();
     return(EXIT_SUCCESS);
 }
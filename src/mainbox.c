@@ -394,7 +394,8 @@ static void todo_clicked(GtkWidget *widget
     }
 }
 
-static void add_info_row(xfical_appt *appt, GtkBox *parentBox, gboolean todo)
+static void add_info_row(xfical_appt *appt, char *starttimecur
+        , char *endtimecur, GtkBox *parentBox, gboolean todo)
 {
 #undef P_N
 #define P_N "add_info_row: "
@@ -415,18 +416,18 @@ static void add_info_row(xfical_appt *appt, GtkBox *parentBox, gboolean todo)
     tmp_title = appt->title
             ? orage_process_text_commands(appt->title)
             : g_strdup(_("No title defined"));
-    s_time = g_strdup(orage_icaltime_to_i18_time(appt->starttimecur));
+    s_time = g_strdup(orage_icaltime_to_i18_time(starttimecur));
     if (todo) {
         e_time = g_strdup(appt->use_due_time
-                ? orage_icaltime_to_i18_time(appt->endtimecur) : s_time);
+                ? orage_icaltime_to_i18_time(endtimecur) : s_time);
         tmp = g_strdup_printf(" %s  %s", e_time, tmp_title);
         g_free(e_time);
     }
     else {
         today = orage_tm_time_to_icaltime(orage_localtime());
         s_timeonly = g_strdup(orage_icaltime_to_i18_time_only(
-                    appt->starttimecur));
-        if (!strncmp(today, appt->starttimecur, 8)) /* today */
+                    starttimecur));
+        if (!strncmp(today, starttimecur, 8)) /* today */
             tmp = g_strdup_printf(" %s* %s", s_timeonly, tmp_title);
         else {
             if (g_par.show_event_days > 1)
@@ -451,17 +452,17 @@ static void add_info_row(xfical_appt *appt, GtkBox *parentBox, gboolean todo)
     if (todo) {
         t = orage_localtime();
         l_time = orage_tm_time_to_icaltime(t);
-        if (appt->starttimecur[8] == 'T') /* date+time */
+        if (starttimecur[8] == 'T') /* date+time */
             len = 15;
         else /* date only */
             len = 8;
         if (appt->use_due_time)
-            e_time = g_strndup(appt->endtimecur, len);
+            e_time = g_strndup(endtimecur, len);
         else
             e_time = g_strdup("99999");
         if (strncmp(e_time,  l_time, len) < 0) /* gone */
             gtk_widget_modify_fg(label, GTK_STATE_NORMAL, &cal->mRed);
-        else if (strncmp(appt->starttimecur, l_time, len) <= 0
+        else if (strncmp(starttimecur, l_time, len) <= 0
              &&  strncmp(e_time, l_time, len) >= 0)
             gtk_widget_modify_fg(label, GTK_STATE_NORMAL, &cal->mBlue);
         g_free(e_time);
@@ -491,7 +492,7 @@ static void add_info_row(xfical_appt *appt, GtkBox *parentBox, gboolean todo)
     if (todo) {
         na = _("Never");
         e_time = g_strdup(appt->use_due_time
-                ? orage_icaltime_to_i18_time(appt->endtimecur) : na);
+                ? orage_icaltime_to_i18_time(endtimecur) : na);
         c_time = g_strdup(appt->completed
                 ? orage_icaltime_to_i18_time(appt->completedtime) : na);
 
@@ -501,7 +502,7 @@ static void add_info_row(xfical_appt *appt, GtkBox *parentBox, gboolean todo)
         g_free(c_time);
     }
     else { /* it is event */
-        e_time = g_strdup(orage_icaltime_to_i18_time(appt->endtimecur));
+        e_time = g_strdup(orage_icaltime_to_i18_time(endtimecur));
 
         tip = g_strdup_printf(_("Title: %s\n%s Start:\t%s\n End:\t%s%s")
                 , tip_title, tip_location, s_time, e_time, tip_note);
@@ -541,15 +542,15 @@ static gint event_order(gconstpointer a, gconstpointer b)
 {
 #undef P_N
 #define P_N "event_order: "
-    xfical_appt *appt1, *appt2;
+    xfical_occurrence *occ1, *occ2;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    appt1 = (xfical_appt *)a;
-    appt2 = (xfical_appt *)b;
+    occ1 = (xfical_occurrence *)a;
+    occ2 = (xfical_occurrence *)b;
 
-    return(strcmp(appt1->starttimecur, appt2->starttimecur));
+    return(strcmp(occ1->starttimecur, occ2->starttimecur));
 }
 
 static gint todo_order(gconstpointer a, gconstpointer b)
@@ -597,10 +598,25 @@ static void info_process(gpointer a, gpointer pbox)
     else
         todo = FALSE;
     if (appt->priority < g_par.priority_list_limit)
-        add_info_row(appt, box, todo);
+        add_info_row(appt, appt->starttimecur, appt->endtimecur, box, todo);
     xfical_appt_free(appt);
 }
 
+static void info_process_occurrence(gpointer a, gpointer pbox)
+{
+#undef P_N
+#define P_N "info_process_occurrence: "
+    xfical_occurrence *occ = (xfical_occurrence *)a;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (occ->appt->priority < g_par.priority_list_limit)
+        add_info_row(occ->appt, occ->starttimecur, occ->endtimecur
+                , GTK_BOX(pbox), FALSE);
+    xfical_occurrence_free(occ);
+}
+
 static void create_mainbox_todo_info(void)
 {
 #undef P_N
@@ -777,7 +793,7 @@ static void build_mainbox_event_info(void)
         gtk_widget_destroy(cal->mEvent_vbox);
         create_mainbox_event_info_box();
         event_list = g_list_sort(event_list, event_order);
-        g_list_foreach(event_list, (GFunc)info_process
+        g_list_foreach(event_list, (GFunc)info_process_occurrence
                 , cal->mEvent_rows_vbox);
         g_list_free(event_list);
         event_list = NULL;
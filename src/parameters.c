@@ -1199,6 +1199,7 @@ void read_parameters(void)
     fpath = orage_data_file_location(ORAGE_ARC_DIR_FILE);
     g_par.archive_file = orage_rc_get_str(orc, "Archive file", fpath);
     g_free(fpath);
+    g_par.archive_compress = orage_rc_get_bool(orc, "Compress archive", FALSE);
 #endif
     fpath = orage_data_file_location(ORAGE_APP_DIR_FILE);
     g_par.orage_file = orage_rc_get_str(orc, "Orage file", fpath);
@@ -1284,6 +1285,12 @@ void read_parameters(void)
     g_par.use_wakeup_timer = orage_rc_get_bool(orc, "Use wakeup timer", TRUE);
     g_par.close_means_quit = orage_rc_get_bool(orc, "Always quit", FALSE);
     g_par.file_close_delay = orage_rc_get_int(orc, "File close delay", 600);
+    g_par.use_change_log = orage_rc_get_bool(orc, "Use change log", FALSE);
+    g_par.change_log_compact_size = orage_rc_get_int(orc
+            , "Change log compact size", 262144);
+    g_par.change_log_compact_age = orage_rc_get_int(orc
+            , "Change log compact age", 3600);
+    g_par.use_snapshot = orage_rc_get_bool(orc, "Use snapshot cache", TRUE);
 
     orage_rc_file_close(orc);
 }
@@ -1301,6 +1308,7 @@ void write_parameters(void)
 #ifdef HAVE_ARCHIVE
     orage_rc_put_int(orc, "Archive limit", g_par.archive_limit);
     orage_rc_put_str(orc, "Archive file", g_par.archive_file);
+    orage_rc_put_bool(orc, "Compress archive", g_par.archive_compress);
 #endif
     orage_rc_put_str(orc, "Orage file", g_par.orage_file);
     orage_rc_put_str(orc, "Sound application", g_par.sound_application);
@@ -1387,6 +1395,12 @@ void write_parameters(void)
     orage_rc_put_bool(orc, "Use wakeup timer", g_par.use_wakeup_timer);
     orage_rc_put_bool(orc, "Always quit", g_par.close_means_quit);
     orage_rc_put_int(orc, "File close delay", g_par.file_close_delay);
+    orage_rc_put_bool(orc, "Use change log", g_par.use_change_log);
+    orage_rc_put_int(orc, "Change log compact size"
+            , g_par.change_log_compact_size);
+    orage_rc_put_int(orc, "Change log compact age"
+            , g_par.change_log_compact_age);
+    orage_rc_put_bool(orc, "Use snapshot cache", g_par.use_snapshot);
 
     orage_rc_file_close(orc);
 }
@@ -63,6 +63,7 @@ typedef struct _parameters
     /* archiving */
     int archive_limit;
     char *archive_file;
+    gboolean archive_compress; /* write archive files with gzip */
 
     /* foreign files */
     int foreign_count;
@@ -74,8 +75,8 @@ typedef struct _parameters
     time_t latest_file_change;
     char *sound_application;
 
-    /* List of active alarms */
-    GList *alarm_list;
+    /* Active alarms. Binary min-heap ordered by alarm_tt, see reminder.c */
+    GPtrArray *alarm_list;
 
     /* alarm timer id and timeout in millisecs */
     guint alarm_timer; /* monitors next alarm */
@@ -134,8 +135,19 @@ typedef struct _parameters
     /* always quit instead of going to background when asked to close */
     gboolean close_means_quit;
 
-    /* delayed close length in seconds. 0 = close immediately */
+    /* 0 = release calendar files after each use, otherwise they are kept
+     * in memory and only read again when changed on disk */
     gint file_close_delay;
+
+    /* store changes of the Orage file in a change log and write the whole
+     * file only when the log is bigger or older than these */
+    gboolean use_change_log;
+    gint change_log_compact_size; /* bytes */
+    gint change_log_compact_age;  /* seconds */
+
+    /* keep parsed calendar files as binary snapshots in the cache
+     * directory and load unchanged files from them (bundled libical only) */
+    gboolean use_snapshot;
 } global_parameters; /* global parameters */
 
 #ifdef ORAGE_MAIN
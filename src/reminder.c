@@ -100,66 +100,203 @@ static void alarm_free(gpointer galarm)
     g_free(l_alarm);
 }
 
-static gint alarm_order(gconstpointer a, gconstpointer b)
+/************************************************************/
+/* alarm heap start                                         */
+/************************************************************/
+/* g_par.alarm_list is a binary min-heap ordered by alarm_tt, so the next
+ * alarm is always in position 0. Each alarm knows its own position
+ * (heap_pos) and alarm_uids finds alarms of one appointment, so that
+ * they can be removed without scanning the whole heap. */
+
+static GHashTable *alarm_uids = NULL; /* uid -> GSList of alarm_struct */
+
+#define ALARM_HEAP(i) ((alarm_struct *)g_ptr_array_index(g_par.alarm_list, i))
+
+static time_t alarm_time_to_epoch(const gchar *alarm_time)
 {
 #undef P_N
-#define P_N "alarm_order: "
+#define P_N "alarm_time_to_epoch: "
+    struct tm t;
 
 #ifdef ORAGE_DEBUG
     orage_message(-300, P_N);
 #endif
-    if (((alarm_struct *)a)->alarm_time == NULL)
-        return(1);
-    else if (((alarm_struct *)b)->alarm_time == NULL)
-        return(-1);
+    if (alarm_time == NULL)
+        return((time_t)G_MAXLONG); /* never, keep it last */
+    t = orage_icaltime_to_tm_time(alarm_time, TRUE);
+    if (t.tm_hour == -1) { /* date only = full day = from midnight */
+        t.tm_hour = 0;
+        t.tm_min = 0;
+        t.tm_sec = 0;
+    }
+    t.tm_isdst = -1;
+    return(mktime(&t));
+}
+
+static void alarm_heap_set(guint pos, alarm_struct *l_alarm)
+{
+    g_par.alarm_list->pdata[pos] = l_alarm;
+    l_alarm->heap_pos = pos;
+}
+
+static void alarm_heap_up(guint pos)
+{
+    alarm_struct *l_alarm = ALARM_HEAP(pos);
+    guint parent;
+
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (ALARM_HEAP(parent)->alarm_tt <= l_alarm->alarm_tt)
+            break;
+        alarm_heap_set(pos, ALARM_HEAP(parent));
+        pos = parent;
+    }
+    alarm_heap_set(pos, l_alarm);
+}
+
+static void alarm_heap_down(guint pos)
+{
+    alarm_struct *l_alarm = ALARM_HEAP(pos);
+    guint child, len = g_par.alarm_list->len;
+
+    while ((child = 2*pos + 1) < len) {
+        if (child + 1 < len 
+        && ALARM_HEAP(child + 1)->alarm_tt < ALARM_HEAP(child)->alarm_tt)
+            child++;
+        if (l_alarm->alarm_tt <= ALARM_HEAP(child)->alarm_tt)
+            break;
+        alarm_heap_set(pos, ALARM_HEAP(child));
+        pos = child;
+    }
+    alarm_heap_set(pos, l_alarm);
+}
+
+static void alarm_uids_add(alarm_struct *l_alarm)
+{
+    GSList *uid_l;
+
+    if (alarm_uids == NULL)
+        alarm_uids = g_hash_table_new_full(g_str_hash, g_str_equal
+                , g_free, NULL);
+    if (l_alarm->uid == NULL)
+        return;
+    uid_l = g_hash_table_lookup(alarm_uids, l_alarm->uid);
+    if (uid_l == NULL)
+        g_hash_table_insert(alarm_uids, g_strdup(l_alarm->uid)
+                , g_slist_prepend(NULL, l_alarm));
+    else /* head stays the same, so no need to update the table */
+        uid_l->next = g_slist_prepend(uid_l->next, l_alarm);
+}
+
+static void alarm_uids_remove(alarm_struct *l_alarm)
+{
+    GSList *uid_l;
+
+    if (alarm_uids == NULL || l_alarm->uid == NULL)
+        return;
+    uid_l = g_hash_table_lookup(alarm_uids, l_alarm->uid);
+    uid_l = g_slist_remove(uid_l, l_alarm);
+    if (uid_l == NULL)
+        g_hash_table_remove(alarm_uids, l_alarm->uid);
+    else
+        g_hash_table_insert(alarm_uids, g_strdup(l_alarm->uid), uid_l);
+}
+
+/* take alarm out of the heap. Caller owns it after this */
+static alarm_struct *alarm_heap_remove(guint pos)
+{
+    alarm_struct *l_alarm = ALARM_HEAP(pos), *last;
+
+    last = g_ptr_array_remove_index(g_par.alarm_list
+            , g_par.alarm_list->len - 1);
+    if (last != l_alarm) {
+        alarm_heap_set(pos, last);
+        if (pos > 0 && ALARM_HEAP((pos - 1) / 2)->alarm_tt > last->alarm_tt)
+            alarm_heap_up(pos);
+        else
+            alarm_heap_down(pos);
+    }
+    alarm_uids_remove(l_alarm);
+    return(l_alarm);
+}
+
+/* next alarm or NULL if there are none */
+static alarm_struct *alarm_heap_first(void)
+{
+    if (g_par.alarm_list == NULL || g_par.alarm_list->len == 0)
+        return(NULL);
+    return(ALARM_HEAP(0));
+}
+
+/* returns list of max cnt first alarms in time order. 
+ * Caller must free the list, but not the data. */
+static GList *alarm_first_alarms(guint cnt)
+{
+    GList *first_l = NULL;
+    guint *cand, cand_cnt = 0, i, best, pos;
 
-    return(strcmp(((alarm_struct *)a)->alarm_time
-                , ((alarm_struct *)b)->alarm_time));
+    if (alarm_heap_first() == NULL)
+        return(NULL);
+    /* the next one is always one of the children of the already
+     * selected alarms, so we only need to look at those */
+    cand = g_new(guint, 2*cnt + 1);
+    cand[cand_cnt++] = 0;
+    while (cnt-- && cand_cnt) {
+        best = 0;
+        for (i = 1; i < cand_cnt; i++)
+            if (ALARM_HEAP(cand[i])->alarm_tt < ALARM_HEAP(cand[best])->alarm_tt)
+                best = i;
+        pos = cand[best];
+        first_l = g_list_prepend(first_l, ALARM_HEAP(pos));
+        cand[best] = cand[--cand_cnt];
+        for (i = 2*pos + 1; i <= 2*pos + 2; i++)
+            if (i < g_par.alarm_list->len)
+                cand[cand_cnt++] = i;
+    }
+    g_free(cand);
+    return(g_list_reverse(first_l));
 }
 
 void alarm_list_free(void)
 {
 #undef P_N
 #define P_N "alarm_free_all: "
-    gchar *time_now;
+    time_t time_now;
     alarm_struct *l_alarm;
-    GList *alarm_l, *kept_l=NULL;
+    GPtrArray *old_list;
+    guint i;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    time_now = orage_tm_time_to_icaltime(orage_localtime());
-        /* FIXME: This could be tuned since now it runs into the remaining
-           elements several times. They could be moved to another list and
-           removed and added back at the end, remove with g_list_remove_link */
-    for (alarm_l = g_list_first(g_par.alarm_list); 
-         alarm_l != NULL; 
-         alarm_l = g_list_first(g_par.alarm_list)) {
-        l_alarm = alarm_l->data;
-        if (l_alarm->temporary && (strcmp(time_now, l_alarm->alarm_time) < 0)) {
-            /* We keep temporary alarms, which have not yet fired.
-               Remove the element from the list, but do not loose it. */
-            g_par.alarm_list = g_list_remove_link(g_par.alarm_list, alarm_l);
-            /*
-            if (!kept_l)
-                kept_l = alarm_l;
-            else
-            */
-            kept_l = g_list_concat(kept_l, alarm_l);
-        }
-        else { /* get rid of that l_alarm element */
-            alarm_free(alarm_l->data);
-            g_par.alarm_list=g_list_remove(g_par.alarm_list, l_alarm);
+    if (g_par.alarm_list == NULL)
+        return;
+    time_now = time(NULL);
+    old_list = g_par.alarm_list;
+    g_par.alarm_list = g_ptr_array_new();
+    if (alarm_uids)
+        g_hash_table_remove_all(alarm_uids);
+    for (i = 0; i < old_list->len; i++) {
+        l_alarm = g_ptr_array_index(old_list, i);
+        if (l_alarm->temporary && time_now <= l_alarm->alarm_tt) {
+            /* We keep temporary alarms, which have not yet fired. */
+            l_alarm->heap_pos = g_par.alarm_list->len;
+            g_ptr_array_add(g_par.alarm_list, l_alarm);
+            alarm_uids_add(l_alarm);
         }
+        else /* get rid of that l_alarm element */
+            alarm_free(l_alarm);
     }
-    g_list_free(g_par.alarm_list);
-    g_par.alarm_list = NULL;
-    if (g_list_length(kept_l)) {
-        g_par.alarm_list = g_list_concat(g_par.alarm_list, kept_l);
-        g_par.alarm_list = g_list_sort(g_par.alarm_list, alarm_order);
-    }
+    g_ptr_array_free(old_list, TRUE);
+    /* restore heap order */
+    for (i = g_par.alarm_list->len / 2; i > 0; i--)
+        alarm_heap_down(i - 1);
 }
 
+/************************************************************/
+/* alarm heap end                                           */
+/************************************************************/
+
 static void alarm_free_memory(alarm_struct *l_alarm)
 {
 #undef P_N
@@ -185,7 +322,75 @@ void alarm_add(alarm_struct *l_alarm)
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    g_par.alarm_list = g_list_prepend(g_par.alarm_list, l_alarm);
+    if (g_par.alarm_list == NULL)
+        g_par.alarm_list = g_ptr_array_new();
+    l_alarm->alarm_tt = alarm_time_to_epoch(l_alarm->alarm_time);
+    g_ptr_array_add(g_par.alarm_list, l_alarm);
+    alarm_heap_up(g_par.alarm_list->len - 1);
+    alarm_uids_add(l_alarm);
+}
+
+/* remove alarms of one appointment. Temporary alarms are kept since they
+ * are not stored in the ical file and can not be created again */
+void alarm_remove_uid(const gchar *uid)
+{
+#undef P_N
+#define P_N "alarm_remove_uid: "
+    GSList *uid_l, *remove_l = NULL;
+    alarm_struct *l_alarm;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (alarm_uids == NULL)
+        return;
+    for (uid_l = g_hash_table_lookup(alarm_uids, uid); uid_l != NULL;
+         uid_l = g_slist_next(uid_l)) {
+        l_alarm = (alarm_struct *)uid_l->data;
+        if (!l_alarm->temporary)
+            remove_l = g_slist_prepend(remove_l, l_alarm);
+    }
+    /* removing changes alarm_uids, so it is done in separate loop */
+    for (uid_l = remove_l; uid_l != NULL; uid_l = g_slist_next(uid_l)) {
+        l_alarm = (alarm_struct *)uid_l->data;
+        alarm_free(alarm_heap_remove(l_alarm->heap_pos));
+    }
+    g_slist_free(remove_l);
+}
+
+/* remove alarms of one calendar file. file_type is the uid prefix of the
+ * file (O00., F01.,...). Temporary alarms are kept like in alarm_list_free */
+void alarm_remove_file(const gchar *file_type)
+{
+#undef P_N
+#define P_N "alarm_remove_file: "
+    alarm_struct *l_alarm;
+    GPtrArray *old_list;
+    guint i;
+
+#ifdef ORAGE_DEBUG
+    orage_message(-100, P_N);
+#endif
+    if (g_par.alarm_list == NULL)
+        return;
+    old_list = g_par.alarm_list;
+    g_par.alarm_list = g_ptr_array_sized_new(old_list->len);
+    for (i = 0; i < old_list->len; i++) {
+        l_alarm = g_ptr_array_index(old_list, i);
+        if (!l_alarm->temporary && l_alarm->uid
+        && g_str_has_prefix(l_alarm->uid, file_type)) {
+            alarm_uids_remove(l_alarm);
+            alarm_free(l_alarm);
+        }
+        else {
+            l_alarm->heap_pos = g_par.alarm_list->len;
+            g_ptr_array_add(g_par.alarm_list, l_alarm);
+        }
+    }
+    g_ptr_array_free(old_list, TRUE);
+    /* restore heap order */
+    for (i = g_par.alarm_list->len / 2; i > 0; i--)
+        alarm_heap_down(i - 1);
 }
 
 static alarm_struct *alarm_copy(alarm_struct *l_alarm, gboolean init)
@@ -401,7 +606,8 @@ static void store_persistent_alarms(void)
     orage_message(-100, P_N);
 #endif
     orc = orage_persistent_file_open(FALSE);
-    g_list_foreach(g_par.alarm_list, alarm_store, (gpointer)orc);
+    if (g_par.alarm_list)
+        g_ptr_array_foreach(g_par.alarm_list, alarm_store, (gpointer)orc);
     orage_rc_file_close(orc);
 }
 
@@ -990,34 +1196,36 @@ static gboolean orage_alarm_clock(gpointer user_data)
 {
 #undef P_N
 #define P_N "orage_alarm_clock: "
-    GList *alarm_l;
     alarm_struct *cur_alarm;
     gboolean alarm_raised=FALSE;
-    gboolean more_alarms=TRUE;
-    gchar *time_now;
+    GSList *uids = NULL, *uid_l;
+    time_t time_now;
                                                                                 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    time_now = orage_tm_time_to_icaltime(orage_localtime());
+    time_now = time(NULL);
   /* Check if there are any alarms to show */
-    for (alarm_l = g_list_first(g_par.alarm_list);
-         alarm_l != NULL && more_alarms;
-         alarm_l = g_list_next(alarm_l)) {
-        /* remember that it is sorted list */
-        cur_alarm = (alarm_struct *)alarm_l->data;
-        if (strcmp(time_now, cur_alarm->alarm_time) > 0) {
-            /*
-            g_print(P_N "time_now=%s alarm=%s\n", time_now, cur_alarm->alarm_time);
-            */
-            create_reminders(cur_alarm);
-            alarm_raised = TRUE;
+    while ((cur_alarm = alarm_heap_first()) != NULL
+            && cur_alarm->alarm_tt < time_now) {
+        alarm_heap_remove(0);
+        create_reminders(cur_alarm);
+        alarm_raised = TRUE;
+        /* normal alarms need to be created again for the next 
+         * repeating event, temporary alarms are gone now */
+        if (!cur_alarm->temporary)
+            uids = g_slist_prepend(uids, g_strdup(cur_alarm->uid));
+        alarm_free(cur_alarm);
+    }
+    if (uids) { /* this calls reset_orage_alarm_clock */
+        for (uid_l = uids; uid_l != NULL; uid_l = g_slist_next(uid_l)) {
+            xfical_alarm_refresh_uid((gchar *)uid_l->data);
+            g_free(uid_l->data);
         }
-        else /* sorted so scan can be stopped */
-            more_alarms = FALSE; 
+        g_slist_free(uids);
     }
-    if (alarm_raised)  /* at least one l_alarm processed, need new list */
-        xfical_alarm_build_list(FALSE); /* this calls reset_orage_alarm_clock */
+    else if (alarm_raised)
+        setup_orage_alarm_clock();
     else
         reset_orage_alarm_clock(); /* need to setup next timer */
     return(FALSE); /* only once */
@@ -1027,12 +1235,8 @@ static void reset_orage_alarm_clock(void)
 {
 #undef P_N
 #define P_N "reset_orage_alarm_clock: "
-    struct tm *t, t_alarm, t2;
-    GList *alarm_l;
     alarm_struct *cur_alarm;
-    gchar *next_alarm;
-    gint secs_to_alarm;
-    gint dd;
+    time_t secs_to_alarm;
 
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
@@ -1041,25 +1245,15 @@ static void reset_orage_alarm_clock(void)
         g_source_remove(g_par.alarm_timer);
         g_par.alarm_timer = 0;
     }
-    if (g_par.alarm_list) { /* we have alarms */
-        memcpy(&t2, orage_localtime(), sizeof(t2));
-        t = &t2;
-        t->tm_mon++;
-        t->tm_year = t->tm_year + 1900;
-        alarm_l = g_list_first(g_par.alarm_list);
-        cur_alarm = (alarm_struct *)alarm_l->data;
-        next_alarm = cur_alarm->alarm_time;
-        t_alarm = orage_icaltime_to_tm_time(next_alarm, FALSE);
+    if ((cur_alarm = alarm_heap_first()) != NULL) { /* we have alarms */
         /* let's find out how much time we have until l_alarm happens */
-        dd = orage_days_between(t, &t_alarm);
-        secs_to_alarm = t_alarm.tm_sec  - t->tm_sec
-                  + 60*(t_alarm.tm_min  - t->tm_min)
-                  + 60*60*(t_alarm.tm_hour - t->tm_hour)
-                  + 24*60*60*dd;
+        secs_to_alarm = cur_alarm->alarm_tt - time(NULL);
         secs_to_alarm += 1; /* alarm needs to come a bit later */
         if (secs_to_alarm < 1) /* rare, but possible */
             secs_to_alarm = 1;
-        g_par.alarm_timer = g_timeout_add_seconds(secs_to_alarm
+        if (secs_to_alarm > G_MAXINT) /* far future, check again later */
+            secs_to_alarm = G_MAXINT;
+        g_par.alarm_timer = g_timeout_add_seconds((guint)secs_to_alarm
                 , (GtkFunction) orage_alarm_clock, NULL);
     }
 }
@@ -1070,9 +1264,8 @@ static gboolean orage_tooltip_update(gpointer user_data)
 #undef P_N
 #define P_N "orage_tooltip_update: "
     struct tm *t;
-    GList *alarm_l;
+    GList *alarm_l, *first_l;
     alarm_struct *cur_alarm;
-    gboolean more_alarms=TRUE;
     GString *tooltip=NULL, *tooltip_highlight_helper=NULL;
     gint alarm_cnt=0;
     gint tooltip_alarm_limit=5;
@@ -1094,64 +1287,59 @@ static gboolean orage_tooltip_update(gpointer user_data)
     g_string_prepend(tooltip, "<span foreground=\"blue\" weight=\"bold\" underline=\"single\">");
     g_string_append(tooltip, " </span>");
   /* Check if there are any alarms to show */
-    for (alarm_l = g_list_first(g_par.alarm_list);
-         alarm_l != NULL && more_alarms;
-         alarm_l = g_list_next(alarm_l)) {
-        /* remember that it is sorted list */
+    first_l = alarm_first_alarms(tooltip_alarm_limit);
+    for (alarm_l = first_l; alarm_l != NULL; alarm_l = g_list_next(alarm_l)) {
         cur_alarm = (alarm_struct *)alarm_l->data;
-        if (alarm_cnt < tooltip_alarm_limit) {
-            if (strlen(cur_alarm->alarm_time) < XFICAL_APPT_DATE_FORMAT_LEN) { 
-               /* it is date = full day */
-                sscanf(cur_alarm->alarm_time, XFICAL_APPT_DATE_FORMAT
-                        , &year, &month, &day);
-                hour = 0; minute = 0; second = 0;
-            }
-            else {
-                sscanf(cur_alarm->alarm_time, XFICAL_APPT_TIME_FORMAT
-                        , &year, &month, &day, &hour, &minute, &second);
-            }
-            g_now = g_date_new_dmy(t->tm_mday, t->tm_mon + 1
-                    , t->tm_year + 1900);
-            g_alarm = g_date_new_dmy(day, month, year);
-            dd = g_date_days_between(g_now, g_alarm);
-            g_date_free(g_now);
-            g_date_free(g_alarm);
-            hh = hour - t->tm_hour;
-            min = minute - t->tm_min;
-            if (min < 0) {
-                min += 60;
-                hh -= 1;
-            }
-            if (hh < 0) {
-                hh += 24;
-                dd -= 1;
-            }
+        if (strlen(cur_alarm->alarm_time) < XFICAL_APPT_DATE_FORMAT_LEN) { 
+           /* it is date = full day */
+            sscanf(cur_alarm->alarm_time, XFICAL_APPT_DATE_FORMAT
+                    , &year, &month, &day);
+            hour = 0; minute = 0; second = 0;
+        }
+        else {
+            sscanf(cur_alarm->alarm_time, XFICAL_APPT_TIME_FORMAT
+                    , &year, &month, &day, &hour, &minute, &second);
+        }
+        g_now = g_date_new_dmy(t->tm_mday, t->tm_mon + 1
+                , t->tm_year + 1900);
+        g_alarm = g_date_new_dmy(day, month, year);
+        dd = g_date_days_between(g_now, g_alarm);
+        g_date_free(g_now);
+        g_date_free(g_alarm);
+        hh = hour - t->tm_hour;
+        min = minute - t->tm_min;
+        if (min < 0) {
+            min += 60;
+            hh -= 1;
+        }
+        if (hh < 0) {
+            hh += 24;
+            dd -= 1;
+        }
 /*
     orage_message(10, P_N "tooltip: alarm=%s hh=%d hh=%d min=%d", cur_alarm->alarm_time, dd, hh, min);
 */
-            g_string_append(tooltip, "<span weight=\"bold\">");
-            tooltip_highlight_helper = g_string_new(" </span>");
-            if (cur_alarm->temporary) { /* let's add a small mark */
-                g_string_append_c(tooltip_highlight_helper, '[');
-            }
-            tmp = cur_alarm->title 
-                ? g_markup_escape_text(cur_alarm->title
-                        , strlen(cur_alarm->title))
-                : g_strdup(_("No title defined"));
-            g_string_append_printf(tooltip_highlight_helper, "%s", tmp);
-            g_free(tmp);
-            if (cur_alarm->temporary) { /* let's add a small mark */
-                g_string_append_c(tooltip_highlight_helper, ']');
-            }
-            g_string_append_printf(tooltip, 
-                    _("\n%02d d %02d h %02d min to: %s"),
-                    dd, hh, min, tooltip_highlight_helper->str);
-            g_string_free(tooltip_highlight_helper, TRUE);
-            alarm_cnt++;
+        g_string_append(tooltip, "<span weight=\"bold\">");
+        tooltip_highlight_helper = g_string_new(" </span>");
+        if (cur_alarm->temporary) { /* let's add a small mark */
+            g_string_append_c(tooltip_highlight_helper, '[');
+        }
+        tmp = cur_alarm->title 
+            ? g_markup_escape_text(cur_alarm->title
+                    , strlen(cur_alarm->title))
+            : g_strdup(_("No title defined"));
+        g_string_append_printf(tooltip_highlight_helper, "%s", tmp);
+        g_free(tmp);
+        if (cur_alarm->temporary) { /* let's add a small mark */
+            g_string_append_c(tooltip_highlight_helper, ']');
         }
-        else /* sorted so scan can be stopped */
-            more_alarms = FALSE; 
+        g_string_append_printf(tooltip, 
+                _("\n%02d d %02d h %02d min to: %s"),
+                dd, hh, min, tooltip_highlight_helper->str);
+        g_string_free(tooltip_highlight_helper, TRUE);
+        alarm_cnt++;
     }
+    g_list_free(first_l);
     if (alarm_cnt == 0)
         g_string_append_printf(tooltip, _("\nNo active alarms found"));
     gtk_status_icon_set_tooltip_markup((GtkStatusIcon *)g_par.trayIcon, tooltip->str);
@@ -1211,8 +1399,6 @@ void setup_orage_alarm_clock(void)
 #ifdef ORAGE_DEBUG
     orage_message(-100, P_N);
 #endif
-    /* order the list */
-    g_par.alarm_list = g_list_sort(g_par.alarm_list, alarm_order);
     reset_orage_alarm_clock();
     store_persistent_alarms(); /* keep track of alarms when orage is down */
     /* We need to use timer since for some reason it does not work if we
@@ -36,6 +36,8 @@ typedef struct _active_alarm_struct
 typedef struct _alarm_struct
 {
     gchar   *alarm_time;
+    time_t   alarm_tt;    /* alarm_time in seconds, set by alarm_add */
+    guint    heap_pos;    /* position in g_par.alarm_list */
     gchar   *action_time; /* alarm is based on this time */
     gchar   *uid;
     gchar   *title;
@@ -71,6 +73,8 @@ typedef struct _alarm_struct
 gboolean orage_day_change(gpointer user_data);
 void setup_orage_alarm_clock(void);
 void alarm_add(alarm_struct *alarm);
+void alarm_remove_uid(const gchar *uid);
+void alarm_remove_file(const gchar *file_type);
 void alarm_read();
 void alarm_list_free();
 void create_reminders(alarm_struct *alarm);